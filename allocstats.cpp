@@ -0,0 +1,199 @@
+#include <atomic>
+#include <cstdint>
+#include "exceptions.h"
+#include "parser.h"
+#include "ast.h"
+#include "allocstats.h"
+
+namespace {
+
+// Counters are kept for tags in the three ranges used in this program
+// (token kinds, nonterminals from 1000, AST node types from 2000),
+// with one more bucket for any other tags
+const unsigned TAGS_PER_RANGE = 64;
+const unsigned NUM_RANGES = 3;
+const unsigned OTHER_BUCKET = NUM_RANGES * TAGS_PER_RANGE;
+const unsigned NUM_BUCKETS = OTHER_BUCKET + 1;
+
+struct Bucket {
+  std::atomic<uint64_t> constructed, destroyed, live, peak;
+  std::atomic<uint64_t> kid_bytes, kid_allocs;
+  std::atomic<uint64_t> str_bytes, str_allocs;
+  std::atomic<uint64_t> loc_bytes, loc_allocs;
+};
+
+Bucket g_buckets[NUM_BUCKETS];
+std::atomic<uint64_t> g_live, g_peak;  // over all tags
+std::atomic<uint64_t> g_location_copies, g_location_bytes;
+
+unsigned bucket_index(int tag) {
+  if (tag >= 0 && tag < int(NUM_RANGES * 1000) && tag % 1000 < int(TAGS_PER_RANGE)) {
+    return unsigned(tag / 1000) * TAGS_PER_RANGE + unsigned(tag % 1000);
+  }
+  return OTHER_BUCKET;
+}
+
+int bucket_tag(unsigned index) {
+  return int(index / TAGS_PER_RANGE) * 1000 + int(index % TAGS_PER_RANGE);
+}
+
+void add(std::atomic<uint64_t> &counter, uint64_t n) {
+  counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+void inc_live(std::atomic<uint64_t> &live_count, std::atomic<uint64_t> &peak_count) {
+  uint64_t live = live_count.fetch_add(1, std::memory_order_relaxed) + 1;
+  uint64_t peak = peak_count.load(std::memory_order_relaxed);
+  while (live > peak && !peak_count.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+void dec_live(std::atomic<uint64_t> &live_count) {
+  live_count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::string tag_name(unsigned index) {
+  if (index == OTHER_BUCKET) {
+    return "(other)";
+  }
+  // token kinds and AST node types share some names,
+  // so the tag number is included
+  int tag = bucket_tag(index);
+  std::string name;
+  try {
+    if (tag >= AST_ADD) {
+      name = ASTTreePrint().node_tag_to_string(tag);
+    } else {
+      name = ParserTreePrint().node_tag_to_string(tag);
+    }
+  } catch (RuntimeError &) {
+    name = "?";
+  }
+  return name + " (" + std::to_string(tag) + ")";
+}
+
+uint64_t get(const std::atomic<uint64_t> &counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+#ifdef ALLOC_STATS
+// Prints the report when the program exits
+class ExitReport {
+public:
+  ~ExitReport() {
+    alloc_stats_print(stderr);
+  }
+};
+
+ExitReport g_exit_report;
+#endif
+
+}
+
+bool alloc_stats_enabled() {
+#ifdef ALLOC_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+void alloc_stats_print(FILE *out) {
+  if (!alloc_stats_enabled()) {
+    fprintf(out, "Allocation statistics were not compiled in (build with ALLOC_STATS=1)\n");
+    return;
+  }
+
+  const unsigned NUM_COLUMNS = 8;
+  auto print_row = [out](const std::string &name, const uint64_t *row) {
+    fprintf(out, "%-22s", name.c_str());
+    for (unsigned j = 0; j < NUM_COLUMNS; j++) {
+      fprintf(out, " %11llu", (unsigned long long) row[j]);
+    }
+    fputc('\n', out);
+  };
+
+  fprintf(out, "%-22s %11s %11s %11s %11s %11s %11s %11s %11s\n", "tag", "created", "destroyed",
+          "live", "peak", "heap allocs", "kid bytes", "str bytes", "loc bytes");
+  uint64_t total[NUM_COLUMNS] = { 0 };
+  for (unsigned i = 0; i < NUM_BUCKETS; i++) {
+    const Bucket &b = g_buckets[i];
+    if (get(b.constructed) == 0 && get(b.peak) == 0) {
+      continue;
+    }
+    uint64_t row[NUM_COLUMNS] = {
+      get(b.constructed), get(b.destroyed), get(b.live), get(b.peak),
+      get(b.kid_allocs) + get(b.str_allocs) + get(b.loc_allocs),
+      get(b.kid_bytes), get(b.str_bytes), get(b.loc_bytes)
+    };
+    print_row(tag_name(i), row);
+    for (unsigned j = 0; j < NUM_COLUMNS; j++) {
+      total[j] += row[j];
+    }
+  }
+  // the per-tag peaks can be reached at different times, so the
+  // peak of the total isn't their sum
+  total[2] = get(g_live);
+  total[3] = get(g_peak);
+  print_row("total", total);
+  // a node's size without the accounting's own members
+  size_t node_size = sizeof(Node);
+#ifdef ALLOC_STATS
+  node_size -= NodeBase::ALLOC_STATS_BYTES;
+#endif
+  fprintf(out, "Node objects: %llu bytes (%zu bytes each)\n",
+          (unsigned long long) (total[0] * node_size), node_size);
+  fprintf(out, "Locations constructed or copied: %llu, source file name bytes: %llu\n",
+          (unsigned long long) get(g_location_copies), (unsigned long long) get(g_location_bytes));
+}
+
+size_t alloc_stats_string_bytes(const std::string &s) {
+  // libstdc++ strings store up to 15 characters inline
+  static const size_t inline_capacity = std::string().capacity();
+  return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
+void alloc_stats_node_created(int tag) {
+  Bucket &b = g_buckets[bucket_index(tag)];
+  add(b.constructed, 1);
+  inc_live(b.live, b.peak);
+  inc_live(g_live, g_peak);
+}
+
+void alloc_stats_node_destroyed(int tag) {
+  Bucket &b = g_buckets[bucket_index(tag)];
+  add(b.destroyed, 1);
+  dec_live(b.live);
+  dec_live(g_live);
+}
+
+void alloc_stats_node_retagged(int old_tag, int new_tag) {
+  unsigned old_index = bucket_index(old_tag), new_index = bucket_index(new_tag);
+  if (old_index != new_index) {
+    dec_live(g_buckets[old_index].live);
+    inc_live(g_buckets[new_index].live, g_buckets[new_index].peak);
+  }
+}
+
+void alloc_stats_kid_bytes(int tag, size_t bytes) {
+  Bucket &b = g_buckets[bucket_index(tag)];
+  add(b.kid_bytes, bytes);
+  add(b.kid_allocs, 1);
+}
+
+void alloc_stats_str_bytes(int tag, size_t bytes) {
+  Bucket &b = g_buckets[bucket_index(tag)];
+  add(b.str_bytes, bytes);
+  add(b.str_allocs, 1);
+}
+
+void alloc_stats_node_loc_bytes(int tag, size_t bytes) {
+  Bucket &b = g_buckets[bucket_index(tag)];
+  add(b.loc_bytes, bytes);
+  add(b.loc_allocs, 1);
+}
+
+void alloc_stats_location_copied(size_t bytes) {
+  add(g_location_copies, 1);
+  add(g_location_bytes, bytes);
+}
@@ -0,0 +1,49 @@
+#ifndef ALLOCSTATS_H
+#define ALLOCSTATS_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// Accounting of Node and Location allocations, for finding out where
+// the memory used by large trees goes.  It is compiled in only if
+// ALLOC_STATS is defined (build with "make ALLOC_STATS=1", after a
+// "make clean"); otherwise the hooks below are never called, and
+// there is no overhead.  Nodes are counted through the accounting
+// hooks of NodeBase (see node_base.h).
+//
+// For each node tag, the following are counted: Node constructions
+// and destructions, live and peak node counts, and heap allocations
+// (and bytes) for kid vectors, strings, and the source file names of
+// Locations copied into nodes.  The live and peak counts are also
+// kept over all nodes.  Locations are also counted overall, wherever
+// they are constructed or copied.  Counters are updated atomically,
+// so trees can be built by multiple threads.
+//
+// The report is printed to stderr at exit, and can also be
+// printed on demand with alloc_stats_print.
+
+// True if allocation accounting was compiled in
+bool alloc_stats_enabled();
+
+// Print the report: only tags that nodes have had are listed.
+// A node whose tag is changed (as Parser2 does, turning tokens into
+// AST leaves) counts as created with its original tag, and as
+// destroyed with its final tag.
+void alloc_stats_print(FILE *out);
+
+// Number of heap bytes used by a string's buffer
+// (0 if the string is short enough to be stored inline)
+size_t alloc_stats_string_bytes(const std::string &s);
+
+// Hooks called by NodeBase and Location (the *_bytes hooks
+// are called for each heap allocation)
+void alloc_stats_node_created(int tag);
+void alloc_stats_node_destroyed(int tag);
+void alloc_stats_node_retagged(int old_tag, int new_tag);
+void alloc_stats_kid_bytes(int tag, size_t bytes);
+void alloc_stats_str_bytes(int tag, size_t bytes);
+void alloc_stats_node_loc_bytes(int tag, size_t bytes);
+void alloc_stats_location_copied(size_t bytes);
+
+#endif // ALLOCSTATS_H
@@ -21,6 +21,10 @@ std::string ASTTreePrint::node_tag_to_string(int tag) const {
     return "VARREF";
   case AST_INT_LITERAL:
     return "INT_LITERAL";
+  case AST_ASSIGN:
+    return "ASSIGN";
+  case AST_STATEMENT_LIST:
+    return "STATEMENT_LIST";
   default:
     RuntimeError::raise("Unknown AST node type %d\n", tag);
   }
@@ -11,6 +11,8 @@ enum ASTKind {
   AST_DIVIDE,
   AST_VARREF,
   AST_INT_LITERAL,
+  AST_ASSIGN,          // kids are target VARREF and expression
+  AST_STATEMENT_LIST,  // kids are AST_ASSIGN statements
 };
 
 class ASTTreePrint : public TreePrint {
@@ -0,0 +1,291 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "exceptions.h"
+#include "astfile.h"
+
+namespace {
+
+// Builds the node records and string table for write_ast_file
+class ASTFileBuilder {
+public:
+  std::vector<uint64_t> roots;
+  std::vector<ASTFileNode> nodes;
+  std::string strtab;
+
+private:
+  std::unordered_map<std::string, uint64_t> m_strings;
+
+public:
+  void add_tree(const Node *t);
+
+private:
+  uint64_t intern(const std::string &s);
+};
+
+void ASTFileBuilder::add_tree(const Node *t) {
+  roots.push_back(nodes.size());
+
+  // preorder traversal: when all of a node's kids are done,
+  // its subtree size is known
+  std::vector<std::pair<const Node *, uint64_t>> work; // node, record index
+  std::vector<unsigned> next_kid;
+  work.push_back({ t, 0 });
+  next_kid.push_back(0);
+
+  auto add_record = [this](const Node *n) {
+    ASTFileNode rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.tag = n->get_tag();
+    rec.num_kids = n->get_num_kids();
+    rec.str_offset = intern(n->get_str());
+    rec.str_len = uint32_t(n->get_str().size());
+    const Location &loc = n->get_loc();
+    std::string srcfile = loc.get_srcfile();
+    rec.srcfile_offset = intern(srcfile);
+    rec.srcfile_len = uint32_t(srcfile.size());
+    rec.line = loc.get_line();
+    rec.col = loc.get_col();
+    rec.flags = n->has_ival() ? ASTFILE_HAS_IVAL : 0;
+    rec.slot = n->get_slot();
+    rec.ival = n->get_ival();
+    nodes.push_back(rec);
+    return uint64_t(nodes.size() - 1);
+  };
+
+  work.back().second = add_record(t);
+  while (!work.empty()) {
+    const Node *n = work.back().first;
+    if (next_kid.back() < n->get_num_kids()) {
+      const Node *kid = n->get_kid(next_kid.back()++);
+      uint64_t index = add_record(kid);
+      work.push_back({ kid, index });
+      next_kid.push_back(0);
+    } else {
+      uint64_t index = work.back().second;
+      nodes[index].subtree_size = nodes.size() - index;
+      work.pop_back();
+      next_kid.pop_back();
+    }
+  }
+}
+
+uint64_t ASTFileBuilder::intern(const std::string &s) {
+  auto i = m_strings.find(s);
+  if (i != m_strings.end()) {
+    return i->second;
+  }
+  uint64_t offset = strtab.size();
+  strtab += s;
+  m_strings[s] = offset;
+  return offset;
+}
+
+bool in_bounds(uint64_t offset, uint64_t len, uint64_t size) {
+  return offset <= size && len <= size - offset;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// Writing AST files
+////////////////////////////////////////////////////////////////////////
+
+void write_ast_file(const std::string &filename, const std::vector<const Node *> &roots) {
+  ASTFileBuilder builder;
+  for (auto i = roots.begin(); i != roots.end(); ++i) {
+    builder.add_tree(*i);
+  }
+
+  ASTFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "ASTB", 4);
+  header.byte_order = ASTFILE_BYTE_ORDER;
+  header.version = ASTFILE_VERSION;
+  header.node_size = sizeof(ASTFileNode);
+  header.num_roots = builder.roots.size();
+  header.num_nodes = builder.nodes.size();
+  header.roots_offset = sizeof(ASTFileHeader);
+  header.nodes_offset = header.roots_offset + header.num_roots*sizeof(uint64_t);
+  header.strtab_offset = header.nodes_offset + header.num_nodes*sizeof(ASTFileNode);
+  header.strtab_size = builder.strtab.size();
+
+  FILE *out = fopen(filename.c_str(), "wb");
+  if (!out) {
+    RuntimeError::raise("Could not open output file '%s': %s", filename.c_str(), strerror(errno));
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+  ok = ok && fwrite(builder.roots.data(), sizeof(uint64_t), builder.roots.size(), out) == builder.roots.size();
+  ok = ok && fwrite(builder.nodes.data(), sizeof(ASTFileNode), builder.nodes.size(), out) == builder.nodes.size();
+  ok = ok && fwrite(builder.strtab.data(), 1, builder.strtab.size(), out) == builder.strtab.size();
+  ok = (fclose(out) == 0) && ok;
+  if (!ok) {
+    RuntimeError::raise("Error writing AST file '%s'", filename.c_str());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// MappedNode implementation
+////////////////////////////////////////////////////////////////////////
+
+std::string_view MappedNode::get_str() const {
+  return std::string_view(m_file->get_strtab() + m_rec->str_offset, m_rec->str_len);
+}
+
+std::string_view MappedNode::get_srcfile() const {
+  return std::string_view(m_file->get_strtab() + m_rec->srcfile_offset, m_rec->srcfile_len);
+}
+
+MappedNode MappedNode::get_kid(unsigned index) const {
+  if (index >= get_num_kids()) {
+    RuntimeError::raise("Kid index %u out of range", index);
+  }
+  MappedNode kid = first_kid();
+  for (unsigned i = 0; i < index; i++) {
+    kid = kid.next_sibling();
+  }
+  return kid;
+}
+
+Node *MappedNode::materialize() const {
+  std::unique_ptr<Node> root;
+  std::vector<std::pair<Node *, unsigned>> stack; // node, kids remaining
+
+  for (uint64_t i = 0; i < m_rec->subtree_size; i++) {
+    MappedNode src(m_file, m_rec + i);
+    Node *n = new Node(src.get_tag(), std::string(src.get_str()));
+    if (src.get_line() > 0) {
+      n->set_loc(Location(std::string(src.get_srcfile()), src.get_line(), src.get_col()));
+    }
+    if (src.has_ival()) {
+      n->set_ival(src.get_ival());
+    }
+    n->set_slot(src.get_slot());
+
+    if (stack.empty()) {
+      root.reset(n);
+    } else {
+      stack.back().first->append_kid(n);
+      stack.back().second--;
+    }
+    if (src.get_num_kids() > 0) {
+      stack.push_back({ n, src.get_num_kids() });
+    }
+    while (!stack.empty() && stack.back().second == 0) {
+      stack.pop_back();
+    }
+  }
+
+  return root.release();
+}
+
+////////////////////////////////////////////////////////////////////////
+// MappedASTFile implementation
+////////////////////////////////////////////////////////////////////////
+
+MappedASTFile::MappedASTFile(const std::string &filename)
+  : m_filename(filename)
+  , m_base(nullptr)
+  , m_size(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    RuntimeError::raise("Could not open AST file '%s': %s", filename.c_str(), strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(ASTFileHeader)) {
+    close(fd);
+    RuntimeError::raise("'%s' is not an AST file", filename.c_str());
+  }
+  m_size = size_t(st.st_size);
+  m_base = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m_base == MAP_FAILED) {
+    m_base = nullptr;
+    RuntimeError::raise("Could not map AST file '%s': %s", filename.c_str(), strerror(errno));
+  }
+
+  m_header = static_cast<const ASTFileHeader *>(m_base);
+  const ASTFileHeader &h = *m_header;
+  bool ok = memcmp(h.magic, "ASTB", 4) == 0
+    && h.byte_order == ASTFILE_BYTE_ORDER
+    && h.version == ASTFILE_VERSION
+    && h.node_size == sizeof(ASTFileNode)
+    && h.roots_offset % 8 == 0 && h.nodes_offset % 8 == 0
+    && h.num_roots <= m_size / sizeof(uint64_t)
+    && h.num_nodes <= m_size / sizeof(ASTFileNode)
+    && in_bounds(h.roots_offset, h.num_roots*sizeof(uint64_t), m_size)
+    && in_bounds(h.nodes_offset, h.num_nodes*sizeof(ASTFileNode), m_size)
+    && in_bounds(h.strtab_offset, h.strtab_size, m_size);
+  if (!ok) {
+    munmap(m_base, m_size);
+    m_base = nullptr;
+    RuntimeError::raise("'%s' is not a valid AST file (version %u)", filename.c_str(), ASTFILE_VERSION);
+  }
+
+  const char *base = static_cast<const char *>(m_base);
+  m_roots = reinterpret_cast<const uint64_t *>(base + h.roots_offset);
+  m_nodes = reinterpret_cast<const ASTFileNode *>(base + h.nodes_offset);
+  m_strtab = base + h.strtab_offset;
+}
+
+MappedASTFile::~MappedASTFile() {
+  if (m_base) {
+    munmap(m_base, m_size);
+  }
+}
+
+MappedNode MappedASTFile::get_root(uint64_t index) const {
+  if (index >= get_num_roots() || m_roots[index] >= get_num_nodes()) {
+    RuntimeError::raise("Invalid root index %lu in AST file '%s'", (unsigned long) index, m_filename.c_str());
+  }
+  return MappedNode(this, m_nodes + m_roots[index]);
+}
+
+void MappedASTFile::validate() const {
+  uint64_t num_nodes = get_num_nodes(), strtab_size = m_header->strtab_size;
+  struct Pending {
+    uint64_t end;       // index just past the subtree
+    uint32_t kids_left;
+  };
+  std::vector<Pending> stack;
+
+  for (uint64_t r = 0; r < get_num_roots(); r++) {
+    uint64_t start = m_roots[r];
+    if (start >= num_nodes || !in_bounds(start, m_nodes[start].subtree_size, num_nodes)) {
+      RuntimeError::raise("AST file '%s': invalid root %lu", m_filename.c_str(), (unsigned long) r);
+    }
+    uint64_t end = start + m_nodes[start].subtree_size;
+
+    for (uint64_t i = start; i < end; i++) {
+      const ASTFileNode &rec = m_nodes[i];
+      uint64_t limit = stack.empty() ? end : stack.back().end;
+      bool ok = rec.subtree_size >= 1 && in_bounds(i, rec.subtree_size, limit)
+        && in_bounds(rec.str_offset, rec.str_len, strtab_size)
+        && in_bounds(rec.srcfile_offset, rec.srcfile_len, strtab_size)
+        && (stack.empty() || stack.back().kids_left > 0);
+      if (!ok) {
+        RuntimeError::raise("AST file '%s': corrupt node record %lu", m_filename.c_str(), (unsigned long) i);
+      }
+      if (!stack.empty()) {
+        stack.back().kids_left--;
+      }
+      stack.push_back({ i + rec.subtree_size, rec.num_kids });
+
+      // pop the subtrees that end with this node
+      while (!stack.empty() && stack.back().end == i + 1) {
+        if (stack.back().kids_left != 0) {
+          RuntimeError::raise("AST file '%s': wrong kid count in subtree ending at node %lu",
+                              m_filename.c_str(), (unsigned long) i);
+        }
+        stack.pop_back();
+      }
+    }
+  }
+}
@@ -0,0 +1,128 @@
+#ifndef ASTFILE_H
+#define ASTFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "node.h"
+
+// Binary file format for trees, designed to be memory-mapped and used
+// directly, with no parsing and no per-node allocation.  The file is
+// position independent (all references are offsets or indices):
+//
+//   header       ASTFileHeader
+//   root table   num_roots uint64_t node indices
+//   node table   num_nodes ASTFileNode records, each tree in preorder
+//   string table node strings and source file names, deduplicated
+//
+// In preorder, a node's first kid immediately follows it, and its
+// next sibling follows its last descendant (at index + subtree_size.)
+// Values are stored in native byte order; the header's byte order
+// mark lets readers reject files written on a different architecture.
+
+const uint32_t ASTFILE_VERSION = 1;
+const uint32_t ASTFILE_BYTE_ORDER = 0x01020304;
+
+struct ASTFileHeader {
+  char magic[4];           // "ASTB"
+  uint32_t byte_order;     // ASTFILE_BYTE_ORDER
+  uint32_t version;        // ASTFILE_VERSION
+  uint32_t node_size;      // sizeof(ASTFileNode)
+  uint64_t num_roots;
+  uint64_t num_nodes;
+  uint64_t roots_offset;
+  uint64_t nodes_offset;
+  uint64_t strtab_offset;
+  uint64_t strtab_size;
+};
+
+struct ASTFileNode {
+  int32_t tag;
+  uint32_t num_kids;
+  uint64_t subtree_size;   // number of nodes in subtree, including this one
+  uint64_t str_offset;     // node string (offset in string table)
+  uint64_t srcfile_offset; // source file name
+  uint32_t str_len;
+  uint32_t srcfile_len;
+  int32_t line, col;
+  uint32_t flags;          // ASTFILE_HAS_IVAL
+  int32_t slot;
+  int64_t ival;
+};
+
+const uint32_t ASTFILE_HAS_IVAL = 1;
+
+// Write trees to a binary AST file.
+// Throws RuntimeError if the file can't be written.
+void write_ast_file(const std::string &filename, const std::vector<const Node *> &roots);
+
+class MappedASTFile;
+
+// Lightweight handle to a node in a memory-mapped AST file:
+// valid as long as the MappedASTFile it came from
+class MappedNode {
+private:
+  const MappedASTFile *m_file;
+  const ASTFileNode *m_rec;
+
+public:
+  MappedNode(const MappedASTFile *file, const ASTFileNode *rec) : m_file(file), m_rec(rec) { }
+
+  int get_tag() const { return m_rec->tag; }
+  unsigned get_num_kids() const { return m_rec->num_kids; }
+  uint64_t get_subtree_size() const { return m_rec->subtree_size; }
+  std::string_view get_str() const;
+  std::string_view get_srcfile() const;
+  int get_line() const { return m_rec->line; }
+  int get_col() const { return m_rec->col; }
+  bool has_ival() const { return (m_rec->flags & ASTFILE_HAS_IVAL) != 0; }
+  int64_t get_ival() const { return m_rec->ival; }
+  int get_slot() const { return m_rec->slot; }
+
+  // Kid access: get_kid is linear in index, so to iterate over
+  // all kids, use first_kid and next_sibling
+  MappedNode first_kid() const { return MappedNode(m_file, m_rec + 1); }
+  MappedNode next_sibling() const { return MappedNode(m_file, m_rec + m_rec->subtree_size); }
+  MappedNode get_kid(unsigned index) const;
+
+  // Build an ordinary heap-allocated copy of the subtree
+  Node *materialize() const;
+};
+
+// Read-only memory mapping of a binary AST file
+class MappedASTFile {
+private:
+  std::string m_filename;
+  void *m_base;
+  size_t m_size;
+  const ASTFileHeader *m_header;
+  const uint64_t *m_roots;
+  const ASTFileNode *m_nodes;
+  const char *m_strtab;
+
+  // no value semantics
+  MappedASTFile(const MappedASTFile &);
+  MappedASTFile &operator=(const MappedASTFile &);
+
+public:
+  // Map the file and check its header: node records are not examined
+  // (see validate.)  Throws RuntimeError if the file can't be mapped
+  // or isn't a valid AST file.
+  MappedASTFile(const std::string &filename);
+  ~MappedASTFile();
+
+  uint64_t get_num_roots() const { return m_header->num_roots; }
+  uint64_t get_num_nodes() const { return m_header->num_nodes; }
+  MappedNode get_root(uint64_t index) const;
+
+  // Check every node record (string bounds and tree structure),
+  // throwing RuntimeError if the file is corrupt.  This is linear in
+  // the size of the file, so it is optional for trusted files.
+  void validate() const;
+
+  const char *get_strtab() const { return m_strtab; }
+};
+
+#endif // ASTFILE_H
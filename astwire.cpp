@@ -0,0 +1,295 @@
+#include <memory>
+#include <utility>
+#include "exceptions.h"
+#include "astwire.h"
+
+namespace {
+
+// Node tags are encoded as single bytes: tags in the three ranges
+// used in this program (token kinds, nonterminals starting at 1000,
+// and AST node types starting at 2000) map to 0-63, 64-127, and
+// 128-191.  Any other tag is written as ESCAPE_TAG followed by
+// the zigzag-encoded tag.  Bytes from NUM_TAG_BYTES up to ESCAPE_TAG
+// are unused.
+const unsigned char ESCAPE_TAG = 0xFF;
+const int NUM_TAG_BYTES = 3*64;
+
+// flag bits in a node's info varint
+const uint64_t HAS_IVAL = 1, HAS_SLOT = 2, NEW_SRCFILE = 4, EXPLICIT_LOC = 8;
+const unsigned INFO_FLAG_BITS = 4;
+
+// string references
+const uint64_t EMPTY_STRING = 0, NEW_STRING = 1, FIRST_STRING_INDEX = 2;
+
+int tag_to_byte(int tag) {
+  if (tag >= 0 && tag < 3000 && tag % 1000 < 64) {
+    return (tag / 1000)*64 + tag % 1000;
+  }
+  return ESCAPE_TAG;
+}
+
+uint64_t zigzag(int64_t n) {
+  return (uint64_t(n) << 1) ^ uint64_t(n >> 63);
+}
+
+int64_t unzigzag(uint64_t n) {
+  return int64_t(n >> 1) ^ -int64_t(n & 1);
+}
+
+void put_varint(std::string &out, uint64_t n) {
+  while (n >= 0x80) {
+    out.push_back(char((n & 0x7F) | 0x80));
+    n >>= 7;
+  }
+  out.push_back(char(n));
+}
+
+// Decode a varint: returns false if the input ends first
+bool get_varint(const unsigned char *&p, const unsigned char *end, uint64_t &n) {
+  n = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (p == end) {
+      return false;
+    }
+    unsigned char b = *p++;
+    n |= uint64_t(b & 0x7F) << shift;
+    if ((b & 0x80) == 0) {
+      return true;
+    }
+  }
+  RuntimeError::raise("Corrupt AST stream: varint too long");
+}
+
+uint64_t read_varint(const unsigned char *&p, const unsigned char *end) {
+  uint64_t n;
+  if (!get_varint(p, end, n)) {
+    RuntimeError::raise("Corrupt AST stream: truncated node");
+  }
+  return n;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// ASTWireEncoder implementation
+////////////////////////////////////////////////////////////////////////
+
+ASTWireEncoder::ASTWireEncoder(OutputBuffer &out)
+  : m_out(out) {
+}
+
+ASTWireEncoder::~ASTWireEncoder() {
+}
+
+void ASTWireEncoder::encode(const Node *t) {
+  m_body.clear();
+  size_t num_strings = m_strings.size();
+
+  // preorder traversal; each node is paired with its parent,
+  // since locations are encoded relative to the parent's location
+  const Location no_loc;
+  std::vector<std::pair<const Node *, const Node *>> work;
+  work.push_back({ t, nullptr });
+  while (!work.empty()) {
+    const Node *n = work.back().first;
+    const Location &parent_loc = work.back().second ? work.back().second->get_loc() : no_loc;
+    work.pop_back();
+
+    int tag = n->get_tag();
+    int tag_byte = tag_to_byte(tag);
+    m_body.push_back(char(tag_byte));
+    if (tag_byte == ESCAPE_TAG) {
+      put_varint(m_body, zigzag(tag));
+    }
+
+    const Location &loc = n->get_loc();
+    bool new_srcfile = loc.get_srcfile() != parent_loc.get_srcfile();
+    uint64_t info = uint64_t(n->get_num_kids()) << INFO_FLAG_BITS;
+    info |= n->has_ival() ? HAS_IVAL : 0;
+    info |= n->get_slot() >= 0 ? HAS_SLOT : 0;
+    info |= new_srcfile ? NEW_SRCFILE : 0;
+    info |= n->is_loc_explicit() ? EXPLICIT_LOC : 0;
+    put_varint(m_body, info);
+    if (n->has_ival()) {
+      put_varint(m_body, zigzag(n->get_ival()));
+    }
+    if (n->get_slot() >= 0) {
+      put_varint(m_body, uint64_t(n->get_slot()));
+    }
+
+    encode_string(n->get_str());
+    if (new_srcfile) {
+      encode_string(loc.get_srcfile());
+    }
+    put_varint(m_body, zigzag(int64_t(loc.get_line()) - parent_loc.get_line()));
+    put_varint(m_body, zigzag(int64_t(loc.get_col()) - parent_loc.get_col()));
+
+    // push kids in reverse, so they are encoded in order
+    for (unsigned i = n->get_num_kids(); i > 0; i--) {
+      work.push_back({ n->get_kid(i - 1), n });
+    }
+  }
+
+  std::string len;
+  put_varint(len, m_body.size());
+  try {
+    m_out.write(len);
+    m_out.write(m_body);
+  } catch (...) {
+    forget_strings(num_strings);
+    throw;
+  }
+}
+
+void ASTWireEncoder::encode_string(const std::string &s) {
+  if (s.empty()) {
+    put_varint(m_body, EMPTY_STRING);
+    return;
+  }
+
+  auto i = m_strings.find(s);
+  if (i != m_strings.end()) {
+    put_varint(m_body, FIRST_STRING_INDEX + i->second);
+    return;
+  }
+
+  put_varint(m_body, NEW_STRING);
+  put_varint(m_body, s.size());
+  m_body += s;
+  if (m_strings.size() < ASTWIRE_MAX_STRINGS) {
+    uint64_t index = m_strings.size();
+    m_strings[s] = index;
+  }
+}
+
+void ASTWireEncoder::forget_strings(size_t num_kept) {
+  for (auto i = m_strings.begin(); i != m_strings.end(); ) {
+    if (i->second >= num_kept) {
+      i = m_strings.erase(i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// ASTWireDecoder implementation
+////////////////////////////////////////////////////////////////////////
+
+ASTWireDecoder::ASTWireDecoder()
+  : m_pos(0) {
+}
+
+ASTWireDecoder::~ASTWireDecoder() {
+}
+
+void ASTWireDecoder::feed(const char *data, size_t len) {
+  // discard decoded bytes once they make up most of the buffer
+  if (m_pos > 0 && m_pos >= m_input.size()/2) {
+    m_input.erase(0, m_pos);
+    m_pos = 0;
+  }
+  m_input.append(data, len);
+}
+
+Node *ASTWireDecoder::next() {
+  const unsigned char *start = reinterpret_cast<const unsigned char *>(m_input.data());
+  const unsigned char *p = start + m_pos, *end = start + m_input.size();
+
+  uint64_t body_len;
+  if (!get_varint(p, end, body_len) || body_len > uint64_t(end - p)) {
+    // frame not completely received yet
+    return nullptr;
+  }
+
+  Node *t = decode_body(p, p + body_len);
+  m_pos = size_t((p + body_len) - start);
+  return t;
+}
+
+Node *ASTWireDecoder::decode_body(const unsigned char *p, const unsigned char *end) {
+  std::unique_ptr<Node> root;
+  std::vector<std::pair<Node *, uint64_t>> stack; // node, kids remaining
+  const Location no_loc;
+
+  do {
+    if (p == end) {
+      RuntimeError::raise("Corrupt AST stream: truncated tree");
+    }
+    int tag = *p++;
+    if (tag == ESCAPE_TAG) {
+      tag = int(unzigzag(read_varint(p, end)));
+    } else if (tag < NUM_TAG_BYTES) {
+      tag = (tag / 64)*1000 + tag % 64;
+    } else {
+      RuntimeError::raise("Corrupt AST stream: invalid tag byte %d", tag);
+    }
+
+    uint64_t info = read_varint(p, end);
+    uint64_t num_kids = info >> INFO_FLAG_BITS;
+    int64_t ival = (info & HAS_IVAL) ? unzigzag(read_varint(p, end)) : 0;
+    int slot = (info & HAS_SLOT) ? int(read_varint(p, end)) : -1;
+
+    Node *n = new Node(tag, decode_string(p, end));
+    if (stack.empty()) {
+      root.reset(n);
+    } else {
+      stack.back().first->append_kid(n);
+      stack.back().second--;
+    }
+
+    const Location &parent_loc = stack.empty() ? no_loc : stack.back().first->get_loc();
+    std::string srcfile = (info & NEW_SRCFILE) ? decode_string(p, end) : parent_loc.get_srcfile();
+    int line = int(parent_loc.get_line() + unzigzag(read_varint(p, end)));
+    int col = int(parent_loc.get_col() + unzigzag(read_varint(p, end)));
+    n->set_loc(Location(srcfile, line, col), (info & EXPLICIT_LOC) != 0);
+    if (info & HAS_IVAL) {
+      n->set_ival(ival);
+    }
+    n->set_slot(slot);
+
+    // a node's location must be known before its kids are decoded,
+    // so it's pushed only after its location was set
+    if (num_kids > 0) {
+      stack.push_back({ n, num_kids });
+    }
+    while (!stack.empty() && stack.back().second == 0) {
+      stack.pop_back();
+    }
+  } while (!stack.empty());
+
+  if (p != end) {
+    RuntimeError::raise("Corrupt AST stream: extra bytes after tree");
+  }
+  return root.release();
+}
+
+const std::string &ASTWireDecoder::decode_string(const unsigned char *&p, const unsigned char *end) {
+  static const std::string empty;
+
+  uint64_t ref = read_varint(p, end);
+  if (ref == EMPTY_STRING) {
+    return empty;
+  }
+  if (ref >= FIRST_STRING_INDEX) {
+    if (ref - FIRST_STRING_INDEX >= m_strings.size()) {
+      RuntimeError::raise("Corrupt AST stream: invalid string reference");
+    }
+    return m_strings[ref - FIRST_STRING_INDEX];
+  }
+
+  uint64_t len = read_varint(p, end);
+  if (len > uint64_t(end - p)) {
+    RuntimeError::raise("Corrupt AST stream: truncated string");
+  }
+  std::string s(reinterpret_cast<const char *>(p), len);
+  p += len;
+
+  // once the table is full, new strings are sent inline every time
+  if (m_strings.size() < ASTWIRE_MAX_STRINGS) {
+    m_strings.push_back(s);
+    return m_strings.back();
+  }
+  m_overflow = s;
+  return m_overflow;
+}
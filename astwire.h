@@ -0,0 +1,91 @@
+#ifndef ASTWIRE_H
+#define ASTWIRE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "node.h"
+#include "outbuf.h"
+
+// Compact streaming encoding of trees, for sending them between
+// processes.  A stream is a sequence of frames, one per tree:
+//
+//   frame  := varint(body length) body
+//   body   := node*                  (preorder)
+//   node   := tag info [ival] [slot] strref [srcfileref] dline dcol
+//
+// where tag is a single byte (see the .cpp file; unusual tags are
+// escaped), info is varint(num_kids << 4 | flags), ival and dline/dcol
+// are zigzag varints, and strings are references into a string table
+// that both ends build up as the stream proceeds.  Source locations
+// are delta-encoded against the parent node's location, and the source
+// file name is only sent when it differs from the parent's.  A flag
+// records whether the location was set explicitly (see Node), so
+// decoded trees match the encoded ones.
+//
+// Encoder and decoder keep state (the string table) for the whole
+// stream, so one encoder must feed one decoder, in order.
+
+// Maximum number of entries in a stream's string table
+const size_t ASTWIRE_MAX_STRINGS = 1 << 16;
+
+class ASTWireEncoder {
+private:
+  OutputBuffer &m_out;
+  std::unordered_map<std::string, uint64_t> m_strings;
+  std::string m_body;
+
+  // no value semantics
+  ASTWireEncoder(const ASTWireEncoder &);
+  ASTWireEncoder &operator=(const ASTWireEncoder &);
+
+public:
+  ASTWireEncoder(OutputBuffer &out);
+  ~ASTWireEncoder();
+
+  // Write one tree as a frame (the output buffer is not flushed).
+  // If writing the frame fails, strings first sent in it are
+  // forgotten, so a caller that discards the partial frame can
+  // go on with the stream.
+  void encode(const Node *t);
+
+private:
+  void encode_string(const std::string &s);
+  void forget_strings(size_t num_kept);
+};
+
+class ASTWireDecoder {
+private:
+  std::vector<std::string> m_strings;
+  std::string m_overflow; // new string received when the table is full
+  std::string m_input;   // bytes received but not yet decoded
+  size_t m_pos;          // start of undecoded bytes in m_input
+
+  // no value semantics
+  ASTWireDecoder(const ASTWireDecoder &);
+  ASTWireDecoder &operator=(const ASTWireDecoder &);
+
+public:
+  ASTWireDecoder();
+  ~ASTWireDecoder();
+
+  // Add bytes received from the stream: they can be split at
+  // arbitrary points
+  void feed(const char *data, size_t len);
+
+  // Decode the next tree, or return nullptr if its frame hasn't
+  // been completely received yet.  Throws RuntimeError if the
+  // stream is corrupt.
+  Node *next();
+
+  // Number of received bytes not yet decoded
+  size_t get_num_pending() const { return m_input.size() - m_pos; }
+
+private:
+  Node *decode_body(const unsigned char *p, const unsigned char *end);
+  const std::string &decode_string(const unsigned char *&p, const unsigned char *end);
+};
+
+#endif // ASTWIRE_H
@@ -0,0 +1,70 @@
+#include "eval.h"
+#include "treeutil.h"
+#include "batcheval.h"
+
+namespace {
+
+struct BatchTask {
+  const Node *expr;
+  size_t expr_nodes;
+  const Dataset *data;
+  int64_t *results;        // results for this expression
+  size_t begin, end;       // row range
+  size_t grain;
+  WorkStealingPool *pool;
+
+  void operator()();
+};
+
+void BatchTask::operator()() {
+  // the initial task for each expression sizes it, so that
+  // counting nodes is done in parallel too
+  if (expr_nodes == 0) {
+    expr_nodes = count_nodes(expr);
+  }
+
+  size_t lo = begin, hi = end;
+
+  // split off the upper half of the row range while this task
+  // has more than its share of work
+  while (hi - lo > 1 && (hi - lo)*expr_nodes > grain) {
+    size_t mid = lo + (hi - lo)/2;
+    BatchTask upper(*this);
+    upper.begin = mid;
+    upper.end = hi;
+    pool->submit(upper);
+    hi = mid;
+  }
+
+  // each worker thread keeps one Evaluator, so its scratch
+  // stacks are reused across tasks
+  thread_local Evaluator evaluator;
+  unsigned nslots = data->num_slots;
+  for (size_t r = lo; r < hi; r++) {
+    results[r] = evaluator.eval(expr, data->values + r*nslots);
+  }
+}
+
+}
+
+void eval_batch(const std::vector<const Node *> &exprs, const Dataset &data,
+                int64_t *results, WorkStealingPool &pool, size_t grain) {
+  if (data.num_rows == 0) {
+    return;
+  }
+
+  for (size_t e = 0; e < exprs.size(); e++) {
+    BatchTask task;
+    task.expr = exprs[e];
+    task.expr_nodes = 0;
+    task.data = &data;
+    task.results = results + e*data.num_rows;
+    task.begin = 0;
+    task.end = data.num_rows;
+    task.grain = grain > 0 ? grain : 1;
+    task.pool = &pool;
+    pool.submit(task);
+  }
+
+  pool.wait();
+}
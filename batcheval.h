@@ -0,0 +1,34 @@
+#ifndef BATCHEVAL_H
+#define BATCHEVAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "node.h"
+#include "workpool.h"
+
+// Row-major table of variable values: the value of slot s
+// in row r is values[r*num_slots + s]
+struct Dataset {
+  const int64_t *values;
+  size_t num_rows;
+  unsigned num_slots;
+};
+
+// Evaluate each expression on each row of a dataset, in parallel.
+// The value of expression e on row r is stored in
+// results[e*data.num_rows + r].  The expressions must have been bound
+// (see bind_varrefs) using the symbol table that defines the dataset's
+// slots.
+//
+// Work is split into (expression x row range) tasks of roughly
+// grain node evaluations each: a task with more work than that splits
+// off half of its rows for other workers to steal, so very large and
+// very small expressions are balanced automatically.
+//
+// If an evaluation fails, the EvaluationError is rethrown (the
+// contents of results are then unspecified.)
+void eval_batch(const std::vector<const Node *> &exprs, const Dataset &data,
+                int64_t *results, WorkStealingPool &pool, size_t grain = 65536);
+
+#endif // BATCHEVAL_H
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include "ast.h"
+#include "exceptions.h"
+#include "batchplan.h"
+
+namespace {
+
+// number of rows evaluated together (each step's column for the
+// block is BLOCK_ROWS values)
+const size_t BLOCK_ROWS = 256;
+
+struct StepKey {
+  int op;
+  int64_t val;
+  unsigned lhs, rhs;
+
+  bool operator==(const StepKey &other) const {
+    return op == other.op && val == other.val && lhs == other.lhs && rhs == other.rhs;
+  }
+};
+
+struct StepKeyHash {
+  size_t operator()(const StepKey &k) const {
+    uint64_t h = uint64_t(k.op) * 0x9E3779B97F4A7C15ULL;
+    h ^= uint64_t(k.val) + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+    h ^= uint64_t(k.lhs) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    h ^= uint64_t(k.rhs) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    return size_t(h);
+  }
+};
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// BatchPlan::Report implementation
+////////////////////////////////////////////////////////////////////////
+
+double BatchPlan::Report::work_eliminated() const {
+  return tree_nodes == 0 ? 0.0 : 1.0 - double(plan_steps) / double(tree_nodes);
+}
+
+////////////////////////////////////////////////////////////////////////
+// BatchPlan implementation
+////////////////////////////////////////////////////////////////////////
+
+BatchPlan::BatchPlan(const std::vector<const Node *> &exprs) {
+  std::unordered_map<StepKey, unsigned, StepKeyHash> index;
+  std::vector<unsigned> num_uses;
+
+  m_report.num_exprs = exprs.size();
+  m_report.tree_nodes = 0;
+
+  // iterative postorder traversal of each tree: when a node is
+  // finished, the steps for its operands are on top of the value stack
+  std::vector<std::pair<const Node *, unsigned>> work;
+  std::vector<unsigned> operands;
+  for (auto e = exprs.begin(); e != exprs.end(); ++e) {
+    work.push_back({ *e, 0 });
+    while (!work.empty()) {
+      const Node *n = work.back().first;
+      unsigned next_kid = work.back().second;
+      if (next_kid < n->get_num_kids()) {
+        work.back().second++;
+        work.push_back({ n->get_kid(next_kid), 0 });
+        continue;
+      }
+      work.pop_back();
+      m_report.tree_nodes++;
+
+      StepKey key = { n->get_tag(), 0, 0, 0 };
+      switch (n->get_tag()) {
+      case AST_INT_LITERAL:
+        if (!n->has_ival()) {
+          EvaluationError::raise(n->get_loc(), "Integer literal '%s' was not decoded", n->get_str().c_str());
+        }
+        key.val = n->get_ival();
+        break;
+      case AST_VARREF:
+        if (n->get_slot() < 0) {
+          EvaluationError::raise(n->get_loc(), "Variable '%s' is not bound to a slot", n->get_str().c_str());
+        }
+        key.val = n->get_slot();
+        break;
+      case AST_ADD: case AST_SUB: case AST_MULTIPLY: case AST_DIVIDE:
+        key.rhs = operands.back();
+        operands.pop_back();
+        key.lhs = operands.back();
+        operands.pop_back();
+        // + and * are commutative (with wrapping arithmetic),
+        // so order their operands canonically
+        if ((key.op == AST_ADD || key.op == AST_MULTIPLY) && key.lhs > key.rhs) {
+          std::swap(key.lhs, key.rhs);
+        }
+        break;
+      default:
+        EvaluationError::raise(n->get_loc(), "Unknown AST node type %d", n->get_tag());
+      }
+
+      auto i = index.find(key);
+      unsigned step;
+      if (i != index.end()) {
+        step = i->second;
+      } else {
+        step = unsigned(m_steps.size());
+        m_steps.push_back({ key.op, key.val, key.lhs, key.rhs, n, 0 });
+        num_uses.push_back(0);
+        index[key] = step;
+        if (key.op != AST_INT_LITERAL && key.op != AST_VARREF) {
+          num_uses[key.lhs]++;
+          num_uses[key.rhs]++;
+        }
+      }
+      operands.push_back(step);
+    }
+
+    m_outputs.push_back({ operands.back(), unsigned(e - exprs.begin()) });
+    num_uses[operands.back()]++;
+    operands.pop_back();
+  }
+
+  m_report.plan_steps = m_steps.size();
+  m_report.shared_steps = 0;
+  for (auto i = num_uses.begin(); i != num_uses.end(); ++i) {
+    if (*i > 1) {
+      m_report.shared_steps++;
+    }
+  }
+
+  std::sort(m_outputs.begin(), m_outputs.end());
+  assign_columns();
+}
+
+BatchPlan::~BatchPlan() {
+}
+
+void BatchPlan::assign_columns() {
+  // find the last step reading each step's values
+  std::vector<unsigned> last_use(m_steps.size());
+  for (unsigned s = 0; s < m_steps.size(); s++) {
+    last_use[s] = s;
+    const Step &step = m_steps[s];
+    if (step.op != AST_INT_LITERAL && step.op != AST_VARREF) {
+      last_use[step.lhs] = s;
+      last_use[step.rhs] = s;
+    }
+  }
+
+  // allocate columns like registers: a step's column is released
+  // after its last reader (or, if it has no readers, right after the
+  // step itself, since outputs are copied out immediately)
+  std::vector<unsigned> free_cols;
+  unsigned num_cols = 0;
+  for (unsigned s = 0; s < m_steps.size(); s++) {
+    Step &step = m_steps[s];
+    if (free_cols.empty()) {
+      free_cols.push_back(num_cols++);
+    }
+    step.col = free_cols.back();
+    free_cols.pop_back();
+
+    if (step.op != AST_INT_LITERAL && step.op != AST_VARREF) {
+      if (last_use[step.lhs] == s) {
+        free_cols.push_back(m_steps[step.lhs].col);
+      }
+      if (last_use[step.rhs] == s && step.rhs != step.lhs) {
+        free_cols.push_back(m_steps[step.rhs].col);
+      }
+    }
+    if (last_use[s] == s) {
+      free_cols.push_back(step.col);
+    }
+  }
+
+  m_report.num_columns = num_cols;
+}
+
+void BatchPlan::eval(const Dataset &data, int64_t *results, WorkStealingPool *pool) const {
+  if (!pool) {
+    std::vector<int64_t> columns;
+    for (size_t begin = 0; begin < data.num_rows; begin += BLOCK_ROWS) {
+      size_t end = std::min(begin + BLOCK_ROWS, data.num_rows);
+      eval_block(data, begin, end, columns, results);
+    }
+    return;
+  }
+
+  for (size_t begin = 0; begin < data.num_rows; begin += BLOCK_ROWS) {
+    size_t end = std::min(begin + BLOCK_ROWS, data.num_rows);
+    pool->submit([this, &data, begin, end, results]() {
+      thread_local std::vector<int64_t> columns;
+      eval_block(data, begin, end, columns, results);
+    });
+  }
+  pool->wait();
+}
+
+void BatchPlan::eval_block(const Dataset &data, size_t begin, size_t end,
+                           std::vector<int64_t> &columns, int64_t *results) const {
+  size_t nrows = end - begin;
+  columns.resize(std::max(m_report.num_columns, size_t(1)) * BLOCK_ROWS);
+  auto output = m_outputs.begin();
+
+  for (size_t s = 0; s < m_steps.size(); s++) {
+    const Step &step = m_steps[s];
+    int64_t *out = &columns[size_t(step.col) * BLOCK_ROWS];
+    const int64_t *lhs = &columns[size_t(m_steps[step.lhs].col) * BLOCK_ROWS];
+    const int64_t *rhs = &columns[size_t(m_steps[step.rhs].col) * BLOCK_ROWS];
+
+    // wrapping arithmetic is done on unsigned values,
+    // as in Evaluator::apply_op
+    switch (step.op) {
+    case AST_INT_LITERAL:
+      for (size_t r = 0; r < nrows; r++) {
+        out[r] = step.val;
+      }
+      break;
+    case AST_VARREF:
+      {
+        const int64_t *in = data.values + begin*data.num_slots + step.val;
+        for (size_t r = 0; r < nrows; r++) {
+          out[r] = in[r*data.num_slots];
+        }
+      }
+      break;
+    case AST_ADD:
+      for (size_t r = 0; r < nrows; r++) {
+        out[r] = int64_t(uint64_t(lhs[r]) + uint64_t(rhs[r]));
+      }
+      break;
+    case AST_SUB:
+      for (size_t r = 0; r < nrows; r++) {
+        out[r] = int64_t(uint64_t(lhs[r]) - uint64_t(rhs[r]));
+      }
+      break;
+    case AST_MULTIPLY:
+      for (size_t r = 0; r < nrows; r++) {
+        out[r] = int64_t(uint64_t(lhs[r]) * uint64_t(rhs[r]));
+      }
+      break;
+    case AST_DIVIDE:
+      for (size_t r = 0; r < nrows; r++) {
+        if (rhs[r] == 0) {
+          EvaluationError::raise(step.origin->get_loc(), "Division by zero");
+        }
+        out[r] = rhs[r] == -1 ? int64_t(0 - uint64_t(lhs[r])) : lhs[r] / rhs[r];
+      }
+      break;
+    }
+
+    // copy out the values of expressions computed by this step
+    for (; output != m_outputs.end() && output->first == s; ++output) {
+      int64_t *dest = results + size_t(output->second)*data.num_rows + begin;
+      for (size_t r = 0; r < nrows; r++) {
+        dest[r] = out[r];
+      }
+    }
+  }
+}
@@ -0,0 +1,70 @@
+#ifndef BATCHPLAN_H
+#define BATCHPLAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "node.h"
+#include "batcheval.h"
+#include "workpool.h"
+
+// Evaluation plan for a batch of expressions in which subexpressions
+// that occur more than once (in one expression or across expressions)
+// are computed only once.  Subtrees are hashed structurally and merged
+// into a DAG of steps; the operands of + and * are ordered canonically,
+// so e.g. (price*qty) and (qty*price) are also shared.
+//
+// The plan is evaluated one block of rows at a time: each step computes
+// a column of values for the block.  Columns are reused once the last
+// step reading them is done, so the working set stays small enough to
+// fit in cache even for very large batches.
+//
+// Like eval_batch, the expressions must be bound (see bind_varrefs)
+// using the symbol table that defines the dataset's slots.
+class BatchPlan {
+public:
+  struct Step {
+    int op;           // AST node tag
+    int64_t val;      // literal value, or slot of variable
+    unsigned lhs, rhs; // operand steps, for operators
+    const Node *origin; // first node computed by this step (for errors)
+    unsigned col;     // column holding the step's values
+  };
+
+  struct Report {
+    size_t num_exprs;
+    size_t tree_nodes;   // total nodes in the expression trees
+    size_t plan_steps;   // distinct subexpressions
+    size_t shared_steps; // steps used by more than one parent or root
+    size_t num_columns;  // columns needed to evaluate a block of rows
+
+    // fraction of per-row node evaluations eliminated by sharing
+    double work_eliminated() const;
+  };
+
+private:
+  std::vector<Step> m_steps;      // in dependency order
+  std::vector<std::pair<unsigned, unsigned>> m_outputs; // (step, expression), by step
+  Report m_report;
+
+public:
+  BatchPlan(const std::vector<const Node *> &exprs);
+  ~BatchPlan();
+
+  const Report &get_report() const { return m_report; }
+  const std::vector<Step> &get_steps() const { return m_steps; }
+
+  // Evaluate the plan for each row of the dataset: the value of
+  // expression e on row r is stored in results[e*data.num_rows + r].
+  // If a pool is given, blocks of rows are evaluated in parallel.
+  // Throws EvaluationError on division by zero.
+  void eval(const Dataset &data, int64_t *results, WorkStealingPool *pool = nullptr) const;
+
+private:
+  void assign_columns();
+  void eval_block(const Dataset &data, size_t begin, size_t end,
+                  std::vector<int64_t> &columns, int64_t *results) const;
+};
+
+#endif // BATCHPLAN_H
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include "exceptions.h"
+#include "lexer.h"
+#include "parser.h"
+#include "parser2.h"
+#include "bench.h"
+
+double bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return double(ts.tv_sec) + double(ts.tv_nsec)/1e9;
+}
+
+// Each thread reuses one parser of each kind (see Lexer::reset)
+
+Node *bench_parse2(const std::string &src) {
+  thread_local Parser2 parser2(new Lexer());
+  parser2.reset(src.data(), src.size(), "<bench>");
+  return parser2.parse();
+}
+
+Node *bench_parse(const std::string &src) {
+  thread_local Parser parser(new Lexer());
+  parser.reset(src.data(), src.size(), "<bench>");
+  return parser.parse();
+}
+
+////////////////////////////////////////////////////////////////////////
+// BenchResult implementation
+////////////////////////////////////////////////////////////////////////
+
+double BenchResult::throughput() const {
+  return median > 0.0 ? items / median : 0.0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// BenchRunner implementation
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Percentile of sorted values (nearest rank)
+double percentile(const std::vector<double> &sorted, double p) {
+  size_t rank = size_t(std::ceil(p / 100.0 * double(sorted.size())));
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+void write_json_string(FILE *out, const std::string &s) {
+  fputc('"', out);
+  for (auto i = s.begin(); i != s.end(); ++i) {
+    unsigned char c = static_cast<unsigned char>(*i);
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+}
+
+BenchRunner::BenchRunner(const Options &options)
+  : m_options(options) {
+}
+
+BenchRunner::~BenchRunner() {
+}
+
+bool BenchRunner::selected(const std::string &name) const {
+  return name.find(m_options.filter) != std::string::npos;
+}
+
+const BenchResult *BenchRunner::run(const std::string &name, const std::string &input,
+                                    double items, const std::string &unit,
+                                    const std::function<void()> &fn,
+                                    const std::function<void()> &setup) {
+  if (!selected(name)) {
+    return nullptr;
+  }
+
+  for (unsigned i = 0; i < m_options.warmup; i++) {
+    if (setup) {
+      setup();
+    }
+    fn();
+  }
+
+  std::vector<double> times;
+  double total = 0.0;
+  while (times.size() < m_options.max_reps
+         && (times.size() < m_options.min_reps || total < m_options.min_secs)) {
+    if (setup) {
+      setup();
+    }
+    double start = bench_now();
+    fn();
+    double elapsed = bench_now() - start;
+    times.push_back(elapsed);
+    total += elapsed;
+  }
+
+  std::sort(times.begin(), times.end());
+  BenchResult r;
+  r.name = name;
+  r.input = input;
+  r.items = items;
+  r.unit = unit;
+  r.reps = unsigned(times.size());
+  r.min = times.front();
+  r.max = times.back();
+  r.mean = total / double(times.size());
+  r.median = times.size() % 2 == 1
+    ? times[times.size()/2]
+    : (times[times.size()/2 - 1] + times[times.size()/2]) / 2.0;
+  r.p99 = percentile(times, 99.0);
+  m_results.push_back(r);
+  return &m_results.back();
+}
+
+void BenchRunner::print_header(FILE *out) {
+  fprintf(out, "%-14s %-20s %6s %11s %11s %11s %14s\n",
+          "benchmark", "input", "reps", "median ms", "p99 ms", "min ms", "throughput");
+}
+
+void BenchRunner::print_result(FILE *out, const BenchResult &r) {
+  fprintf(out, "%-14s %-20s %6u %11.3f %11.3f %11.3f %9.2f M%s/s\n",
+          r.name.c_str(), r.input.c_str(), r.reps, r.median*1e3, r.p99*1e3, r.min*1e3,
+          r.throughput() / 1e6, r.unit.c_str());
+}
+
+void BenchRunner::write_json(FILE *out) const {
+  fputs("[\n", out);
+  for (auto i = m_results.begin(); i != m_results.end(); ++i) {
+    fputs("  {\"name\":", out);
+    write_json_string(out, i->name);
+    fputs(",\"input\":", out);
+    write_json_string(out, i->input);
+    fprintf(out, ",\"items\":%.0f,\"unit\":", i->items);
+    write_json_string(out, i->unit);
+    fprintf(out, ",\"reps\":%u,\"min\":%.9g,\"median\":%.9g,\"mean\":%.9g,\"p99\":%.9g,\"max\":%.9g"
+            ",\"throughput\":%.9g}%s\n",
+            i->reps, i->min, i->median, i->mean, i->p99, i->max, i->throughput(),
+            i + 1 != m_results.end() ? "," : "");
+  }
+  fputs("]\n", out);
+}
@@ -0,0 +1,97 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include "node.h"
+#include "outbuf.h"
+
+// Helper functions and classes for benchmark programs
+
+// Current value of a monotonic clock, in seconds
+double bench_now();
+
+// Parse an expression from an in-memory string using Parser2
+Node *bench_parse2(const std::string &src);
+
+// Parse an expression from an in-memory string using Parser,
+// returning the parse tree
+Node *bench_parse(const std::string &src);
+
+// Sink that counts bytes and discards them, so that only
+// the cost of producing output is measured
+class NullSink : public OutputSink {
+public:
+  size_t count;
+
+  NullSink() : count(0) { }
+  virtual void write(const char *, size_t len) { count += len; }
+};
+
+// Timing statistics for one benchmark, over its measured repetitions
+struct BenchResult {
+  std::string name;   // what was measured
+  std::string input;  // description of the input
+  double items;       // work per repetition, in units (e.g. bytes)
+  std::string unit;
+  unsigned reps;
+  double min, median, mean, p99, max; // seconds per repetition
+
+  // Units per second, based on the median time
+  double throughput() const;
+};
+
+// Runs benchmarks and collects their results.  Each benchmark is run
+// a few times untimed (warmup), then timed for at least min_reps
+// repetitions and min_secs seconds (but at most max_reps repetitions.)
+// Reporting the median and 99th percentile of the repetition times
+// makes the results robust against occasional interference.
+class BenchRunner {
+public:
+  struct Options {
+    unsigned warmup;
+    unsigned min_reps, max_reps;
+    double min_secs;
+    std::string filter; // only run benchmarks whose name contains this
+
+    Options() : warmup(2), min_reps(10), max_reps(10000), min_secs(0.2) { }
+  };
+
+private:
+  Options m_options;
+  std::vector<BenchResult> m_results;
+
+  // no value semantics
+  BenchRunner(const BenchRunner &);
+  BenchRunner &operator=(const BenchRunner &);
+
+public:
+  BenchRunner(const Options &options = Options());
+  ~BenchRunner();
+
+  // Check whether a benchmark with given name passes the filter
+  bool selected(const std::string &name) const;
+
+  // Run a benchmark: fn does one repetition.  The optional setup
+  // function is called (untimed) before each repetition, for example
+  // to prepare data that the repetition consumes.  Returns nullptr if
+  // the benchmark is filtered out.
+  const BenchResult *run(const std::string &name, const std::string &input,
+                         double items, const std::string &unit,
+                         const std::function<void()> &fn,
+                         const std::function<void()> &setup = std::function<void()>());
+
+  const std::vector<BenchResult> &get_results() const { return m_results; }
+
+  // Print a result as a line of a table (print_header prints the
+  // table's header line)
+  static void print_header(FILE *out);
+  static void print_result(FILE *out, const BenchResult &r);
+
+  // Write all results as a JSON array of objects
+  void write_json(FILE *out) const;
+};
+
+#endif // BENCH_H
@@ -0,0 +1,103 @@
+// Benchmark comparing the throughput of the JSON and S-expression
+// emitters (see treeemit.h) with the text tree printer, on ASTs,
+// parse trees, and a very deep left-associative chain.
+//
+// Usage: bench_emit [-z nodes] [-s seed]
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h> // for getopt
+#include <memory>
+#include "exceptions.h"
+#include "ast.h"
+#include "parser.h"
+#include "workload.h"
+#include "outbuf.h"
+#include "treeemit.h"
+#include "treeutil.h"
+#include "bench.h"
+
+namespace {
+
+// Build a left-deep chain of n additions directly (Parser2 would
+// need one level of recursion per operator to parse it)
+Node *build_chain(size_t n) {
+  Node *ast = new Node(AST_VARREF, "a");
+  for (size_t i = 0; i < n; i++) {
+    ast = new Node(AST_ADD, {ast, new Node(AST_VARREF, "b")});
+  }
+  return ast;
+}
+
+// The text format is skipped for deep trees: its indentation makes
+// the output size quadratic in the depth of the tree
+void bench_tree(const char *label, Node *t, const TreePrint &tags, bool text = true) {
+  size_t nodes = count_nodes(t);
+  printf("%s: %zu nodes\n", label, nodes);
+  printf("  %-6s %12s %10s %10s\n", "format", "bytes", "MB/s", "Mnodes/s");
+
+  for (int format = text ? 0 : 1; format < 3; format++) {
+    NullSink sink;
+    double start = bench_now();
+    {
+      OutputBuffer out(sink, 1 << 20);
+      if (format == 0) {
+        tags.print(t, out);
+      } else if (format == 1) {
+        emit_json(t, tags, out);
+      } else {
+        emit_sexp(t, tags, out);
+      }
+      out.flush();
+    }
+    double secs = bench_now() - start;
+    static const char *names[] = { "text", "json", "sexp" };
+    printf("  %-6s %12zu %10.1f %10.2f\n", names[format], sink.count,
+           double(sink.count) / 1e6 / secs, double(nodes) / 1e6 / secs);
+  }
+}
+
+}
+
+int execute(int argc, char **argv) {
+  size_t nodes = 1000000;
+  uint64_t seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "z:s:")) != -1) {
+    switch (opt) {
+    case 'z':
+      nodes = size_t(atol(optarg));
+      break;
+    case 's':
+      seed = uint64_t(atoll(optarg));
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+
+  WorkloadGen gen(WorkloadShape(), seed);
+  std::string src = gen.generate_nodes(nodes);
+
+  std::unique_ptr<Node> ast(bench_parse2(src));
+  bench_tree("AST", ast.get(), ASTTreePrint());
+  ast.reset();
+
+  std::unique_ptr<Node> parse_tree(bench_parse(src));
+  bench_tree("parse tree", parse_tree.get(), ParserTreePrint());
+  parse_tree.reset();
+
+  std::unique_ptr<Node> chain(build_chain(nodes / 2));
+  bench_tree("left-deep chain", chain.get(), ASTTreePrint(), false);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -0,0 +1,213 @@
+// Benchmark for parallel evaluation of many expressions over one
+// dataset (see batcheval.h).  Expression sizes follow a heavy-tailed
+// distribution: most are tiny, a few are very large.  The batch is
+// evaluated with 1, 2, 4, ... worker threads, and the results of
+// each run are checked against the single-threaded run.  The batch is
+// also evaluated with a BatchPlan (see batchplan.h), which computes
+// subexpressions shared within and across expressions only once; its
+// report of the work eliminated is printed, and its results are
+// checked too.
+//
+// Then a stream of formula strings, drawn (with a skewed distribution,
+// and with varying whitespace) from a smaller set of formulas, is
+// parsed both from scratch and through an ExprCache (see exprcache.h)
+// shared by the worker threads, and the cache statistics are printed.
+//
+// Usage: bench_eval [-n num_exprs] [-r num_rows] [-t max_threads] [-s seed]
+//                   [-c cache_entries] [-l lookups]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h> // for getopt
+#include <memory>
+#include <thread>
+#include <vector>
+#include "exceptions.h"
+#include "workload.h"
+#include "symtab.h"
+#include "treeutil.h"
+#include "batcheval.h"
+#include "batchplan.h"
+#include "exprcache.h"
+#include "bench.h"
+
+namespace {
+
+const unsigned NUM_VARS = 8;
+
+double run_batch(const std::vector<const Node *> &exprs, const Dataset &data,
+                 std::vector<int64_t> &results, unsigned nthreads, unsigned long &steals) {
+  WorkStealingPool pool(nthreads);
+  double start = bench_now();
+  eval_batch(exprs, data, results.data(), pool);
+  double elapsed = bench_now() - start;
+  steals = pool.get_num_steals();
+  return elapsed;
+}
+
+// Formula strings as a service might see them: num_lookups strings,
+// some formulas much more often than others, with or without spaces
+std::vector<std::string> gen_lookups(WorkloadGen &gen, size_t num_formulas, size_t num_lookups) {
+  std::vector<std::string> formulas;
+  for (size_t i = 0; i < num_formulas; i++) {
+    formulas.push_back(gen.generate_nodes(3 + gen.random(28)));
+  }
+  std::vector<std::string> lookups;
+  for (size_t i = 0; i < num_lookups; i++) {
+    std::string src = formulas[gen.random(gen.random(gen.random(num_formulas) + 1) + 1)];
+    if (gen.random(2) == 0) {
+      src.erase(std::remove(src.begin(), src.end(), ' '), src.end());
+    }
+    lookups.push_back(src);
+  }
+  return lookups;
+}
+
+// Parse all of the lookups on the pool's threads, through the
+// cache if one is given
+double run_lookups(const std::vector<std::string> &lookups, WorkStealingPool &pool, ExprCache *cache) {
+  const size_t CHUNK = 1000;
+  double start = bench_now();
+  for (size_t begin = 0; begin < lookups.size(); begin += CHUNK) {
+    size_t end = std::min(begin + CHUNK, lookups.size());
+    pool.submit([&lookups, cache, begin, end]() {
+      for (size_t i = begin; i < end; i++) {
+        if (cache) {
+          cache->get(lookups[i]);
+        } else {
+          delete bench_parse2(lookups[i]);
+        }
+      }
+    });
+  }
+  pool.wait();
+  return bench_now() - start;
+}
+
+}
+
+int execute(int argc, char **argv) {
+  unsigned num_exprs = 10000, max_threads = std::thread::hardware_concurrency();
+  size_t num_rows = 1000, cache_entries = 1000, num_lookups = 200000;
+  uint64_t seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:t:s:c:l:")) != -1) {
+    switch (opt) {
+    case 'n':
+      num_exprs = unsigned(atol(optarg));
+      break;
+    case 'r':
+      num_rows = size_t(atol(optarg));
+      break;
+    case 't':
+      max_threads = unsigned(atol(optarg));
+      break;
+    case 's':
+      seed = uint64_t(atoll(optarg));
+      break;
+    case 'c':
+      cache_entries = size_t(atol(optarg));
+      break;
+    case 'l':
+      num_lookups = size_t(atol(optarg));
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+
+  // generate and bind expressions: 1 in 1000 has ~100,000 nodes,
+  // 1 in 20 has ~1000 nodes, and the rest have 3-30 nodes
+  WorkloadShape shape;
+  shape.vocab_size = NUM_VARS;
+  WorkloadGen gen(shape, seed);
+  SymbolTable symtab;
+  std::vector<std::unique_ptr<Node>> asts;
+  std::vector<const Node *> exprs;
+  size_t total_nodes = 0;
+  for (unsigned i = 0; i < num_exprs; i++) {
+    size_t target;
+    if (gen.random(1000) == 0) {
+      target = 100000;
+    } else if (gen.random(20) == 0) {
+      target = 1000;
+    } else {
+      target = 3 + gen.random(28);
+    }
+    Node *ast = bench_parse2(gen.generate_nodes(target));
+    bind_varrefs(ast, symtab);
+    asts.push_back(std::unique_ptr<Node>(ast));
+    exprs.push_back(ast);
+    total_nodes += count_nodes(ast);
+  }
+
+  // one value for each variable in each row
+  unsigned num_vars = symtab.get_num_slots();
+  std::vector<int64_t> values(num_rows * num_vars);
+  for (auto i = values.begin(); i != values.end(); ++i) {
+    *i = int64_t(gen.random(2001)) - 1000;
+  }
+  Dataset data = { values.data(), num_rows, num_vars };
+
+  printf("%u expressions, %zu AST nodes, %zu rows: %.3g node evaluations\n",
+         num_exprs, total_nodes, num_rows, double(total_nodes) * double(num_rows));
+  printf("%8s %10s %10s %10s %10s\n", "threads", "seconds", "speedup", "efficiency", "steals");
+
+  std::vector<int64_t> expected(exprs.size() * num_rows), results(expected.size());
+  unsigned long steals;
+  double base = run_batch(exprs, data, expected, 1, steals);
+  printf("%8u %10.4f %10.2f %10.2f %10lu\n", 1u, base, 1.0, 1.0, steals);
+
+  for (unsigned nthreads = 2; nthreads <= max_threads; nthreads *= 2) {
+    double elapsed = run_batch(exprs, data, results, nthreads, steals);
+    if (results != expected) {
+      RuntimeError::raise("Results with %u threads differ from single-threaded results", nthreads);
+    }
+    double speedup = base / elapsed;
+    printf("%8u %10.4f %10.2f %10.2f %10lu\n", nthreads, elapsed, speedup, speedup / nthreads, steals);
+  }
+
+  double plan_start = bench_now();
+  BatchPlan plan(exprs);
+  double plan_build = bench_now() - plan_start;
+  WorkStealingPool pool(max_threads);
+  plan_start = bench_now();
+  plan.eval(data, results.data(), &pool);
+  double plan_eval = bench_now() - plan_start;
+  if (results != expected) {
+    RuntimeError::raise("Results from BatchPlan differ from eval_batch results");
+  }
+  const BatchPlan::Report &report = plan.get_report();
+  printf("\nBatchPlan on %u threads: %zu tree nodes -> %zu steps (%zu shared), %zu columns\n",
+         max_threads, report.tree_nodes, report.plan_steps, report.shared_steps, report.num_columns);
+  printf("%.1f%% of node evaluations eliminated; planning %.4f seconds, evaluation %.4f seconds\n",
+         100.0 * report.work_eliminated(), plan_build, plan_eval);
+
+  // twice as many formulas as cache entries, so that the
+  // rarely used ones are evicted
+  std::vector<std::string> lookups = gen_lookups(gen, 2 * std::max(cache_entries, size_t(1)), num_lookups);
+  ExprCache cache(cache_entries);
+  double uncached = run_lookups(lookups, pool, nullptr);
+  double cached = run_lookups(lookups, pool, &cache);
+  ExprCache::Stats stats = cache.get_stats();
+  printf("\n%zu lookups on %u threads, cache of %zu entries\n", lookups.size(), max_threads, cache_entries);
+  printf("%10s %10s %10s %10s %10s %10s %10s\n",
+         "uncached", "cached", "hit rate", "misses", "evictions", "entries", "bytes");
+  printf("%10.4f %10.4f %10.3f %10lu %10lu %10zu %10zu\n", uncached, cached, stats.hit_rate(),
+         (unsigned long) stats.misses, (unsigned long) stats.evictions, stats.entries, stats.bytes);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -0,0 +1,226 @@
+// Benchmark for parallel tree passes (see partree.h).  The input is a
+// long sum of generated terms, whose AST (built by Parser2) has a
+// left-deep spine as long as the sum.  Three passes are run over it,
+// sequentially and then with 1, 2, 4, ... worker threads:
+//
+//   hash    a structural hash of each subtree (parallel_reduce)
+//   count   counting the integer literals (parallel_for_each)
+//   fold    constant folding of operators on two literals
+//           (parallel_transform)
+//
+// Each parallel result is checked against the sequential result.
+// Times are the best of several runs; computing the subtree sizes
+// (needed once per tree) is timed separately.
+//
+// Usage: bench_partree [-m MB] [-t max_threads] [-g fragment_size] [-r reps] [-s seed]
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <unistd.h> // for getopt
+#include <memory>
+#include <thread>
+#include <vector>
+#include "exceptions.h"
+#include "ast.h"
+#include "partree.h"
+#include "workload.h"
+#include "treeutil.h"
+#include "bench.h"
+
+namespace {
+
+uint64_t mix(uint64_t h, uint64_t v) {
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+uint64_t hash_node(const Node *n, uint64_t *kid_hashes) {
+  uint64_t h = mix(uint64_t(n->get_tag()), std::hash<std::string>()(n->get_str()));
+  for (unsigned i = 0; i < n->get_num_kids(); i++) {
+    h = mix(h, kid_hashes[i]);
+  }
+  return h;
+}
+
+bool is_literal(const Node *n) {
+  return n->get_tag() == AST_INT_LITERAL && n->has_ival();
+}
+
+// Replace an operator on two literals with a literal for its result
+// (with wrapping arithmetic, as Evaluator does)
+Node *fold_node(Node *n) {
+  int tag = n->get_tag();
+  if (n->get_num_kids() != 2 || !is_literal(n->get_kid(0)) || !is_literal(n->get_kid(1))) {
+    return n;
+  }
+  uint64_t lhs = uint64_t(n->get_kid(0)->get_ival()), rhs = uint64_t(n->get_kid(1)->get_ival());
+  int64_t result;
+  if (tag == AST_ADD) {
+    result = int64_t(lhs + rhs);
+  } else if (tag == AST_SUB) {
+    result = int64_t(lhs - rhs);
+  } else if (tag == AST_MULTIPLY) {
+    result = int64_t(lhs * rhs);
+  } else if (tag == AST_DIVIDE && int64_t(rhs) != 0 && int64_t(rhs) != -1) {
+    result = int64_t(lhs) / int64_t(rhs);
+  } else {
+    return n;
+  }
+  Node *lit = new Node(AST_INT_LITERAL, std::to_string(result));
+  lit->set_ival(result);
+  lit->set_loc(n->get_loc());
+  delete n;
+  return lit;
+}
+
+// Best time of reps runs of fn (setup, if any, is called untimed
+// before each run)
+double best_time(unsigned reps, const std::function<void()> &fn,
+                 const std::function<void()> &setup = std::function<void()>()) {
+  double best = 0.0;
+  for (unsigned i = 0; i < reps; i++) {
+    if (setup) {
+      setup();
+    }
+    double start = bench_now();
+    fn();
+    double elapsed = bench_now() - start;
+    if (i == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+}
+
+int execute(int argc, char **argv) {
+  size_t megabytes = 8, fragment_size = DEFAULT_FRAGMENT_SIZE;
+  unsigned max_threads = std::max(2u, std::thread::hardware_concurrency());
+  unsigned reps = 3;
+  uint64_t seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:t:g:r:s:")) != -1) {
+    switch (opt) {
+    case 'm':
+      megabytes = size_t(atol(optarg));
+      break;
+    case 't':
+      max_threads = unsigned(atol(optarg));
+      break;
+    case 'g':
+      fragment_size = size_t(atol(optarg));
+      break;
+    case 'r':
+      reps = unsigned(atol(optarg));
+      break;
+    case 's':
+      seed = uint64_t(atoll(optarg));
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+  if (reps == 0) {
+    reps = 1;
+  }
+
+  WorkloadShape shape;
+  shape.ws_newlines = true;
+  WorkloadGen gen(shape, seed);
+  std::string src = gen.generate_sum(std::max(size_t(1), megabytes) << 20);
+  std::unique_ptr<Node> ast(bench_parse2(src));
+  std::unique_ptr<SubtreeSizes> sizes;
+  double sizes_time = best_time(reps, [&]() { sizes.reset(new SubtreeSizes(ast.get())); });
+  printf("%zu bytes, %zu AST nodes, depth %zu, %zu fragments\n", src.size(),
+         sizes->get_num_nodes(), tree_depth(ast.get()), sizes->count_fragments(fragment_size));
+  printf("subtree sizes: %.4f seconds\n", sizes_time);
+
+  // the fold pass transforms a fresh copy of the tree on each run
+  std::unique_ptr<Node> fold_input;
+  std::unique_ptr<SubtreeSizes> fold_sizes;
+  auto fold_setup = [&]() {
+    fold_input.reset(bench_parse2(src));
+    fold_sizes.reset(new SubtreeSizes(fold_input.get()));
+  };
+
+  // sequential results, which the parallel results must match
+  const Node *root = ast.get();
+  uint64_t expected_hash = 0;
+  std::atomic<size_t> literals(0);
+  auto count_literal = [&literals](const Node *n) {
+    if (n->get_tag() == AST_INT_LITERAL) {
+      literals.fetch_add(1, std::memory_order_relaxed);
+    }
+  };
+  std::unique_ptr<Node> expected_fold;
+  double seq_times[3];
+  seq_times[0] = best_time(reps, [&]() {
+    expected_hash = parallel_reduce<uint64_t>(root, *sizes, nullptr, hash_node, fragment_size);
+  });
+  seq_times[1] = best_time(reps, [&]() {
+    literals = 0;
+    parallel_for_each(root, *sizes, nullptr, count_literal, fragment_size);
+  });
+  size_t expected_literals = literals;
+  seq_times[2] = best_time(reps, [&]() {
+    expected_fold.reset(parallel_transform(fold_input.release(), *fold_sizes, nullptr, fold_node, fragment_size));
+  }, fold_setup);
+  printf("%zu literals, %zu nodes after folding\n", expected_literals, count_nodes(expected_fold.get()));
+
+  const char *names[] = { "hash", "count", "fold" };
+  printf("%8s %8s %10s %10s %10s\n", "pass", "threads", "seconds", "speedup", "efficiency");
+  for (unsigned i = 0; i < 3; i++) {
+    printf("%8s %8s %10.4f %10.2f %10s\n", names[i], "seq", seq_times[i], 1.0, "-");
+  }
+
+  for (unsigned nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    WorkStealingPool pool(nthreads);
+    double times[3];
+    uint64_t hash = 0;
+    times[0] = best_time(reps, [&]() {
+      hash = parallel_reduce<uint64_t>(root, *sizes, &pool, hash_node, fragment_size);
+    });
+    if (hash != expected_hash) {
+      RuntimeError::raise("Hash computed with %u threads differs from sequential hash", nthreads);
+    }
+
+    times[1] = best_time(reps, [&]() {
+      literals = 0;
+      parallel_for_each(root, *sizes, &pool, count_literal, fragment_size);
+    });
+    if (literals != expected_literals) {
+      RuntimeError::raise("Literals counted with %u threads differ from sequential count", nthreads);
+    }
+
+    std::unique_ptr<Node> folded;
+    times[2] = best_time(reps, [&]() {
+      folded.reset(parallel_transform(fold_input.release(), *fold_sizes, &pool, fold_node, fragment_size));
+    }, [&]() { folded.reset(); fold_setup(); });
+    if (!trees_equal(expected_fold.get(), folded.get(), true)) {
+      RuntimeError::raise("AST folded with %u threads differs from sequentially folded AST", nthreads);
+    }
+
+    for (unsigned i = 0; i < 3; i++) {
+      double speedup = seq_times[i] / times[i];
+      printf("%8s %8u %10.4f %10.2f %10.2f\n", names[i], nthreads, times[i], speedup, speedup / nthreads);
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
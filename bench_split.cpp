@@ -0,0 +1,118 @@
+// Benchmark for parallel parsing of one large expression (see
+// parsplit.h).  The input is a long sum of generated terms (mostly
+// products), spread over many lines.  It is parsed sequentially by
+// Parser2, then split and parsed with 1, 2, 4, ... worker threads; the
+// AST from each parallel parse (including node locations) is checked
+// against the sequential AST.  Times are the best of several runs.
+//
+// Usage: bench_split [-m MB] [-t max_threads] [-c min_chunk_KB] [-r reps] [-s seed]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h> // for getopt
+#include <memory>
+#include <thread>
+#include <vector>
+#include "exceptions.h"
+#include "lexer.h"
+#include "parser2.h"
+#include "parsplit.h"
+#include "workload.h"
+#include "treeutil.h"
+#include "bench.h"
+
+namespace {
+
+Node *parse_sequential(const std::string &src) {
+  Parser2 parser(new Lexer(src.data(), src.size(), "<bench>"));
+  return parser.parse();
+}
+
+// Best time of reps runs of fn, which returns a tree (kept from
+// the last run, so it can be checked)
+template<typename Fn>
+double best_time(unsigned reps, std::unique_ptr<Node> &result, Fn fn) {
+  double best = 0.0;
+  for (unsigned i = 0; i < reps; i++) {
+    result.reset();
+    double start = bench_now();
+    result.reset(fn());
+    double elapsed = bench_now() - start;
+    if (i == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+}
+
+int execute(int argc, char **argv) {
+  size_t megabytes = 16, min_chunk_kb = 1024;
+  unsigned max_threads = std::max(2u, std::thread::hardware_concurrency());
+  unsigned reps = 3;
+  uint64_t seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:t:c:r:s:")) != -1) {
+    switch (opt) {
+    case 'm':
+      megabytes = size_t(atol(optarg));
+      break;
+    case 't':
+      max_threads = unsigned(atol(optarg));
+      break;
+    case 'c':
+      min_chunk_kb = size_t(atol(optarg));
+      break;
+    case 'r':
+      reps = unsigned(atol(optarg));
+      break;
+    case 's':
+      seed = uint64_t(atoll(optarg));
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+  if (reps == 0) {
+    reps = 1;
+  }
+
+  WorkloadShape shape;
+  shape.ws_newlines = true;
+  WorkloadGen gen(shape, seed);
+  std::string src = gen.generate_sum(std::max(size_t(1), megabytes) << 20);
+  std::unique_ptr<Node> expected, result;
+  double base = best_time(reps, expected, [&]() { return parse_sequential(src); });
+  printf("%zu bytes, %zu AST nodes\n", src.size(), count_nodes(expected.get()));
+  printf("%8s %10s %10s %10s %10s\n", "threads", "seconds", "speedup", "efficiency", "chunks");
+  printf("%8s %10.4f %10.2f %10s %10u\n", "seq", base, 1.0, "-", 1u);
+
+  for (unsigned nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    WorkStealingPool pool(nthreads);
+    SplitParseInfo info;
+    double elapsed = best_time(reps, result, [&]() {
+      return parse2_split(src.data(), src.size(), "<bench>", pool, min_chunk_kb << 10, &info);
+    });
+    if (!trees_equal(expected.get(), result.get(), true)) {
+      RuntimeError::raise("AST parsed with %u threads differs from sequential AST", nthreads);
+    }
+    double speedup = base / elapsed;
+    printf("%8u %10.4f %10.2f %10.2f %10zu\n", nthreads, elapsed, speedup, speedup / nthreads, info.num_chunks);
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -0,0 +1,229 @@
+// Benchmark for pipelined parsing (see tokpipe.h): compares Parser2
+// pulling tokens from a lexer on the same thread (the interleaved
+// peek/next path) with Parser2 consuming tokens lexed on a producer
+// thread and passed through a TokenPipeline, over large inputs.  Also
+// measures the raw throughput of the SPSC queue between two threads.
+//
+// The pipelined parse can only be faster when the producer and
+// consumer threads run on different cores.
+//
+// Usage: bench_spsc [options]
+//   -f NAME   only run benchmarks whose name contains NAME
+//   -r N      minimum number of timed repetitions (default 5)
+//   -w N      number of warmup repetitions (default 1)
+//   -t SECS   minimum timed seconds per benchmark (default 0.5)
+//   -z SCALE  scale input sizes by SCALE (default 1)
+//   -q N      number of batches in the pipeline (default 64)
+//   -j FILE   also write results as JSON to FILE ("-" for stdout)
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h> // for getopt
+#include <memory>
+#include <thread>
+#include <vector>
+#include "exceptions.h"
+#include "lexer.h"
+#include "parser2.h"
+#include "tokpipe.h"
+#include "spscqueue.h"
+#include "workload.h"
+#include "outbuf.h"
+#include "treeutil.h"
+#include "bench.h"
+
+namespace {
+
+struct BenchInput {
+  std::string name;
+  std::string src;
+  bool script;  // parse as a sequence of statements
+};
+
+// A script of assignment statements, about size bytes long
+std::string gen_script(size_t size, uint64_t seed) {
+  WorkloadShape shape;
+  shape.ws_newlines = true;
+  WorkloadGen gen(shape, seed);
+  std::string src;
+  StringSink sink(src);
+  OutputBuffer out(sink);
+  for (unsigned i = 0; src.size() < size; i++) {
+    out.put('r');
+    out.write_uint(i);
+    out.write(" = ", 3);
+    gen.generate(out);
+    out.write(";\n", 2);
+    out.flush();
+  }
+  return src;
+}
+
+Node *parse_with(Lexer *lexer, bool script) {
+  Parser2 parser(lexer);
+  return script ? parser.parse_script() : parser.parse();
+}
+
+Node *parse_interleaved(const BenchInput &input) {
+  return parse_with(new Lexer(input.src.data(), input.src.size(), "<bench>"), input.script);
+}
+
+Node *parse_pipelined(const BenchInput &input, size_t batch_size, size_t num_batches) {
+  Lexer *producer = new Lexer(input.src.data(), input.src.size(), "<bench>");
+  TokenSource *pipeline = new TokenPipeline(producer, batch_size, num_batches);
+  return parse_with(new Lexer(pipeline, "<bench>"), input.script);
+}
+
+void report(const BenchResult *r) {
+  if (r) {
+    BenchRunner::print_result(stdout, *r);
+    fflush(stdout);
+  }
+}
+
+// Send count values from a producer thread to the calling thread
+void queue_transfer(uint64_t count, size_t capacity) {
+  SPSCQueue<uint64_t> queue(capacity);
+  std::atomic<bool> stop(false);
+  std::thread producer([&]() {
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t val = i;
+      queue.push(val, stop);
+    }
+  });
+  uint64_t sum = 0, val = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    if (!queue.pop(val, stop)) {
+      break;
+    }
+    sum += val;
+  }
+  producer.join();
+  if (sum != count * (count - 1) / 2) {
+    RuntimeError::raise("SPSC queue lost or reordered values");
+  }
+}
+
+void bench_input(BenchRunner &runner, const BenchInput &input, size_t num_batches) {
+  double bytes = double(input.src.size());
+
+  // check that pipelining doesn't change the result
+  {
+    std::unique_ptr<Node> expected(parse_interleaved(input));
+    std::unique_ptr<Node> actual(parse_pipelined(input, TokenPipeline::DEFAULT_BATCH_SIZE, num_batches));
+    if (!trees_equal(expected.get(), actual.get(), true)) {
+      RuntimeError::raise("Pipelined parse of %s differs from interleaved parse", input.name.c_str());
+    }
+  }
+
+  std::unique_ptr<Node> result;
+  auto discard_result = [&]() { result.reset(); };
+
+  const BenchResult *base =
+    runner.run("interleaved", input.name, bytes, "B",
+               [&]() { result.reset(parse_interleaved(input)); }, discard_result);
+  report(base);
+
+  const size_t batch_sizes[] = { 64, TokenPipeline::DEFAULT_BATCH_SIZE, 4096 };
+  for (size_t batch_size : batch_sizes) {
+    std::string name = "pipelined-b" + std::to_string(batch_size);
+    const BenchResult *r =
+      runner.run(name, input.name, bytes, "B",
+                 [&]() { result.reset(parse_pipelined(input, batch_size, num_batches)); },
+                 discard_result);
+    report(r);
+    if (base && r) {
+      printf("  speedup of %s over interleaved: %.2fx\n", name.c_str(), base->median / r->median);
+    }
+  }
+}
+
+}
+
+int execute(int argc, char **argv) {
+  BenchRunner::Options options;
+  options.warmup = 1;
+  options.min_reps = 5;
+  options.min_secs = 0.5;
+  double scale = 1.0;
+  size_t num_batches = TokenPipeline::DEFAULT_NUM_BATCHES;
+  const char *json_file = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:r:w:t:z:q:j:")) != -1) {
+    switch (opt) {
+    case 'f':
+      options.filter = optarg;
+      break;
+    case 'r':
+      options.min_reps = unsigned(atol(optarg));
+      break;
+    case 'w':
+      options.warmup = unsigned(atol(optarg));
+      break;
+    case 't':
+      options.min_secs = atof(optarg);
+      break;
+    case 'z':
+      scale = atof(optarg);
+      break;
+    case 'q':
+      num_batches = size_t(atol(optarg));
+      break;
+    case 'j':
+      json_file = optarg;
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+  if (options.min_reps < 1) {
+    options.min_reps = 1;
+  }
+  if (num_batches < 1) {
+    RuntimeError::raise("The pipeline needs at least one batch");
+  }
+
+  // inputs: scripts of many statements, and one large expression
+  std::vector<BenchInput> inputs;
+  const size_t script_sizes[] = { 1 << 20, 16 << 20 };
+  for (size_t size : script_sizes) {
+    size_t n = std::max(size_t(1), size_t(double(size) * scale));
+    inputs.push_back({ "script-" + std::to_string(n >> 10) + "K", gen_script(n, 1), true });
+  }
+  WorkloadGen gen(WorkloadShape(), 1);
+  size_t nodes = std::max(size_t(1), size_t(500000 * scale));
+  inputs.push_back({ "random-" + std::to_string(nodes), gen.generate_nodes(nodes), false });
+
+  BenchRunner runner(options);
+  BenchRunner::print_header(stdout);
+  uint64_t count = std::max(uint64_t(1), uint64_t(4000000 * scale));
+  report(runner.run("spsc_queue", std::to_string(count) + " values", double(count), "item",
+                    [&]() { queue_transfer(count, 1024); }));
+  for (auto i = inputs.begin(); i != inputs.end(); ++i) {
+    bench_input(runner, *i, num_batches);
+  }
+
+  if (json_file) {
+    FILE *out = std::string(json_file) == "-" ? stdout : fopen(json_file, "w");
+    if (!out) {
+      RuntimeError::raise("Could not open output file '%s'", json_file);
+    }
+    runner.write_json(out);
+    if (out != stdout && fclose(out) != 0) {
+      RuntimeError::raise("Error writing output file '%s'", json_file);
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
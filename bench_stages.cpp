@@ -0,0 +1,235 @@
+// Micro-benchmarks for each stage of the pipeline: lexing (on one
+// thread, and in parallel chunks: see parlex.h), parse tree
+// construction (Parser), the parse tree to AST transformation
+// (buildast), direct AST construction (Parser2), tree printing, and
+// tree destruction.  Each stage is run over generated inputs of
+// several sizes and shapes.
+//
+// Usage: bench_stages [options]
+//   -f NAME   only run benchmarks whose name contains NAME
+//   -r N      minimum number of timed repetitions (default 10)
+//   -w N      number of warmup repetitions (default 2)
+//   -t SECS   minimum timed seconds per benchmark (default 0.2)
+//   -z SCALE  scale input sizes by SCALE (default 1)
+//   -p N      threads for parallel lexing (default: hardware threads)
+//   -j FILE   also write results as JSON to FILE ("-" for stdout)
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h> // for getopt
+#include <memory>
+#include <vector>
+#include "exceptions.h"
+#include "lexer.h"
+#include "ast.h"
+#include "buildast.h"
+#include "parser.h"
+#include "parlex.h"
+#include "workpool.h"
+#include "workload.h"
+#include "outbuf.h"
+#include "treeutil.h"
+#include "bench.h"
+
+namespace {
+
+struct BenchInput {
+  std::string name;
+  std::string src;
+};
+
+// A flat chain of n operands joined by additive and multiplicative
+// operators (the parsers recurse once per operator, so n must not be
+// too large)
+std::string gen_flat(WorkloadGen &gen, size_t n) {
+  static const char *ops[] = { " + ", " - ", " * ", " / " };
+  std::string src = "v0";
+  for (size_t i = 1; i < n; i++) {
+    unsigned op = unsigned(gen.random(4));
+    src += ops[op];
+    if (op == 3 || gen.random(2) == 0) {
+      src += std::to_string(1 + gen.random(999));
+    } else {
+      src += "v" + std::to_string(gen.random(8));
+    }
+  }
+  return src;
+}
+
+// Parentheses nested depth levels deep
+std::string gen_nested(size_t depth) {
+  std::string src;
+  for (size_t i = 0; i < depth; i++) {
+    src += "(a * ";
+  }
+  src += "b";
+  for (size_t i = 0; i < depth; i++) {
+    src += " + c)";
+  }
+  return src;
+}
+
+std::string name_with_size(const char *shape, size_t size) {
+  return std::string(shape) + "-" + std::to_string(size);
+}
+
+// Lex an in-memory string, either one token Node at a time (as the
+// parsers do) or in batches; returns the number of tokens
+size_t lex_all(const std::string &src, bool batch) {
+  size_t count = 0;
+  Lexer lexer(src.data(), src.size(), "<bench>");
+  if (batch) {
+    std::vector<LexToken> toks;
+    std::string lexemes;
+    while (lexer.lex_batch(toks, lexemes, 4096) > 0) {
+      count += toks.size();
+    }
+  } else {
+    while (lexer.peek(1)) {
+      delete lexer.next();
+      count++;
+    }
+  }
+  return count;
+}
+
+// Chunk size for parallel lexing: small, so that even the smaller
+// inputs are split
+const size_t PARLEX_CHUNK = 64 << 10;
+
+void bench_input(BenchRunner &runner, WorkStealingPool &pool,
+                 const BenchInput &input) {
+  const std::string &src = input.src;
+  double bytes = double(src.size());
+  std::unique_ptr<Node> parse_tree(bench_parse(src));
+  std::unique_ptr<Node> ast(bench_parse2(src));
+  double parse_tree_nodes = double(count_nodes(parse_tree.get()));
+  double ast_nodes = double(count_nodes(ast.get()));
+  std::unique_ptr<Node> result;
+  auto discard_result = [&]() { result.reset(); };
+
+  auto report = [](const BenchResult *r) {
+    if (r) {
+      BenchRunner::print_result(stdout, *r);
+      fflush(stdout);
+    }
+  };
+
+  report(runner.run("lex", input.name, bytes, "B",
+                    [&]() { lex_all(src, false); }));
+  report(runner.run("lex_batch", input.name, bytes, "B",
+                    [&]() { lex_all(src, true); }));
+  std::vector<LexToken> toks;
+  report(runner.run("lex_parallel", input.name, bytes, "B", [&]() {
+    lex_parallel(src.data(), src.size(), "<bench>", pool, toks,
+                 PARLEX_CHUNK);
+  }));
+  report(runner.run("parse", input.name, bytes, "B",
+                    [&]() { result.reset(bench_parse(src)); }, discard_result));
+  report(runner.run("buildast", input.name, parse_tree_nodes, "node",
+                    [&]() { result.reset(buildast(parse_tree.get())); },
+                    discard_result));
+  report(runner.run("parse2", input.name, bytes, "B",
+                    [&]() { result.reset(bench_parse2(src)); },
+                    discard_result));
+
+  ASTTreePrint tp;
+  report(runner.run("print", input.name, ast_nodes, "node", [&]() {
+    NullSink sink;
+    OutputBuffer out(sink);
+    tp.print(ast.get(), out);
+    out.flush();
+  }));
+
+  // the setup functions build the trees that the timed part destroys
+  report(runner.run("destroy_parse", input.name, parse_tree_nodes, "node",
+                    discard_result, [&]() { result.reset(bench_parse(src)); }));
+  report(runner.run("destroy_ast", input.name, ast_nodes, "node",
+                    discard_result,
+                    [&]() { result.reset(bench_parse2(src)); }));
+}
+
+}
+
+int execute(int argc, char **argv) {
+  BenchRunner::Options options;
+  double scale = 1.0;
+  const char *json_file = nullptr;
+  unsigned num_threads = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:r:w:t:z:p:j:")) != -1) {
+    switch (opt) {
+    case 'f':
+      options.filter = optarg;
+      break;
+    case 'r':
+      options.min_reps = unsigned(atol(optarg));
+      break;
+    case 'w':
+      options.warmup = unsigned(atol(optarg));
+      break;
+    case 't':
+      options.min_secs = atof(optarg);
+      break;
+    case 'z':
+      scale = atof(optarg);
+      break;
+    case 'p':
+      num_threads = unsigned(atol(optarg));
+      break;
+    case 'j':
+      json_file = optarg;
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+  if (options.min_reps < 1) {
+    options.min_reps = 1;
+  }
+
+  // inputs: random expressions of increasing size (as numbers of
+  // AST nodes), a long flat operator chain, and deeply nested
+  // parentheses
+  WorkloadGen gen(WorkloadShape(), 1);
+  std::vector<BenchInput> inputs;
+  const size_t random_sizes[] = { 1000, 20000, 200000 };
+  for (size_t size : random_sizes) {
+    size_t n = std::max(size_t(1), size_t(double(size) * scale));
+    inputs.push_back({ name_with_size("random", n), gen.generate_nodes(n) });
+  }
+  size_t flat_len = std::max(size_t(1), size_t(2000 * scale));
+  inputs.push_back({ name_with_size("flat", flat_len),
+                     gen_flat(gen, flat_len) });
+  size_t depth = std::max(size_t(1), size_t(500 * scale));
+  inputs.push_back({ name_with_size("nested", depth), gen_nested(depth) });
+
+  WorkStealingPool pool(num_threads);
+  BenchRunner runner(options);
+  BenchRunner::print_header(stdout);
+  for (auto i = inputs.begin(); i != inputs.end(); ++i) {
+    bench_input(runner, pool, *i);
+  }
+
+  if (json_file) {
+    FILE *out = std::string(json_file) == "-" ? stdout : fopen(json_file, "w");
+    if (!out) {
+      RuntimeError::raise("Could not open output file '%s'", json_file);
+    }
+    runner.write_json(out);
+    if (out != stdout && fclose(out) != 0) {
+      RuntimeError::raise("Error writing output file '%s'", json_file);
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -0,0 +1,235 @@
+// Benchmark for tree visitors (see visitor.h).  A pass that counts
+// nodes by kind is run over ASTs and parse trees in several ways:
+//
+//   virtual     an iterative walk calling a virtual visit method,
+//               which switches on the node's tag (the way TreePrint
+//               subclasses dispatch on tags)
+//   recursive   Node::preorder with a switch in the lambda (only for
+//               trees shallow enough for the recursion)
+//   preorder    TreeWalker::preorder with a TreeVisitor
+//   postorder   TreeWalker::postorder with the same TreeVisitor
+//
+// The counts from each way are checked against each other.  The
+// comparison is only meaningful for an optimized build (as the
+// Makefile builds it), where TreeVisitor's dispatch is inlined.
+//
+// Usage: bench_visit [options]
+//   -f NAME   only run benchmarks whose name contains NAME
+//   -r N      minimum number of timed repetitions (default 10)
+//   -t SECS   minimum timed seconds per benchmark (default 0.2)
+//   -z SCALE  scale input sizes by SCALE (default 1)
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h> // for getopt
+#include <memory>
+#include <vector>
+#include "exceptions.h"
+#include "visitor.h"
+#include "workload.h"
+#include "treeutil.h"
+#include "bench.h"
+
+namespace {
+
+// Number of nodes of each kind
+struct KindCounts {
+  size_t ops, operands, nonterminals, tokens, other;
+
+  KindCounts() : ops(0), operands(0), nonterminals(0), tokens(0), other(0) { }
+
+  bool operator==(const KindCounts &rhs) const {
+    return ops == rhs.ops && operands == rhs.operands && nonterminals == rhs.nonterminals
+        && tokens == rhs.tokens && other == rhs.other;
+  }
+
+  void count(int tag) {
+    switch (tag) {
+    case AST_ADD:
+    case AST_SUB:
+    case AST_MULTIPLY:
+    case AST_DIVIDE:
+      ops++;
+      break;
+    case AST_VARREF:
+    case AST_INT_LITERAL:
+      operands++;
+      break;
+    case NODE_E:
+    case NODE_EPrime:
+    case NODE_T:
+    case NODE_TPrime:
+    case NODE_F:
+      nonterminals++;
+      break;
+    default:
+      if (tag >= TOK_IDENTIFIER && tag <= TOK_SEMICOLON) {
+        tokens++;
+      } else {
+        other++;
+      }
+      break;
+    }
+  }
+};
+
+// The virtual-plus-switch way
+class NodeCallback {
+public:
+  virtual ~NodeCallback() { }
+  virtual void visit(const Node *n) = 0;
+};
+
+class CountCallback : public NodeCallback {
+public:
+  KindCounts counts;
+
+  virtual void visit(const Node *n) { counts.count(n->get_tag()); }
+};
+
+void walk_virtual(const Node *t, NodeCallback &cb, std::vector<const Node *> &work) {
+  work.clear();
+  work.push_back(t);
+  while (!work.empty()) {
+    const Node *n = work.back();
+    work.pop_back();
+    cb.visit(n);
+    for (unsigned i = n->get_num_kids(); i > 0; i--) {
+      work.push_back(n->get_kid(i - 1));
+    }
+  }
+}
+
+// The static dispatch way
+class CountVisitor : public TreeVisitor<CountVisitor, const Node> {
+public:
+  KindCounts counts;
+
+  WalkAction visit_binary(const Node *) { counts.ops++; return WALK_CONTINUE; }
+  WalkAction visit_varref(const Node *) { counts.operands++; return WALK_CONTINUE; }
+  WalkAction visit_int_literal(const Node *) { counts.operands++; return WALK_CONTINUE; }
+  WalkAction visit_nonterminal(const Node *) { counts.nonterminals++; return WALK_CONTINUE; }
+  WalkAction visit_token(const Node *) { counts.tokens++; return WALK_CONTINUE; }
+  WalkAction visit_node(const Node *) { counts.other++; return WALK_CONTINUE; }
+};
+
+// A chain of n terms joined by + and -, some of them products: the
+// AST is a left-deep spine, as deep as the chain is long
+std::string gen_chain(WorkloadGen &gen, size_t n) {
+  std::string src = "v0";
+  for (size_t i = 1; i < n; i++) {
+    src += gen.random(2) == 0 ? " + " : " - ";
+    if (gen.random(3) == 0) {
+      src += std::to_string(1 + gen.random(999)) + " * ";
+    }
+    src += "v" + std::to_string(gen.random(8));
+  }
+  return src;
+}
+
+void bench_tree(BenchRunner &runner, const std::string &input, Node *t, bool shallow) {
+  double nodes = double(count_nodes(t));
+  auto report = [](const BenchResult *r) {
+    if (r) {
+      BenchRunner::print_result(stdout, *r);
+      fflush(stdout);
+    }
+  };
+
+  std::vector<const Node *> work;
+  CountCallback cb;
+  NodeCallback &base = cb;
+  report(runner.run("virtual", input, nodes, "node", [&]() {
+    cb.counts = KindCounts();
+    walk_virtual(t, base, work);
+  }));
+
+  KindCounts recursive_counts;
+  if (shallow) {
+    report(runner.run("recursive", input, nodes, "node", [&]() {
+      recursive_counts = KindCounts();
+      t->preorder([&](Node *n) { recursive_counts.count(n->get_tag()); });
+    }));
+  }
+
+  TreeWalker<const Node> walker;
+  CountVisitor pre, post;
+  report(runner.run("preorder", input, nodes, "node", [&]() {
+    pre.counts = KindCounts();
+    walker.preorder(t, pre);
+  }));
+  report(runner.run("postorder", input, nodes, "node", [&]() {
+    post.counts = KindCounts();
+    walker.postorder(t, post);
+  }));
+
+  // check the results of the benchmarks that ran (with -f, some may not have)
+  std::vector<const KindCounts *> results;
+  const char *names[] = { "virtual", "recursive", "preorder", "postorder" };
+  const KindCounts *counts[] = { &cb.counts, &recursive_counts, &pre.counts, &post.counts };
+  for (unsigned i = 0; i < 4; i++) {
+    if (runner.selected(names[i]) && (i != 1 || shallow)) {
+      results.push_back(counts[i]);
+    }
+  }
+  for (auto i = results.begin(); i != results.end(); ++i) {
+    if (!(**i == *results.front())) {
+      RuntimeError::raise("Visitors counted different nodes in %s", input.c_str());
+    }
+  }
+}
+
+}
+
+int execute(int argc, char **argv) {
+  BenchRunner::Options options;
+  double scale = 1.0;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:r:t:z:")) != -1) {
+    switch (opt) {
+    case 'f':
+      options.filter = optarg;
+      break;
+    case 'r':
+      options.min_reps = unsigned(atol(optarg));
+      break;
+    case 't':
+      options.min_secs = atof(optarg);
+      break;
+    case 'z':
+      scale = atof(optarg);
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+  if (options.min_reps < 1) {
+    options.min_reps = 1;
+  }
+
+  WorkloadGen gen(WorkloadShape(), 1);
+  size_t random_size = std::max(size_t(1), size_t(200000 * scale));
+  size_t chain_len = std::max(size_t(1), size_t(200000 * scale));
+  std::string random_src = gen.generate_nodes(random_size), chain_src = gen_chain(gen, chain_len);
+
+  BenchRunner runner(options);
+  BenchRunner::print_header(stdout);
+  std::unique_ptr<Node> t(bench_parse2(random_src));
+  bench_tree(runner, "ast-random-" + std::to_string(random_size), t.get(), true);
+  t.reset(bench_parse(random_src));
+  bench_tree(runner, "parse-random-" + std::to_string(random_size), t.get(), true);
+  t.reset(bench_parse2(chain_src));
+  bench_tree(runner, "ast-chain-" + std::to_string(chain_len), t.get(), false);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
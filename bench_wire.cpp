@@ -0,0 +1,130 @@
+// Benchmark comparing the compact AST wire format (see astwire.h)
+// with the text tree output of ASTTreePrint: output size, and
+// encoding and decoding throughput.  Decoded trees are checked
+// against the originals.
+//
+// Usage: bench_wire [-n num_trees] [-z nodes_per_tree] [-s seed]
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h> // for getopt
+#include <memory>
+#include <vector>
+#include "exceptions.h"
+#include "ast.h"
+#include "workload.h"
+#include "outbuf.h"
+#include "astwire.h"
+#include "treeutil.h"
+#include "bench.h"
+
+namespace {
+
+// feed the decoder in pieces of this size, as if read from a socket
+const size_t FEED_CHUNK = 4096;
+
+void print_row(const char *format, size_t bytes, size_t nodes, double secs) {
+  printf("%-12s %12zu %10.2f %10.1f %10.2f\n", format, bytes, double(bytes) / double(nodes),
+         double(bytes) / 1e6 / secs, double(nodes) / 1e6 / secs);
+}
+
+}
+
+int execute(int argc, char **argv) {
+  unsigned num_trees = 200;
+  size_t tree_nodes = 10000;
+  uint64_t seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:z:s:")) != -1) {
+    switch (opt) {
+    case 'n':
+      num_trees = unsigned(atol(optarg));
+      break;
+    case 'z':
+      tree_nodes = size_t(atol(optarg));
+      break;
+    case 's':
+      seed = uint64_t(atoll(optarg));
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+
+  WorkloadGen gen(WorkloadShape(), seed);
+  std::vector<std::unique_ptr<Node>> trees;
+  size_t total_nodes = 0;
+  for (unsigned i = 0; i < num_trees; i++) {
+    trees.push_back(std::unique_ptr<Node>(bench_parse2(gen.generate_nodes(tree_nodes))));
+    total_nodes += count_nodes(trees.back().get());
+  }
+
+  // text tree output
+  std::string text;
+  StringSink text_sink(text);
+  ASTTreePrint tp;
+  double start = bench_now();
+  {
+    OutputBuffer out(text_sink);
+    for (auto i = trees.begin(); i != trees.end(); ++i) {
+      tp.print(i->get(), out);
+    }
+    out.flush();
+  }
+  double text_secs = bench_now() - start;
+
+  // wire encoding
+  std::string wire;
+  StringSink wire_sink(wire);
+  start = bench_now();
+  {
+    OutputBuffer out(wire_sink);
+    ASTWireEncoder encoder(out);
+    for (auto i = trees.begin(); i != trees.end(); ++i) {
+      encoder.encode(i->get());
+    }
+    out.flush();
+  }
+  double encode_secs = bench_now() - start;
+
+  // wire decoding
+  std::vector<std::unique_ptr<Node>> decoded;
+  start = bench_now();
+  {
+    ASTWireDecoder decoder;
+    for (size_t pos = 0; pos < wire.size(); pos += FEED_CHUNK) {
+      decoder.feed(wire.data() + pos, std::min(FEED_CHUNK, wire.size() - pos));
+      while (Node *t = decoder.next()) {
+        decoded.push_back(std::unique_ptr<Node>(t));
+      }
+    }
+  }
+  double decode_secs = bench_now() - start;
+
+  if (decoded.size() != trees.size()) {
+    RuntimeError::raise("Decoded %zu trees, expected %zu", decoded.size(), trees.size());
+  }
+  for (size_t i = 0; i < trees.size(); i++) {
+    if (!trees_equal(trees[i].get(), decoded[i].get(), true)) {
+      RuntimeError::raise("Decoded tree %zu differs from original", i);
+    }
+  }
+
+  printf("%u trees, %zu nodes\n", num_trees, total_nodes);
+  printf("%-12s %12s %10s %10s %10s\n", "format", "bytes", "bytes/node", "MB/s", "Mnodes/s");
+  print_row("text", text.size(), total_nodes, text_secs);
+  print_row("wire encode", wire.size(), total_nodes, encode_secs);
+  print_row("wire decode", wire.size(), total_nodes, decode_secs);
+  printf("wire/text size ratio: %.3f\n", double(wire.size()) / double(text.size()));
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -18,7 +18,7 @@ int buildast_operator_tag(int op_tag) {
   case TOK_TIMES:
     return AST_MULTIPLY;
   case TOK_DIVIDE:
-    return TOK_DIVIDE;
+    return AST_DIVIDE;
   default:
     RuntimeError::raise("Unknown operator %d in parse tree", op_tag);
   }
@@ -69,7 +69,12 @@ Node *buildast(Node *t) {
     return new Node(AST_VARREF, t->get_str());
 
   case TOK_INTEGER_LITERAL: // integer literal
-    return new Node(AST_INT_LITERAL, t->get_str());
+    {
+      // keep the value decoded by the lexer
+      Node *lit = new Node(AST_INT_LITERAL, t->get_str());
+      lit->set_ival(t->get_ival());
+      return lit;
+    }
 
   default:
     RuntimeError::raise("Unknown parse node type %d", tag);
@@ -0,0 +1,80 @@
+#include "ast.h"
+#include "exceptions.h"
+#include "eval.h"
+
+Evaluator::Evaluator() {
+}
+
+Evaluator::~Evaluator() {
+}
+
+int64_t Evaluator::eval(const Node *ast, const int64_t *slot_values) {
+  m_work.clear();
+  m_values.clear();
+
+  m_work.push_back({ ast, 0 });
+  while (!m_work.empty()) {
+    const Node *n = m_work.back().first;
+    unsigned next_kid = m_work.back().second;
+
+    if (next_kid < n->get_num_kids()) {
+      // evaluate the next operand first
+      m_work.back().second++;
+      m_work.push_back({ n->get_kid(next_kid), 0 });
+      continue;
+    }
+    m_work.pop_back();
+
+    switch (n->get_tag()) {
+    case AST_INT_LITERAL:
+      if (!n->has_ival()) {
+        EvaluationError::raise(n->get_loc(), "Integer literal '%s' was not decoded", n->get_str().c_str());
+      }
+      m_values.push_back(n->get_ival());
+      break;
+
+    case AST_VARREF:
+      if (n->get_slot() < 0) {
+        EvaluationError::raise(n->get_loc(), "Variable '%s' is not bound to a slot", n->get_str().c_str());
+      }
+      m_values.push_back(slot_values[n->get_slot()]);
+      break;
+
+    default:
+      {
+        // binary operator: both operand values are on the value stack
+        int64_t rhs = m_values.back();
+        m_values.pop_back();
+        int64_t lhs = m_values.back();
+        m_values.back() = apply_op(n, lhs, rhs);
+      }
+      break;
+    }
+  }
+
+  return m_values.back();
+}
+
+int64_t Evaluator::apply_op(const Node *n, int64_t lhs, int64_t rhs) {
+  // do addition, subtraction, and multiplication using unsigned
+  // arithmetic, so that overflow wraps rather than being undefined
+  switch (n->get_tag()) {
+  case AST_ADD:
+    return int64_t(uint64_t(lhs) + uint64_t(rhs));
+  case AST_SUB:
+    return int64_t(uint64_t(lhs) - uint64_t(rhs));
+  case AST_MULTIPLY:
+    return int64_t(uint64_t(lhs) * uint64_t(rhs));
+  case AST_DIVIDE:
+    if (rhs == 0) {
+      EvaluationError::raise(n->get_loc(), "Division by zero");
+    }
+    if (rhs == -1) {
+      // avoid INT64_MIN / -1, which traps
+      return int64_t(0 - uint64_t(lhs));
+    }
+    return lhs / rhs;
+  default:
+    EvaluationError::raise(n->get_loc(), "Unknown AST node type %d", n->get_tag());
+  }
+}
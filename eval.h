@@ -0,0 +1,41 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "node.h"
+
+// Evaluator for ASTs whose variable references have been bound
+// to slot indices (see bind_varrefs in symtab.h).  Variable values
+// are passed as an array indexed by slot.  Integer literals must
+// carry the value decoded by the lexer.
+//
+// Arithmetic is on 64-bit integers and wraps on overflow.
+// Division by zero raises EvaluationError.
+//
+// Evaluation is iterative, so arbitrarily deep trees can be
+// evaluated.  An Evaluator keeps its scratch stacks between calls,
+// so reusing one Evaluator for many evaluations avoids allocation.
+// An Evaluator must not be shared between threads.
+class Evaluator {
+private:
+  std::vector<std::pair<const Node *, unsigned>> m_work;
+  std::vector<int64_t> m_values;
+
+  // no value semantics
+  Evaluator(const Evaluator &);
+  Evaluator &operator=(const Evaluator &);
+
+public:
+  Evaluator();
+  ~Evaluator();
+
+  int64_t eval(const Node *ast, const int64_t *slot_values);
+
+  // Apply a binary AST operator to two values: n is the operator node,
+  // used for reporting errors
+  static int64_t apply_op(const Node *n, int64_t lhs, int64_t rhs);
+};
+
+#endif // EVAL_H
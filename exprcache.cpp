@@ -0,0 +1,157 @@
+#include <cctype>
+#include <cstdio>
+#include <vector>
+#include "exceptions.h"
+#include "lexer.h"
+#include "parser2.h"
+#include "exprcache.h"
+
+////////////////////////////////////////////////////////////////////////
+// ExprCache::Stats implementation
+////////////////////////////////////////////////////////////////////////
+
+double ExprCache::Stats::hit_rate() const {
+  uint64_t lookups = hits + misses;
+  return lookups == 0 ? 0.0 : double(hits) / double(lookups);
+}
+
+////////////////////////////////////////////////////////////////////////
+// ExprCache implementation
+////////////////////////////////////////////////////////////////////////
+
+size_t ExprCache::KeyHash::operator()(const std::string &key) const {
+  uint64_t h = 14695981039346656037ULL;
+  for (auto i = key.begin(); i != key.end(); ++i) {
+    h ^= uint64_t(static_cast<unsigned char>(*i));
+    h *= 1099511628211ULL;
+  }
+  return size_t(h);
+}
+
+ExprCache::ExprCache(size_t max_entries, size_t max_bytes, const std::string &filename)
+  : m_max_entries(max_entries > 0 ? max_entries : 1)
+  , m_max_bytes(max_bytes)
+  , m_filename(filename)
+  , m_hits(0)
+  , m_misses(0)
+  , m_evictions(0)
+  , m_bytes(0) {
+}
+
+ExprCache::~ExprCache() {
+}
+
+std::shared_ptr<const Node> ExprCache::get(const std::string &src) {
+  std::string key = normalize(src);
+
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto i = m_index.find(key);
+    if (i != m_index.end()) {
+      // move entry to front of LRU list
+      m_lru.splice(m_lru.begin(), m_lru, i->second);
+      m_hits++;
+      return i->second->ast;
+    }
+    m_misses++;
+  }
+
+  // Parse without holding the lock, so that other threads can
+  // use the cache while we're busy
+  std::shared_ptr<const Node> ast(parse(key));
+  size_t bytes = tree_bytes(ast.get()) + 2*key.capacity();
+
+  std::lock_guard<std::mutex> guard(m_lock);
+
+  // another thread may have added the same expression meanwhile
+  auto i = m_index.find(key);
+  if (i != m_index.end()) {
+    m_lru.splice(m_lru.begin(), m_lru, i->second);
+    return i->second->ast;
+  }
+
+  m_lru.push_front({ key, ast, bytes });
+  m_index[key] = m_lru.begin();
+  m_bytes += bytes;
+  evict_excess();
+
+  return ast;
+}
+
+void ExprCache::clear() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  m_index.clear();
+  m_lru.clear();
+  m_bytes = 0;
+}
+
+ExprCache::Stats ExprCache::get_stats() const {
+  std::lock_guard<std::mutex> guard(m_lock);
+  Stats stats;
+  stats.hits = m_hits;
+  stats.misses = m_misses;
+  stats.evictions = m_evictions;
+  stats.entries = m_lru.size();
+  stats.bytes = m_bytes;
+  return stats;
+}
+
+std::string ExprCache::normalize(const std::string &src) {
+  std::string key;
+  key.reserve(src.size());
+
+  bool pending_space = false;
+  for (auto i = src.begin(); i != src.end(); ++i) {
+    unsigned char c = static_cast<unsigned char>(*i);
+    if (isspace(c)) {
+      pending_space = true;
+      continue;
+    }
+    // whitespace is only significant if it separates two
+    // identifier or integer literal characters
+    if (pending_space && !key.empty() && isalnum(c)
+        && isalnum(static_cast<unsigned char>(key.back()))) {
+      key.push_back(' ');
+    }
+    pending_space = false;
+    key.push_back(char(c));
+  }
+
+  return key;
+}
+
+size_t ExprCache::tree_bytes(const Node *t) {
+  size_t bytes = 0;
+  std::vector<const Node *> work;
+  work.push_back(t);
+  while (!work.empty()) {
+    const Node *n = work.back();
+    work.pop_back();
+    bytes += sizeof(Node) + n->get_num_kids()*sizeof(Node *);
+    bytes += n->get_str().size() + n->get_loc().get_srcfile().size();
+    for (auto i = n->cbegin(); i != n->cend(); ++i) {
+      work.push_back(*i);
+    }
+  }
+  return bytes;
+}
+
+Node *ExprCache::parse(const std::string &key) const {
+  // each thread reuses one parser (see Lexer::reset)
+  thread_local Parser2 parser2(new Lexer());
+  parser2.reset(key.data(), key.size(), m_filename);
+  return parser2.parse();
+}
+
+void ExprCache::evict_excess() {
+  // always keep the most recently added entry, even if it is
+  // larger than the byte limit on its own
+  while (m_lru.size() > 1
+         && (m_lru.size() > m_max_entries || (m_max_bytes > 0 && m_bytes > m_max_bytes))) {
+    Entry &victim = m_lru.back();
+    m_bytes -= victim.bytes;
+    m_index.erase(victim.key);
+    m_lru.pop_back();
+    m_evictions++;
+  }
+}
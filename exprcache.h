@@ -0,0 +1,87 @@
+#ifndef EXPRCACHE_H
+#define EXPRCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "node.h"
+
+// Bounded, thread-safe LRU cache of ASTs (as built by Parser2),
+// keyed by normalized source text.  Normalization removes
+// whitespace that does not separate two identifier/literal characters,
+// so "a+b" and "a + b" share one entry.  Cached ASTs are parsed from
+// the normalized text, so their source locations refer to it.
+//
+// Returned trees are shared and must not be modified.  A tree stays
+// valid for as long as the caller holds a reference to it, even if
+// it is evicted from the cache in the meantime.
+class ExprCache {
+public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+    size_t bytes;          // approximate memory used by cached ASTs
+
+    double hit_rate() const;
+  };
+
+private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<const Node> ast;
+    size_t bytes;
+  };
+
+  // FNV-1a hash of the normalized source text
+  struct KeyHash {
+    size_t operator()(const std::string &key) const;
+  };
+
+  typedef std::list<Entry> EntryList;
+
+  size_t m_max_entries, m_max_bytes;
+  std::string m_filename;
+  mutable std::mutex m_lock;
+  EntryList m_lru;   // most recently used entry at front
+  std::unordered_map<std::string, EntryList::iterator, KeyHash> m_index;
+  uint64_t m_hits, m_misses, m_evictions;
+  size_t m_bytes;
+
+  // no value semantics
+  ExprCache(const ExprCache &);
+  ExprCache &operator=(const ExprCache &);
+
+public:
+  // max_bytes == 0 means the cache is bounded only by max_entries.
+  // filename is used as the source file of the cached ASTs' locations.
+  ExprCache(size_t max_entries, size_t max_bytes = 0, const std::string &filename = "<cache>");
+  ~ExprCache();
+
+  // Get the AST for given source text, parsing it on a cache miss.
+  // Throws SyntaxError if the text is not a valid expression
+  // (parse failures are not cached).
+  std::shared_ptr<const Node> get(const std::string &src);
+
+  // Remove all entries (statistics are not reset)
+  void clear();
+
+  Stats get_stats() const;
+
+  // Normalize source text for use as a cache key
+  static std::string normalize(const std::string &src);
+
+  // Approximate number of bytes of heap memory used by a tree
+  static size_t tree_bytes(const Node *t);
+
+private:
+  Node *parse(const std::string &key) const;
+  void evict_excess();
+};
+
+#endif // EXPRCACHE_H
@@ -0,0 +1,247 @@
+// Generator of synthetic expression workloads: writes expressions in
+// the language accepted by Parser and Parser2, with a configurable
+// shape (see WorkloadShape in workload.h), to standard output or a file.
+//
+// Usage: genexpr [options]
+//   -s SEED      random seed (default 1)
+//   -b BYTES     stop after this much output (suffixes K, M, G;
+//                default 1M)
+//   -n COUNT     stop after this many expressions
+//   -m MODE      lines:  one expression per line (the default)
+//                script: one statement "sN = expression;" per line,
+//                        with N zero-padded so that statement names
+//                        are longer than any generated identifier
+//                        (so expressions never refer to statements)
+//                single: a single expression, joining the generated
+//                        expressions with + (note that Parser, used
+//                        by astdemo -p and -b, recurses once per
+//                        top-level operator; Parser2 doesn't)
+//   -o W,W,W,W   weights of the +, -, *, / operators (default 3,2,3,1)
+//   -k MIN-MAX   operands per operator chain (default 2-5)
+//   -d DEPTH     maximum parenthesis nesting depth (default 4)
+//   -p PROB      probability of an operand being parenthesized (0.2)
+//   -r PROB      probability of a leaf being a literal (0.3)
+//   -i MIN-MAX   identifier length (default 1-6)
+//   -a CHARS     identifier alphabet (default a-z and 0-9)
+//   -V SIZE      draw identifiers from a vocabulary of SIZE names
+//   -L MIN-MAX   digits in integer literals (default 1-3)
+//   -w DENSITY   average whitespace characters between tokens (1.0)
+//   -N           whitespace may include newlines (so expressions
+//                may span lines)
+//   -D           allow division by any operand, not just by
+//                nonzero literals
+//   -f FILE      write output to FILE instead of standard output
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h> // for getopt
+#include "exceptions.h"
+#include "outbuf.h"
+#include "workload.h"
+
+namespace {
+
+enum {
+  LINES_MODE,
+  SCRIPT_MODE,
+  SINGLE_MODE,
+};
+
+unsigned long parse_number(const char *s, const char *what) {
+  char *end;
+  errno = 0;
+  unsigned long val = strtoul(s, &end, 10);
+  if (errno != 0 || end == s || *end != '\0') {
+    RuntimeError::raise("Invalid %s '%s'", what, s);
+  }
+  return val;
+}
+
+double parse_double(const char *s, const char *what) {
+  char *end;
+  double val = strtod(s, &end);
+  if (end == s || *end != '\0') {
+    RuntimeError::raise("Invalid %s '%s'", what, s);
+  }
+  return val;
+}
+
+// Parse a byte count with an optional K, M, or G suffix
+uint64_t parse_size(const char *s) {
+  char *end;
+  errno = 0;
+  uint64_t val = strtoull(s, &end, 10);
+  if (errno != 0 || end == s) {
+    RuntimeError::raise("Invalid size '%s'", s);
+  }
+  switch (*end) {
+  case 'K': case 'k': val <<= 10; end++; break;
+  case 'M': case 'm': val <<= 20; end++; break;
+  case 'G': case 'g': val <<= 30; end++; break;
+  }
+  if (*end != '\0') {
+    RuntimeError::raise("Invalid size '%s'", s);
+  }
+  return val;
+}
+
+// Parse a range MIN-MAX (or a single number, meaning MIN = MAX)
+void parse_range(const char *s, unsigned &min, unsigned &max, const char *what) {
+  std::string str(s);
+  size_t dash = str.find('-');
+  if (dash == std::string::npos) {
+    min = max = unsigned(parse_number(s, what));
+  } else {
+    min = unsigned(parse_number(str.substr(0, dash).c_str(), what));
+    max = unsigned(parse_number(str.substr(dash + 1).c_str(), what));
+  }
+}
+
+void parse_weights(const char *s, unsigned weights[4]) {
+  std::string str(s);
+  size_t pos = 0;
+  for (unsigned i = 0; i < 4; i++) {
+    size_t comma = str.find(',', pos);
+    if ((comma == std::string::npos) != (i == 3)) {
+      RuntimeError::raise("Operator weights must be four numbers separated by commas");
+    }
+    weights[i] = unsigned(parse_number(str.substr(pos, comma - pos).c_str(), "operator weight"));
+    pos = comma + 1;
+  }
+}
+
+}
+
+int execute(int argc, char **argv) {
+  WorkloadShape shape;
+  uint64_t seed = 1, max_bytes = 1 << 20, max_count = 0;
+  int mode = LINES_MODE;
+  const char *outfile = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:b:n:m:o:k:d:p:r:i:a:V:L:w:NDf:")) != -1) {
+    switch (opt) {
+    case 's':
+      seed = parse_number(optarg, "seed");
+      break;
+    case 'b':
+      max_bytes = parse_size(optarg);
+      break;
+    case 'n':
+      max_count = parse_number(optarg, "count");
+      break;
+    case 'm':
+      if (strcmp(optarg, "lines") == 0) {
+        mode = LINES_MODE;
+      } else if (strcmp(optarg, "script") == 0) {
+        mode = SCRIPT_MODE;
+      } else if (strcmp(optarg, "single") == 0) {
+        mode = SINGLE_MODE;
+      } else {
+        RuntimeError::raise("Unknown mode '%s'", optarg);
+      }
+      break;
+    case 'o':
+      parse_weights(optarg, shape.op_weights);
+      break;
+    case 'k':
+      parse_range(optarg, shape.chain_min, shape.chain_max, "chain length");
+      break;
+    case 'd':
+      shape.max_depth = unsigned(parse_number(optarg, "depth"));
+      break;
+    case 'p':
+      shape.paren_prob = parse_double(optarg, "probability");
+      break;
+    case 'r':
+      shape.literal_prob = parse_double(optarg, "probability");
+      break;
+    case 'i':
+      parse_range(optarg, shape.ident_min, shape.ident_max, "identifier length");
+      break;
+    case 'a':
+      shape.ident_alphabet = optarg;
+      break;
+    case 'V':
+      shape.vocab_size = unsigned(parse_number(optarg, "vocabulary size"));
+      break;
+    case 'L':
+      parse_range(optarg, shape.literal_min, shape.literal_max, "literal length");
+      break;
+    case 'w':
+      shape.ws_density = parse_double(optarg, "whitespace density");
+      break;
+    case 'N':
+      shape.ws_newlines = true;
+      break;
+    case 'D':
+      shape.safe_division = false;
+      break;
+    case 'f':
+      outfile = optarg;
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+
+  WorkloadGen gen(shape, seed);
+
+  int fd = STDOUT_FILENO;
+  if (outfile) {
+    fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+      RuntimeError::raise("Could not open output file '%s': %s", outfile, strerror(errno));
+    }
+  }
+
+  FdSink sink(fd);
+  OutputBuffer out(sink, 1 << 20);
+  uint64_t bytes = 0, count = 0;
+  std::string name;
+  while (bytes < max_bytes && (max_count == 0 || count < max_count)) {
+    if (mode == SCRIPT_MODE) {
+      name = std::to_string(count);
+      if (name.size() < shape.ident_max) {
+        name.insert(0, shape.ident_max - name.size(), '0');
+      }
+      name.insert(0, 1, 's');
+      name += " = ";
+      out.write(name);
+      bytes += name.size();
+    } else if (mode == SINGLE_MODE && count > 0) {
+      out.write(" + ", 3);
+      bytes += 3;
+    }
+    bytes += gen.generate(out);
+    if (mode == SCRIPT_MODE) {
+      out.write(";\n", 2);
+      bytes += 2;
+    } else if (mode == LINES_MODE) {
+      out.put('\n');
+      bytes++;
+    }
+    count++;
+  }
+  if (mode == SINGLE_MODE) {
+    out.put('\n');
+  }
+  out.flush();
+
+  if (outfile && close(fd) != 0) {
+    RuntimeError::raise("Error writing output file '%s': %s", outfile, strerror(errno));
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -1,5 +1,6 @@
 #include <cassert>
 #include <cctype>
+#include <cstdint>
 #include <string>
 #include "cpputil.h"
 #include "token.h"
@@ -10,19 +11,88 @@
 // Lexer implementation
 ////////////////////////////////////////////////////////////////////////
 
+TokenSource::~TokenSource() {
+}
+
 Lexer::Lexer(FILE *in, const std::string &filename)
   : m_in(in)
+  , m_source(nullptr)
+  , m_buf(nullptr)
+  , m_buf_len(0)
   , m_filename(filename)
   , m_line(1)
   , m_col(1)
+  , m_prev_col(1)
+  , m_offset(0)
+  , m_eof(false) {
+}
+
+Lexer::Lexer(const char *buf, size_t len, const std::string &filename)
+  : m_in(nullptr)
+  , m_source(nullptr)
+  , m_buf(buf)
+  , m_buf_len(len)
+  , m_filename(filename)
+  , m_line(1)
+  , m_col(1)
+  , m_prev_col(1)
+  , m_offset(0)
+  , m_eof(false) {
+}
+
+Lexer::Lexer(TokenSource *source, const std::string &filename)
+  : m_in(nullptr)
+  , m_source(source)
+  , m_buf(nullptr)
+  , m_buf_len(0)
+  , m_filename(filename)
+  , m_line(1)
+  , m_col(1)
+  , m_prev_col(1)
+  , m_offset(0)
+  , m_eof(false) {
+}
+
+Lexer::Lexer()
+  : m_in(nullptr)
+  , m_source(nullptr)
+  , m_buf(nullptr)
+  , m_buf_len(0)
+  , m_line(1)
+  , m_col(1)
+  , m_prev_col(1)
+  , m_offset(0)
   , m_eof(false) {
 }
 
 Lexer::~Lexer() {
-  // delete any cached lookahead tokens
-  for (auto i = m_lookahead.begin(); i != m_lookahead.end(); ++i) {
-    delete *i;
-  }
+  clear_lookahead();
+  delete m_source;
+}
+
+void Lexer::reset(const char *buf, size_t len, const std::string &filename) {
+  clear_lookahead();
+  delete m_source;
+  m_source = nullptr;
+  m_in = nullptr;
+  m_buf = buf;
+  m_buf_len = len;
+  m_filename = filename;
+  m_line = 1;
+  m_col = 1;
+  m_offset = 0;
+  m_eof = false;
+}
+
+void Lexer::reset(FILE *in, const std::string &filename) {
+  reset(nullptr, 0, filename);
+  m_in = in;
+}
+
+void Lexer::set_position(int line, int col) {
+  assert(m_lookahead.empty());
+  m_line = line;
+  m_col = col;
 }
 
 Node *Lexer::next() {
@@ -53,16 +123,33 @@ Location Lexer::get_current_loc() const {
   return Location(m_filename, m_line, m_col);
 }
 
+// Delete any cached lookahead tokens
+void Lexer::clear_lookahead() {
+  for (auto i = m_lookahead.begin(); i != m_lookahead.end(); ++i) {
+    delete *i;
+  }
+  m_lookahead.clear();
+}
+
 // Read the next character of input, returning -1 (and setting m_eof to true)
 // if the end of input has been reached.
 int Lexer::read() {
   if (m_eof) {
     return -1;
   }
-  int c = fgetc(m_in);
+  int c;
+  if (m_in) {
+    c = getc_unlocked(m_in);
+  } else {
+    c = m_offset < m_buf_len ? static_cast<unsigned char>(m_buf[m_offset]) : -1;
+  }
   if (c < 0) {
     m_eof = true;
-  } else if (c == '\n') {
+    return c;
+  }
+  m_offset++;
+  if (c == '\n') {
+    m_prev_col = m_col;
     m_col = 1;
     m_line++;
   } else {
@@ -74,24 +161,90 @@ int Lexer::read() {
 // "Unread" a character.  Useful for when reading a character indicates
 // that the current token has ended and the next one has begun.
 void Lexer::unread(int c) {
-  ungetc(c, m_in);
-  m_col--;
+  // in buffer mode, decrementing the offset is enough
+  if (m_in) {
+    ungetc(c, m_in);
+  }
+  m_offset--;
+  if (c == '\n') {
+    m_line--;
+    m_col = m_prev_col;
+  } else {
+    m_col--;
+  }
 }
 
 void Lexer::fill(int how_many) {
   assert(how_many > 0);
-  if (!m_eof && int(m_lookahead.size()) < how_many) {
+  if (m_source) {
+    fill_from_source(how_many);
+  } else if (!m_eof && int(m_lookahead.size()) < how_many) {
     m_lookahead.push_back(read_token());
   }
 }
 
+// Take tokens from the token source until there are at least
+// how_many lookahead tokens, or the source is exhausted
+void Lexer::fill_from_source(int how_many) {
+  while (!m_eof && int(m_lookahead.size()) < how_many) {
+    if (!m_source->next_tokens(m_lookahead, m_line, m_col, m_offset)) {
+      m_eof = true;
+    }
+  }
+}
+
 Node *Lexer::read_token() {
-  int c, line = -1, col = -1;
+  LexToken tok;
+  m_lexeme.clear();
+  if (!scan(tok, m_lexeme)) {
+    // reached end of file
+    return nullptr;
+  }
+  return token_create(static_cast<enum TokenKind>(tok.kind), m_lexeme, tok.line, tok.col);
+}
+
+size_t Lexer::prelex() {
+  if (m_source) {
+    size_t count = m_lookahead.size();
+    fill_from_source(INT32_MAX);
+    return m_lookahead.size() - count;
+  }
+
+  size_t count = 0;
+  while (!m_eof) {
+    Node *tok = read_token();
+    if (!tok) {
+      break;
+    }
+    m_lookahead.push_back(tok);
+    count++;
+  }
+  return count;
+}
+
+size_t Lexer::lex_batch(std::vector<LexToken> &toks, std::string &lexemes, size_t max_tokens) {
+  assert(m_lookahead.empty() && !m_source);
+  toks.clear();
+  lexemes.clear();
+
+  LexToken tok;
+  while (toks.size() < max_tokens && scan(tok, lexemes)) {
+    toks.push_back(tok);
+  }
+  return toks.size();
+}
+
+// Scan the next token, appending its lexeme to given string and
+// storing its kind and position in tok.  Returns false (and leaves
+// the lexeme string unchanged) if the end of input is reached.
+bool Lexer::scan(LexToken &tok, std::string &lexeme) {
+  int c;
 
   // skip whitespace characters until a non-whitespace character is read
   for (;;) {
-    line = m_line;
-    col = m_col;
+    tok.line = m_line;
+    tok.col = m_col;
+    tok.offset = m_offset;
     c = read();
     if (c < 0 || !isspace(c)) {
       break;
@@ -100,65 +253,99 @@ Node *Lexer::read_token() {
 
   if (c < 0) {
     // reached end of file
-    return nullptr;
+    return false;
   }
 
-  std::string lexeme;
+  size_t start = lexeme.size();
   lexeme.push_back(char(c));
 
   if (isalpha(c)) {
-    return read_continued_token(TOK_IDENTIFIER, lexeme, line, col, isalnum);
+    tok.kind = TOK_IDENTIFIER;
+    scan_continued(lexeme, isalnum);
   } else if (isdigit(c)) {
-    return read_continued_token(TOK_INTEGER_LITERAL, lexeme, line, col, isdigit);
+    tok.kind = TOK_INTEGER_LITERAL;
+    scan_continued(lexeme, isdigit);
   } else {
     switch (c) {
     case '+':
-      return token_create(TOK_PLUS, lexeme, line, col);
+      tok.kind = TOK_PLUS;
+      break;
     case '-':
-      return token_create(TOK_MINUS, lexeme, line, col);
+      tok.kind = TOK_MINUS;
+      break;
     case '*':
-      return token_create(TOK_TIMES, lexeme, line, col);
+      tok.kind = TOK_TIMES;
+      break;
     case '/':
-      return token_create(TOK_DIVIDE, lexeme, line, col);
+      tok.kind = TOK_DIVIDE;
+      break;
     case '(':
-      return token_create(TOK_LPAREN, lexeme, line, col);
+      tok.kind = TOK_LPAREN;
+      break;
     case ')':
-      return token_create(TOK_RPAREN, lexeme, line, col);
-#ifdef SOLUTION
+      tok.kind = TOK_RPAREN;
+      break;
     case ';':
-      return token_create(TOK_SEMICOLON, lexeme, line, col);
+      tok.kind = TOK_SEMICOLON;
+      break;
     case '=':
-      return token_create(TOK_ASSIGN, lexeme, line, col);
-#endif
+      tok.kind = TOK_ASSIGN;
+      break;
     default:
       SyntaxError::raise(get_current_loc(), "Unrecognized character '%c'", c);
     }
-  } 
+  }
+
+  tok.length = uint32_t(lexeme.size() - start);
+  return true;
 }
 
-// Read the continuation of a (possibly) multi-character token, such as
+// Scan the continuation of a (possibly) multi-character token, such as
 // an identifier or integer literal.  pred is a pointer to a predicate
 // function to determine which characters are valid continuations.
-Node *Lexer::read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col, int (*pred)(int)) {
-  std::string lexeme(lexeme_start);
+void Lexer::scan_continued(std::string &lexeme, int (*pred)(int)) {
   for (;;) {
     int c = read();
     if (c >= 0 && pred(c)) {
-      // token has finished
       lexeme.push_back(char(c));
     } else {
+      // token has finished
       if (c >= 0) {
         unread(c);
       }
-      return token_create(kind, lexeme, line, col);
+      return;
     }
   }
 }
 
 // Helper function to create a Node object to represent a token.
 Node *Lexer::token_create(enum TokenKind kind, const std::string &lexeme, int line, int col) {
-  Node *token = new Node(kind, lexeme);
   Location source_info(m_filename, line, col);
+
+  // decode integer literals once, so that consumers of the tokens
+  // (and the AST nodes built from them) don't need to re-parse digits
+  int64_t ival = 0;
+  if (kind == TOK_INTEGER_LITERAL) {
+    ival = decode_int_literal(lexeme, source_info);
+  }
+
+  Node *token = new Node(kind, lexeme);
   token->set_loc(source_info);
+  if (kind == TOK_INTEGER_LITERAL) {
+    token->set_ival(ival);
+  }
   return token;
 }
+
+int64_t Lexer::decode_int_literal(const std::string &lexeme, const Location &loc) {
+  const uint64_t max = uint64_t(INT64_MAX);
+  uint64_t val = 0;
+  for (auto i = lexeme.begin(); i != lexeme.end(); ++i) {
+    uint64_t digit = uint64_t(*i - '0');
+    if (val > (max - digit) / 10) {
+      SyntaxError::raise(loc, "Integer literal '%s' is out of range", lexeme.c_str());
+    }
+    val = val*10 + digit;
+  }
+  return int64_t(val);
+}
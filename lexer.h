@@ -2,22 +2,86 @@
 #define LEXER_H
 
 #include <deque>
+#include <vector>
 #include <cstdio>
+#include <cstdint>
 #include "token.h"
 #include "node.h"
 
+// Kind and position of a token, as produced by bulk lexing
+struct LexToken {
+  int kind;          // a TokenKind value
+  int line, col;
+  uint64_t offset;   // byte offset of the token in the input
+  uint32_t length;   // length of the lexeme, in bytes
+};
+
+// Supplier of tokens lexed somewhere else (for example, by a lexer
+// running on another thread: see TokenPipeline)
+class TokenSource {
+public:
+  virtual ~TokenSource();
+
+  // Append the next tokens of the input to given queue, and set line,
+  // col, and offset to the source position following them (offset
+  // being the number of bytes of input read.)  Returns false
+  // (appending no tokens) at the end of input.  Errors found while
+  // lexing the input are thrown once the tokens preceding them have
+  // been returned.
+  virtual bool next_tokens(std::deque<Node *> &tokens, int &line, int &col, uint64_t &offset) = 0;
+};
+
+// A Lexer reads either from a stdio stream or from an in-memory
+// buffer.  In the latter case, the offset of the next character
+// is m_offset.  A lexer can be reset to read a new input, reusing
+// its lookahead and lexeme storage, so that many short inputs can
+// be lexed without setting up a lexer for each one.  A lexer can
+// also pass on tokens from a TokenSource, so that a parser can use
+// tokens lexed elsewhere.
 class Lexer {
 private:
-  FILE *m_in;
+  FILE *m_in;              // null when reading from a buffer
+  TokenSource *m_source;   // null unless passing on tokens from a source
+  const char *m_buf;
+  size_t m_buf_len;
   std::deque<Node *> m_lookahead;
   std::string m_filename;
+  std::string m_lexeme;    // scratch space for read_token
   int m_line, m_col;
+  int m_prev_col;          // column before the last newline read
+  uint64_t m_offset;
   bool m_eof;
 
+  // no value semantics
+  Lexer(const Lexer &);
+  Lexer &operator=(const Lexer &);
+
 public:
   Lexer(FILE *in, const std::string &filename);
+
+  // Read from an in-memory buffer, which must remain valid while
+  // the lexer reads from it (the contents are not copied)
+  Lexer(const char *buf, size_t len, const std::string &filename);
+
+  // Pass on tokens from given source, which the lexer takes
+  // ownership of (it is deleted when the lexer is destroyed or reset)
+  Lexer(TokenSource *source, const std::string &filename);
+
+  // Read an empty input: call reset to give the lexer an input
+  Lexer();
+
   ~Lexer();
 
+  // Start reading a new input, discarding any lookahead tokens
+  // and resetting the current position to line 1, column 1
+  void reset(const char *buf, size_t len, const std::string &filename);
+  void reset(FILE *in, const std::string &filename);
+
+  // Set the current line and column, when the input is a piece of a
+  // larger source starting at that position, so that tokens have their
+  // locations in the whole source
+  void set_position(int line, int col);
+
   // Consume the next token.
   // Throws SyntaxError if the input ends before
   // one token can be read.
@@ -33,13 +97,33 @@ public:
   // Get the current source location: useful for error reporting
   Location get_current_loc() const;
 
+  // Read all remaining tokens into the lookahead queue, so that
+  // lexing can be timed separately from parsing.  Returns the number
+  // of tokens read.
+  size_t prelex();
+
+  // Number of bytes of input read so far
+  uint64_t get_offset() const { return m_offset; }
+
+  // Bulk lexing: read up to max_tokens tokens without creating Nodes.
+  // toks is filled with the tokens' kinds and positions, and lexemes
+  // with their lexemes, one after another (so the lexeme of each token
+  // starts where the previous token's lexeme ended.)  Returns the number
+  // of tokens read, which is 0 only at the end of input.  Must not be
+  // mixed with next/peek on the same lexer.
+  size_t lex_batch(std::vector<LexToken> &toks, std::string &lexemes, size_t max_tokens);
+
 private:
+  void clear_lookahead();
+  void fill_from_source(int how_many);
   int read();
   void unread(int c);
   void fill(int how_many);
   Node *read_token();
-  Node *read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col, int (*pred)(int));
+  bool scan(LexToken &tok, std::string &lexeme);
+  void scan_continued(std::string &lexeme, int (*pred)(int));
   Node *token_create(enum TokenKind kind, const std::string &lexeme, int line, int col);
+  int64_t decode_int_literal(const std::string &lexeme, const Location &loc);
 };
 
 #endif // LEXER_H
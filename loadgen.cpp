@@ -0,0 +1,236 @@
+// Load generator for the astdemo server (astdemo -s PATH): sends
+// requests over several connections at once, and reports throughput
+// and the distribution of request latencies.
+//
+// Each connection is driven by its own thread, which keeps a fixed
+// number of requests in flight (1 by default, so each request is sent
+// when the previous response arrives.)  A request's latency is the
+// time from sending it to receiving its response.
+//
+// Usage: loadgen [options] SOCKET_PATH
+//   -c N      number of connections (default 4)
+//   -n N      requests per connection (default 2000)
+//   -d SECS   run for this many seconds instead of a number of requests
+//   -q N      requests in flight per connection (default 1)
+//   -m MODE   p, b, or 2 (default 2)
+//   -f FMT    response format: t, j, s, u (not with -m p), or w
+//             (default t)
+//   -e FILE   send the expressions in FILE (one per line), rather
+//             than generated expressions
+//   -k N      number of generated expressions (default 1000)
+//   -s SEED   seed for generated expressions (default 1)
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unistd.h> // for getopt
+#include <vector>
+#include "exceptions.h"
+#include "outbuf.h"
+#include "workload.h"
+#include "server.h"
+#include "bench.h"
+
+namespace {
+
+struct LoadOptions {
+  std::string path;
+  unsigned conns;
+  unsigned requests;
+  double secs;
+  unsigned depth;
+  char mode, format;
+
+  LoadOptions()
+    : conns(4), requests(2000), secs(0.0), depth(1), mode('2'), format('t') { }
+};
+
+// Results from one connection
+struct ConnResult {
+  std::vector<double> latencies;
+  uint64_t errors;
+  uint64_t response_bytes;
+  std::string failure; // set if the connection failed
+
+  ConnResult() : errors(0), response_bytes(0) { }
+};
+
+void run_connection(const LoadOptions &opts, const std::vector<std::string> &exprs,
+                    unsigned index, ConnResult &result) {
+  try {
+    ASTClient client(opts.path);
+    std::deque<double> sent; // send times of requests in flight
+    std::string payload;
+    size_t next_expr = (size_t(index) * 7919) % exprs.size();
+    uint64_t num_sent = 0;
+    double deadline = opts.secs > 0.0 ? bench_now() + opts.secs : 0.0;
+
+    auto more = [&]() {
+      return deadline > 0.0 ? bench_now() < deadline : num_sent < opts.requests;
+    };
+
+    for (;;) {
+      while (sent.size() < opts.depth && more()) {
+        sent.push_back(bench_now());
+        client.send_request(opts.mode, opts.format, exprs[next_expr]);
+        next_expr = (next_expr + 1) % exprs.size();
+        num_sent++;
+      }
+      if (sent.empty()) {
+        break;
+      }
+      unsigned char status = client.receive_response(payload);
+      result.latencies.push_back(bench_now() - sent.front());
+      sent.pop_front();
+      result.response_bytes += payload.size();
+      if (status != SERVER_STATUS_OK) {
+        if (result.errors == 0) {
+          fprintf(stderr, "Request failed: %s\n", payload.c_str());
+        }
+        result.errors++;
+      }
+    }
+  } catch (BaseException &ex) {
+    result.failure = ex.what();
+  }
+}
+
+std::vector<std::string> read_exprs(const char *filename) {
+  std::ifstream in(filename);
+  if (!in) {
+    RuntimeError::raise("Could not open expression file '%s'", filename);
+  }
+  std::vector<std::string> exprs;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.find_first_not_of(" \t\r") != std::string::npos) {
+      exprs.push_back(line);
+    }
+  }
+  return exprs;
+}
+
+std::vector<std::string> gen_exprs(unsigned count, uint64_t seed) {
+  WorkloadGen gen(WorkloadShape(), seed);
+  std::vector<std::string> exprs;
+  for (unsigned i = 0; i < count; i++) {
+    std::string src;
+    StringSink sink(src);
+    OutputBuffer out(sink);
+    gen.generate(out);
+    out.flush();
+    exprs.push_back(src);
+  }
+  return exprs;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+  size_t rank = size_t(std::ceil(p / 100.0 * double(sorted.size())));
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+}
+
+int execute(int argc, char **argv) {
+  LoadOptions opts;
+  const char *expr_file = nullptr;
+  unsigned num_exprs = 1000;
+  uint64_t seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:n:d:q:m:f:e:k:s:")) != -1) {
+    switch (opt) {
+    case 'c':
+      opts.conns = unsigned(atol(optarg));
+      break;
+    case 'n':
+      opts.requests = unsigned(atol(optarg));
+      break;
+    case 'd':
+      opts.secs = atof(optarg);
+      break;
+    case 'q':
+      opts.depth = unsigned(atol(optarg));
+      break;
+    case 'm':
+      opts.mode = optarg[0];
+      break;
+    case 'f':
+      opts.format = optarg[0];
+      break;
+    case 'e':
+      expr_file = optarg;
+      break;
+    case 'k':
+      num_exprs = unsigned(atol(optarg));
+      break;
+    case 's':
+      seed = uint64_t(strtoull(optarg, nullptr, 10));
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+  if (optind >= argc) {
+    RuntimeError::raise("Usage: loadgen [options] SOCKET_PATH");
+  }
+  opts.path = argv[optind];
+  if (opts.conns < 1 || opts.depth < 1 || num_exprs < 1) {
+    RuntimeError::raise("Connections, requests in flight, and expressions must be at least 1");
+  }
+  check_server_request(opts.mode, opts.format);
+
+  std::vector<std::string> exprs = expr_file ? read_exprs(expr_file) : gen_exprs(num_exprs, seed);
+  if (exprs.empty()) {
+    RuntimeError::raise("No expressions to send");
+  }
+
+  std::vector<ConnResult> results(opts.conns);
+  std::vector<std::thread> threads;
+  double start = bench_now();
+  for (unsigned i = 0; i < opts.conns; i++) {
+    threads.emplace_back(run_connection, std::cref(opts), std::cref(exprs), i, std::ref(results[i]));
+  }
+  for (auto i = threads.begin(); i != threads.end(); ++i) {
+    i->join();
+  }
+  double elapsed = bench_now() - start;
+
+  std::vector<double> latencies;
+  uint64_t errors = 0, response_bytes = 0;
+  for (auto i = results.begin(); i != results.end(); ++i) {
+    if (!i->failure.empty()) {
+      RuntimeError::raise("Connection failed: %s", i->failure.c_str());
+    }
+    latencies.insert(latencies.end(), i->latencies.begin(), i->latencies.end());
+    errors += i->errors;
+    response_bytes += i->response_bytes;
+  }
+  if (latencies.empty()) {
+    RuntimeError::raise("No requests were completed");
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  printf("connections:      %u (%u in flight each)\n", opts.conns, opts.depth);
+  printf("requests:         %zu (%lu failed)\n", latencies.size(), (unsigned long) errors);
+  printf("elapsed:          %.3f s\n", elapsed);
+  printf("throughput:       %.0f requests/s, %.2f MB/s of responses\n",
+         double(latencies.size()) / elapsed, double(response_bytes) / 1e6 / elapsed);
+  printf("latency (us):     p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+         percentile(latencies, 50) * 1e6, percentile(latencies, 90) * 1e6,
+         percentile(latencies, 99) * 1e6, latencies.back() * 1e6);
+  return errors > 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -18,24 +18,43 @@
 // ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include "allocstats.h"
 #include "location.h"
 
+namespace {
+
+// Count a Location constructed or copied (see allocstats.h), and its
+// source file name's heap buffer, if it was allocated for this copy
+void count_location(const std::string &srcfile, bool allocated = true) {
+#ifdef ALLOC_STATS
+  alloc_stats_location_copied(allocated ? alloc_stats_string_bytes(srcfile) : 0);
+#else
+  (void) srcfile;
+  (void) allocated;
+#endif
+}
+
+}
+
 Location::Location()
   : m_srcfile("<unknown>")
   , m_line(-1)
   , m_col(-1) {
+  count_location(m_srcfile);
 }
 
 Location::Location(const std::string &srcfile, int line, int col)
   : m_srcfile(srcfile)
   , m_line(line)
   , m_col(col) {
+  count_location(m_srcfile);
 }
 
 Location::Location(const Location &other)
   : m_srcfile(other.m_srcfile)
   , m_line(other.m_line)
   , m_col(other.m_col) {
+  count_location(m_srcfile);
 }
 
 Location::~Location() {
@@ -43,7 +62,9 @@ Location::~Location() {
 
 Location &Location::operator=(const Location &rhs) {
   if (this != &rhs) {
+    size_t old_capacity = m_srcfile.capacity();
     m_srcfile = rhs.m_srcfile;
+    count_location(m_srcfile, m_srcfile.capacity() != old_capacity);
     m_line = rhs.m_line;
     m_col = rhs.m_col;
   }
@@ -1,6 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h> // for getopt
 #include <memory>
+#include <string>
+#include <vector>
 #include "lexer.h"
 #include "parser.h"
 #include "parser2.h"
@@ -8,22 +11,348 @@
 #include "buildast.h"
 #include "exceptions.h"
 #include "treeprint.h"
+#include "astfile.h"
+#include "outbuf.h"
+#include "treeemit.h"
+#include "unparse.h"
+#include "treeutil.h"
+#include "stats.h"
+#include "workpool.h"
+#include "trace.h"
+#include "server.h"
+#include "tokpipe.h"
+#include "parsplit.h"
+#include "parlex.h"
 
 enum {
   PRINT_TOKENS,
+  DUMP_TOKENS,
   PRINT_PARSE_TREE,
   BUILD_AST,
   PARSER2,
+  READ_AST_FILE,
 };
 
+// tree output formats
+enum {
+  TEXT_OUTPUT,
+  JSON_OUTPUT,
+  SEXP_OUTPUT,
+  SOURCE_OUTPUT,
+};
+
+// Print a tree in given format, or write it to a binary AST file
+// if an output file was specified
+void output_tree(Node *t, const TreePrint &tp, int format, const char *ast_outfile, OutputSink &sink) {
+  if (ast_outfile) {
+    write_ast_file(ast_outfile, { t });
+    return;
+  }
+
+  OutputBuffer out(sink);
+  if (format == JSON_OUTPUT) {
+    emit_json(t, tp, out);
+  } else if (format == SEXP_OUTPUT) {
+    emit_sexp(t, tp, out);
+  } else if (format == SOURCE_OUTPUT) {
+    unparse(t, out);
+    out.put('\n');
+  } else {
+    tp.print(t, out);
+  }
+  out.flush();
+}
+
+// Size of a token record written by dump_tokens_binary
+const size_t TOKEN_RECORD_SIZE = 21;
+
+// Append an unsigned value to a buffer in little-endian byte order
+void put_le(char *&p, uint64_t val, unsigned nbytes) {
+  for (unsigned i = 0; i < nbytes; i++) {
+    *p++ = char(val >> (8*i));
+  }
+}
+
+// Print a token as a "kind:lexeme" line
+void print_token(const LexToken &tok, const char *lexeme, OutputBuffer &out) {
+  out.write_int(tok.kind);
+  out.put(':');
+  out.write(lexeme, tok.length);
+  out.put('\n');
+}
+
+// Write a token as a packed binary record: kind (1 byte), offset
+// (8 bytes), length, line, and column (4 bytes each), all little-endian.
+void dump_token(const LexToken &tok, OutputBuffer &out) {
+  char rec[TOKEN_RECORD_SIZE], *p = rec;
+  put_le(p, uint64_t(tok.kind), 1);
+  put_le(p, tok.offset, 8);
+  put_le(p, tok.length, 4);
+  put_le(p, uint64_t(tok.line), 4);
+  put_le(p, uint64_t(tok.col), 4);
+  out.write(rec, TOKEN_RECORD_SIZE);
+}
+
+// Print all tokens as text, one "kind:lexeme" line per token,
+// returning the number of tokens
+uint64_t print_tokens(Lexer *lexer, OutputSink &sink) {
+  uint64_t count = 0;
+  OutputBuffer out(sink);
+  std::vector<LexToken> toks;
+  std::string lexemes;
+  while (lexer->lex_batch(toks, lexemes, 4096) > 0) {
+    count += toks.size();
+    const char *lexeme = lexemes.data();
+    for (auto i = toks.begin(); i != toks.end(); ++i) {
+      print_token(*i, lexeme, out);
+      lexeme += i->length;
+    }
+  }
+  out.flush();
+  return count;
+}
+
+// Write all tokens as packed binary records (see dump_token),
+// returning the number of tokens
+uint64_t dump_tokens_binary(Lexer *lexer, OutputSink &sink) {
+  uint64_t count = 0;
+  OutputBuffer out(sink);
+  std::vector<LexToken> toks;
+  std::string lexemes;
+  while (lexer->lex_batch(toks, lexemes, 4096) > 0) {
+    count += toks.size();
+    for (auto i = toks.begin(); i != toks.end(); ++i) {
+      dump_token(*i, out);
+    }
+  }
+  out.flush();
+  return count;
+}
+
+// Print every tree in a binary AST file
+void print_ast_file(const char *filename, int format, OutputSink &sink) {
+  MappedASTFile astfile(filename);
+  astfile.validate();
+  for (uint64_t i = 0; i < astfile.get_num_roots(); i++) {
+    std::unique_ptr<Node> t(astfile.get_root(i).materialize());
+    if (t->get_tag() >= AST_ADD) {
+      output_tree(t.get(), ASTTreePrint(), format, nullptr, sink);
+    } else {
+      output_tree(t.get(), ParserTreePrint(), format, nullptr, sink);
+    }
+  }
+}
+
+
+// What to do with each input
+struct RunConfig {
+  int mode;
+  int format;
+  const char *ast_outfile;
+  bool pipeline;   // lex on a separate thread while parsing
+  RunStats *stats; // null if statistics aren't being collected
+};
+
+// Process one input, writing its output to given sink.  Statistics
+// are added to the totals for previous inputs.
+void process_input(const RunConfig &cfg, FILE *in, const char *filename, OutputSink &sink) {
+  TRACE_SPAN_DETAIL("input", filename);
+  RunStats *stats = cfg.stats;
+  std::unique_ptr<Lexer> lexer(new Lexer(in, filename));
+
+  if (cfg.mode == PRINT_TOKENS || cfg.mode == DUMP_TOKENS) {
+    TRACE_SPAN_DETAIL("lex", filename);
+    PhaseTimer timer(stats, RunStats::PHASE_LEX);
+    uint64_t num_tokens;
+    if (cfg.mode == PRINT_TOKENS) {
+      num_tokens = print_tokens(lexer.get(), sink);
+    } else {
+      num_tokens = dump_tokens_binary(lexer.get(), sink);
+    }
+    if (stats) {
+      stats->tokens += num_tokens;
+      stats->bytes_read += lexer->get_offset();
+    }
+    return;
+  }
+
+  // the parser takes tokens from a lexer on another thread
+  if (cfg.pipeline) {
+    lexer.reset(new Lexer(new TokenPipeline(lexer.release()), filename));
+  }
+
+  // when collecting statistics or tracing, the whole input is lexed
+  // before parsing, so that lexing and parsing are timed separately
+  // (except that a trace of a pipelined run shows them overlapping)
+  if (stats || (trace_enabled() && !cfg.pipeline)) {
+    TRACE_SPAN_DETAIL("lex", filename);
+    PhaseTimer timer(stats, RunStats::PHASE_LEX);
+    size_t num_tokens = lexer->prelex();
+    if (stats) {
+      stats->tokens += num_tokens;
+      stats->bytes_read += lexer->get_offset();
+    }
+  }
+
+  // the parser takes ownership of the lexer
+  std::unique_ptr<Node> root, ast;
+  if (cfg.mode == PRINT_PARSE_TREE || cfg.mode == BUILD_AST) {
+    std::unique_ptr<Parser> parser(new Parser(lexer.release()));
+    {
+      TRACE_SPAN_DETAIL("parse", filename);
+      PhaseTimer timer(stats, RunStats::PHASE_PARSE);
+      root.reset(parser->parse());
+    }
+    if (cfg.mode == BUILD_AST) {
+      TRACE_SPAN_DETAIL("buildast", filename);
+      PhaseTimer timer(stats, RunStats::PHASE_BUILDAST);
+      ast.reset(buildast(root.get()));
+    }
+  } else {
+    std::unique_ptr<Parser2> parser2(new Parser2(lexer.release()));
+    TRACE_SPAN_DETAIL("parse", filename);
+    PhaseTimer timer(stats, RunStats::PHASE_PARSE);
+    ast.reset(parser2->parse());
+  }
+
+  if (stats) {
+    stats->parse_nodes += root ? count_nodes(root.get()) : 0;
+    stats->ast_nodes += ast ? count_nodes(ast.get()) : 0;
+    uint64_t depth = tree_depth(ast ? ast.get() : root.get());
+    if (depth > stats->max_depth) {
+      stats->max_depth = depth;
+    }
+  }
+
+  {
+    TRACE_SPAN_DETAIL("output", filename);
+    PhaseTimer timer(stats, RunStats::PHASE_OUTPUT);
+    if (ast) {
+      output_tree(ast.get(), ASTTreePrint(), cfg.format, cfg.ast_outfile, sink);
+    } else {
+      output_tree(root.get(), ParserTreePrint(), cfg.format, cfg.ast_outfile, sink);
+    }
+  }
+
+  TRACE_SPAN_DETAIL("destroy", filename);
+  PhaseTimer timer(stats, RunStats::PHASE_DESTROY);
+  ast.reset();
+  root.reset();
+}
+
+// Open and process an input file
+void process_file(const RunConfig &cfg, const char *filename, OutputSink &sink) {
+  FILE *in = fopen(filename, "r");
+  if (!in) {
+    RuntimeError::raise("Could not open input file '%s'", filename);
+  }
+  try {
+    process_input(cfg, in, filename, sink);
+  } catch (...) {
+    fclose(in);
+    throw;
+  }
+  fclose(in);
+}
+
+// Read all of an input into memory
+void read_input(FILE *in, const char *filename, std::string &src) {
+  TRACE_SPAN_DETAIL("read", filename);
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    src.append(buf, n);
+  }
+  if (ferror(in)) {
+    RuntimeError::raise("Error reading input file '%s'", filename);
+  }
+}
+
+// Process a single input in parallel: the input is split into
+// pieces that are lexed (see parlex.h), or parsed with Parser2
+// (see parsplit.h), concurrently
+void process_input_split(const RunConfig &cfg, FILE *in, const char *filename,
+                         unsigned num_threads, OutputSink &sink) {
+  TRACE_SPAN_DETAIL("input", filename);
+  std::string src;
+  read_input(in, filename, src);
+  WorkStealingPool pool(num_threads);
+
+  if (cfg.mode == PRINT_TOKENS || cfg.mode == DUMP_TOKENS) {
+    std::vector<LexToken> toks;
+    {
+      TRACE_SPAN_DETAIL("lex", filename);
+      lex_parallel(src.data(), src.size(), filename, pool, toks);
+    }
+    TRACE_SPAN_DETAIL("output", filename);
+    OutputBuffer out(sink);
+    for (auto i = toks.begin(); i != toks.end(); ++i) {
+      if (cfg.mode == PRINT_TOKENS) {
+        print_token(*i, src.data() + i->offset, out);
+      } else {
+        dump_token(*i, out);
+      }
+    }
+    out.flush();
+    return;
+  }
+
+  std::unique_ptr<Node> ast;
+  {
+    TRACE_SPAN_DETAIL("parse", filename);
+    ast.reset(parse2_split(src.data(), src.size(), filename, pool));
+  }
+
+  {
+    TRACE_SPAN_DETAIL("output", filename);
+    output_tree(ast.get(), ASTTreePrint(), cfg.format, cfg.ast_outfile, sink);
+  }
+
+  TRACE_SPAN_DETAIL("destroy", filename);
+  ast.reset();
+}
+
+// Process input files in parallel.  Each file's output is collected
+// in memory, and written to given sink in the order of the files
+// once they have all been processed.
+void process_files_parallel(const RunConfig &cfg, const std::vector<const char *> &filenames,
+                            unsigned num_threads, OutputSink &sink) {
+  std::vector<std::string> outputs(filenames.size());
+  {
+    WorkStealingPool pool(num_threads);
+    for (size_t i = 0; i < filenames.size(); i++) {
+      const char *filename = filenames[i];
+      std::string *output = &outputs[i];
+      pool.submit([&cfg, filename, output]() {
+        StringSink out(*output);
+        process_file(cfg, filename, out);
+      });
+    }
+    pool.wait();
+  }
+
+  TRACE_SPAN("write outputs");
+  for (auto i = outputs.begin(); i != outputs.end(); ++i) {
+    sink.write(i->data(), i->size());
+  }
+}
 
 int execute(int argc, char **argv) {
   int mode = PRINT_PARSE_TREE, opt;
-  while ((opt = getopt(argc, argv, "lpb2")) != -1) {
+  int format = TEXT_OUTPUT;
+  const char *ast_outfile = nullptr;
+  bool print_stats = false, json_stats = false, perf_counters = false;
+  bool pipeline = false;
+  unsigned num_jobs = 1;
+  const char *socket_path = nullptr;
+  while ((opt = getopt(argc, argv, "lLpb2rw:JSutTPj:X:s:q")) != -1) {
     switch (opt) {
     case 'l':
       mode = PRINT_TOKENS;
       break;
+    case 'L':
+      mode = DUMP_TOKENS;
+      break;
     case 'p':
       mode = PRINT_PARSE_TREE;
       break;
@@ -33,66 +362,139 @@ int execute(int argc, char **argv) {
     case '2':
       mode = PARSER2;
       break;
+    case 'r':
+      mode = READ_AST_FILE;
+      break;
+    case 'w':
+      ast_outfile = optarg;
+      break;
+    case 'J':
+      format = JSON_OUTPUT;
+      break;
+    case 'S':
+      format = SEXP_OUTPUT;
+      break;
+    case 'u':
+      format = SOURCE_OUTPUT;
+      break;
+    case 't':
+      print_stats = true;
+      break;
+    case 'T':
+      json_stats = true;
+      break;
+    case 'P':
+      perf_counters = true;
+      break;
+    case 'j':
+      num_jobs = unsigned(atoi(optarg));
+      if (num_jobs < 1) {
+        RuntimeError::raise("Invalid number of jobs: %s", optarg);
+      }
+      break;
+    case 'X':
+      trace_start(optarg);
+      trace_set_thread_name("main");
+      break;
+    case 's':
+      socket_path = optarg;
+      break;
+    case 'q':
+      pipeline = true;
+      break;
     default:
       RuntimeError::raise("Unknown option: %c", opt);
     }
   }
 
-  FILE *in;
-  const char *filename;
+  if (socket_path) {
+    ASTServer server(socket_path);
+    fprintf(stderr, "Listening on %s\n", socket_path);
+    server.run();
+    fprintf(stderr, "Served %lu requests\n", (unsigned long) server.get_num_requests());
+    return 0;
+  }
+
+  FdSink stdout_sink(STDOUT_FILENO);
 
-  if (optind < argc) {
-    // read input from file
-    filename = argv[optind];
-    in = fopen(filename, "r");
-    if (!in) {
-      RuntimeError::raise("Could not open input file '%s'", filename);
+  if (mode == READ_AST_FILE) {
+    if (optind >= argc) {
+      RuntimeError::raise("An AST file is required with -r");
     }
-  } else {
-    filename = "<stdin>";
-    in = stdin;
+    print_ast_file(argv[optind], format, stdout_sink);
+    return 0;
   }
 
-  Lexer *lexer = new Lexer(in, filename);
+  std::vector<const char *> filenames(argv + optind, argv + argc);
+  if (ast_outfile && filenames.size() > 1) {
+    RuntimeError::raise("Only one input file can be used with -w");
+  }
+  bool parallel = num_jobs > 1 && filenames.size() > 1;
+  bool split = num_jobs > 1 && filenames.size() <= 1
+    && (mode == PARSER2 || mode == PRINT_TOKENS || mode == DUMP_TOKENS);
 
-  if (mode == PRINT_TOKENS) {
-    bool done = false;
-    while (!done) {
-      Node *tok = lexer->next();
-      if (!tok) {
-        done = true;
-      } else {
-        int kind = tok->get_tag();
-        std::string lexeme = tok->get_str();
-        printf("%d:%s\n", kind, lexeme.c_str());
-        delete tok;
-      }
+  // statistics are only collected if requested
+  std::unique_ptr<RunStats> stats_holder;
+  if (perf_counters && !json_stats) {
+    print_stats = true;
+  }
+  if (print_stats || json_stats) {
+    if (parallel || split) {
+      RuntimeError::raise("Statistics can't be collected with -j");
+    }
+    stats_holder.reset(new RunStats());
+    if (perf_counters) {
+      stats_holder->enable_perf_counters();
     }
-  } else if (mode == PRINT_PARSE_TREE || mode == BUILD_AST) {
-    std::unique_ptr<Parser> parser(new Parser(lexer));
-    std::unique_ptr<Node> root(parser->parse());
+  }
+
+  RunConfig cfg;
+  cfg.mode = mode;
+  cfg.format = format;
+  cfg.ast_outfile = ast_outfile;
+  cfg.pipeline = pipeline;
+  cfg.stats = stats_holder.get();
 
-    if (mode == PRINT_PARSE_TREE) {
-      ParserTreePrint tp;
-      tp.print(root.get());
+  if (split) {
+    if (filenames.empty()) {
+      process_input_split(cfg, stdin, "<stdin>", num_jobs, stdout_sink);
     } else {
-      std::unique_ptr<Node> ast(buildast(root.get()));
-      ASTTreePrint tp;
-      tp.print(ast.get());
+      FILE *in = fopen(filenames[0], "r");
+      if (!in) {
+        RuntimeError::raise("Could not open input file '%s'", filenames[0]);
+      }
+      try {
+        process_input_split(cfg, in, filenames[0], num_jobs, stdout_sink);
+      } catch (...) {
+        fclose(in);
+        throw;
+      }
+      fclose(in);
     }
+  } else if (filenames.empty()) {
+    process_input(cfg, stdin, "<stdin>", stdout_sink);
+  } else if (parallel) {
+    process_files_parallel(cfg, filenames, num_jobs, stdout_sink);
   } else {
-    std::unique_ptr<Parser2> parser2(new Parser2(lexer));
-    std::unique_ptr<Node> ast(parser2->parse());
-    ASTTreePrint tp;
-    tp.print(ast.get());
+    for (auto i = filenames.begin(); i != filenames.end(); ++i) {
+      process_file(cfg, *i, stdout_sink);
+    }
+  }
+
+  if (print_stats) {
+    cfg.stats->print(stderr);
+  }
+  if (json_stats) {
+    cfg.stats->write_json(stderr);
   }
 
   return 0;
 }
 
 int main(int argc, char **argv) {
+  int result;
   try {
-    return execute(argc, argv);
+    result = execute(argc, argv);
   } catch (BaseException &ex) {
     if (ex.has_location()) {
       const Location &loc = ex.get_loc();
@@ -100,6 +502,15 @@ int main(int argc, char **argv) {
     } else {
       fprintf(stderr, "Error: %s\n", ex.what());
     }
-    return 1;
+    result = 1;
+  }
+
+  // the trace (if any) is written even if the run failed
+  try {
+    trace_finish();
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    result = 1;
   }
+  return result;
 }
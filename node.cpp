@@ -26,6 +26,8 @@ Node::Node(int tag, const std::string &str, const std::vector<Node *> &kids)
   , m_kids(kids)
   , m_str(str)
   , m_loc_was_set_explicitly(false) {
+  alloc_created(m_tag);
+  note_storage();
 }
 
 // Private constructor, used only by other constructors
@@ -34,6 +36,8 @@ Node::Node(int tag, const std::string &str, const std::initializer_list<Node *>
   , m_kids(kids)
   , m_str(str)
   , m_loc_was_set_explicitly(false) {
+  alloc_created(m_tag);
+  note_storage();
 }
 
 Node::Node(int tag)
@@ -45,6 +49,7 @@ Node::Node(int tag, std::initializer_list<Node *> kids)
   // parent node's location defaults to first kid's location
   if (!m_kids.empty()) {
     m_loc = m_kids[0]->get_loc();
+    note_storage();
   }
 }
 
@@ -53,6 +58,7 @@ Node::Node(int tag, const std::vector<Node *> &kids)
   // parent node's location defaults to first kid's location
   if (!m_kids.empty()) {
     m_loc = m_kids[0]->get_loc();
+    note_storage();
   }
 }
 
@@ -61,9 +67,19 @@ Node::Node(int tag, const std::string &str)
 }
 
 Node::~Node() {
-  // delete child nodes
-  for (auto i = m_kids.begin(); i != m_kids.end(); ++i) {
-    delete *i;
+  alloc_destroyed(m_tag);
+
+  // Delete descendants iteratively, so that deleting a very deep tree
+  // can't overflow the stack: each node's kids are detached before
+  // the node is deleted, so its own destructor has nothing to do.
+  std::vector<Node *> work;
+  work.swap(m_kids);
+  while (!work.empty()) {
+    Node *n = work.back();
+    work.pop_back();
+    work.insert(work.end(), n->m_kids.begin(), n->m_kids.end());
+    n->m_kids.clear();
+    delete n;
   }
 }
 
@@ -73,6 +89,7 @@ void Node::append_kid(Node *kid) {
   if (!m_loc.is_valid()) {
     m_loc = kid->get_loc();
   }
+  note_storage();
 }
 
 void Node::prepend_kid(Node *kid) {
@@ -85,4 +102,18 @@ void Node::prepend_kid(Node *kid) {
   if (kid->get_loc().is_valid() && !m_loc_was_set_explicitly) {
     m_loc = kid->get_loc();
   }
+  note_storage();
+}
+
+Node *Node::replace_kid(unsigned index, Node *kid) {
+  Node *old_kid = m_kids.at(index);
+  m_kids[index] = kid;
+
+  // as in prepend_kid, a new first kid determines the location
+  // (unless it was set explicitly)
+  if (index == 0 && kid->get_loc().is_valid() && !m_loc_was_set_explicitly) {
+    m_loc = kid->get_loc();
+    note_storage();
+  }
+  return old_kid;
 }
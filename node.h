@@ -47,6 +47,9 @@ private:
   Node(int tag, const std::string &str, const std::vector<Node *> &kids);
   Node(int tag, const std::string &str, const std::initializer_list<Node *> kids);
 
+  // count the allocations of a change to the kids, string or location
+  void note_storage() { alloc_storage(m_tag, m_kids.capacity(), m_str, m_loc.get_srcfile()); }
+
 public:
   typedef std::vector<Node *>::const_iterator const_iterator;
 
@@ -58,10 +61,10 @@ public:
   virtual ~Node();
 
   int get_tag() const { return m_tag; }
-  void set_tag(int tag) { m_tag = tag; }
+  void set_tag(int tag) { alloc_retagged(m_tag, tag); m_tag = tag; }
 
-  std::string get_str() const { return m_str; }
-  void set_str(const std::string &str) { m_str = str; }
+  const std::string &get_str() const { return m_str; }
+  void set_str(const std::string &str) { m_str = str; note_storage(); }
 
   void append_kid(Node *kid);
   void prepend_kid(Node *kid);
@@ -69,12 +72,25 @@ public:
   Node *get_kid(unsigned index) const { return m_kids.at(index); }
   Node *get_last_kid() const { return m_kids.back(); }
 
+  // Replace the kid at given index, returning the kid it replaces
+  // (which the caller becomes responsible for deleting)
+  Node *replace_kid(unsigned index, Node *kid);
+
   const_iterator cbegin() const { return m_kids.cbegin(); }
   const_iterator cend() const { return m_kids.cend(); }
 
-  void set_loc(const Location &loc) { m_loc = loc; m_loc_was_set_explicitly = true; }
+  void set_loc(const Location &loc) { set_loc(loc, true); }
   const Location &get_loc() const { return m_loc; }
 
+  // Whether the location was set explicitly (rather than taken from
+  // a kid), and setting it as either, for rebuilding a copy of a tree
+  bool is_loc_explicit() const { return m_loc_was_set_explicitly; }
+  void set_loc(const Location &loc, bool is_explicit) {
+    m_loc = loc;
+    m_loc_was_set_explicitly = is_explicit;
+    note_storage();
+  }
+
   // do a preorder traversal of the tree, invoking specified
   // function on each node
   template<typename Fn>
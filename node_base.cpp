@@ -18,10 +18,60 @@
 // ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include "allocstats.h"
 #include "node_base.h"
 
-NodeBase::NodeBase() {
+NodeBase::NodeBase()
+  : m_ival(0)
+  , m_has_ival(false)
+  , m_slot(-1)
+#ifdef ALLOC_STATS
+  , m_kids_capacity(0)
+  , m_str_capacity(std::string().capacity())
+  , m_srcfile_capacity(std::string().capacity())
+#endif
+{
 }
 
 NodeBase::~NodeBase() {
 }
+
+#ifdef ALLOC_STATS
+void NodeBase::alloc_created(int tag) {
+  alloc_stats_node_created(tag);
+}
+
+void NodeBase::alloc_destroyed(int tag) {
+  alloc_stats_node_destroyed(tag);
+}
+
+void NodeBase::alloc_retagged(int old_tag, int new_tag) {
+  alloc_stats_node_retagged(old_tag, new_tag);
+}
+
+void NodeBase::alloc_storage(int tag, size_t kids_capacity, const std::string &str,
+                             const std::string &srcfile) {
+  // a changed capacity means a new heap allocation (unless
+  // the new buffer is empty, or stored inline)
+  if (kids_capacity != m_kids_capacity) {
+    m_kids_capacity = kids_capacity;
+    if (kids_capacity > 0) {
+      alloc_stats_kid_bytes(tag, kids_capacity * sizeof(void *));
+    }
+  }
+  if (str.capacity() != m_str_capacity) {
+    m_str_capacity = str.capacity();
+    size_t bytes = alloc_stats_string_bytes(str);
+    if (bytes > 0) {
+      alloc_stats_str_bytes(tag, bytes);
+    }
+  }
+  if (srcfile.capacity() != m_srcfile_capacity) {
+    m_srcfile_capacity = srcfile.capacity();
+    size_t bytes = alloc_stats_string_bytes(srcfile);
+    if (bytes > 0) {
+      alloc_stats_node_loc_bytes(tag, bytes);
+    }
+  }
+}
+#endif
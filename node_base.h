@@ -21,21 +21,68 @@
 #ifndef NODE_BASE_H
 #define NODE_BASE_H
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
 // The Node class will inherit from this type, so you can use it
 // to define any attributes and methods that Node objects should have
 // (constant value, results of semantic analysis, code generation info,
 // etc.)
 class NodeBase {
 private:
-  // fields could go here
+  // value of an integer literal, decoded once by the lexer
+  int64_t m_ival;
+  bool m_has_ival;
+
+  // variable slot index assigned by bind_varrefs (see symtab.h),
+  // -1 if the node has not been bound
+  int m_slot;
+
+#ifdef ALLOC_STATS
+  // capacities of the node's kid vector, string and location's source
+  // file name, when its allocations were last counted
+  size_t m_kids_capacity, m_str_capacity, m_srcfile_capacity;
+#endif
 
   // copy ctor and assignment operator not supported
   NodeBase(const NodeBase &);
   NodeBase &operator=(const NodeBase &);
 
 public:
+#ifdef ALLOC_STATS
+  // size of the members above that are only used for the accounting
+  static const size_t ALLOC_STATS_BYTES = 3 * sizeof(size_t);
+#endif
+
   NodeBase();
   virtual ~NodeBase();  
+
+  bool has_ival() const { return m_has_ival; }
+  int64_t get_ival() const { return m_ival; }
+  void set_ival(int64_t ival) { m_ival = ival; m_has_ival = true; }
+
+  int get_slot() const { return m_slot; }
+  void set_slot(int slot) { m_slot = slot; }
+
+protected:
+  // Allocation accounting hooks (see allocstats.h), which do nothing
+  // unless ALLOC_STATS is defined.  Node calls alloc_created and
+  // alloc_destroyed from its constructors and destructor,
+  // alloc_retagged when its tag changes, and alloc_storage after
+  // changing its kids, string or location, which counts any heap
+  // allocations the change made.
+#ifdef ALLOC_STATS
+  void alloc_created(int tag);
+  void alloc_destroyed(int tag);
+  void alloc_retagged(int old_tag, int new_tag);
+  void alloc_storage(int tag, size_t kids_capacity, const std::string &str, const std::string &srcfile);
+#else
+  void alloc_created(int) { }
+  void alloc_destroyed(int) { }
+  void alloc_retagged(int, int) { }
+  void alloc_storage(int, size_t, const std::string &, const std::string &) { }
+#endif
 };
 
 #endif // NODE_BASE_H
@@ -0,0 +1,127 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include "exceptions.h"
+#include "outbuf.h"
+
+////////////////////////////////////////////////////////////////////////
+// OutputSink implementations
+////////////////////////////////////////////////////////////////////////
+
+OutputSink::OutputSink() {
+}
+
+OutputSink::~OutputSink() {
+}
+
+FileSink::FileSink(FILE *out)
+  : m_out(out) {
+}
+
+FileSink::~FileSink() {
+}
+
+void FileSink::write(const char *data, size_t len) {
+  if (fwrite(data, 1, len, m_out) != len) {
+    RuntimeError::raise("Error writing output: %s", strerror(errno));
+  }
+}
+
+FdSink::FdSink(int fd)
+  : m_fd(fd) {
+}
+
+FdSink::~FdSink() {
+}
+
+void FdSink::write(const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = ::write(m_fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      RuntimeError::raise("Error writing output: %s", strerror(errno));
+    }
+    data += n;
+    len -= size_t(n);
+  }
+}
+
+StringSink::StringSink(std::string &str)
+  : m_str(str) {
+}
+
+StringSink::~StringSink() {
+}
+
+void StringSink::write(const char *data, size_t len) {
+  m_str.append(data, len);
+}
+
+////////////////////////////////////////////////////////////////////////
+// OutputBuffer implementation
+////////////////////////////////////////////////////////////////////////
+
+OutputBuffer::OutputBuffer(OutputSink &sink, size_t capacity)
+  : m_sink(sink)
+  , m_buf(capacity > 0 ? capacity : 1)
+  , m_len(0) {
+}
+
+OutputBuffer::~OutputBuffer() {
+  try {
+    flush();
+  } catch (...) {
+    // destructors must not throw
+  }
+}
+
+void OutputBuffer::write_int(int64_t val) {
+  if (val < 0) {
+    put('-');
+    write_uint(0 - uint64_t(val));
+  } else {
+    write_uint(uint64_t(val));
+  }
+}
+
+void OutputBuffer::write_uint(uint64_t val) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = char('0' + val % 10);
+    val /= 10;
+  } while (val != 0);
+
+  while (n > 0) {
+    put(digits[--n]);
+  }
+}
+
+void OutputBuffer::flush() {
+  if (m_len > 0) {
+    size_t len = m_len;
+    m_len = 0;
+    m_sink.write(m_buf.data(), len);
+  }
+}
+
+void OutputBuffer::write_large(const char *data, size_t len) {
+  // fill the rest of the buffer, and if what remains
+  // won't fit, write it directly to the sink
+  size_t avail = m_buf.size() - m_len;
+  std::copy(data, data + avail, m_buf.data() + m_len);
+  m_len += avail;
+  flush();
+  data += avail;
+  len -= avail;
+
+  if (len >= m_buf.size()) {
+    m_sink.write(data, len);
+  } else {
+    std::copy(data, data + len, m_buf.data());
+    m_len = len;
+  }
+}
@@ -0,0 +1,106 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Destination for bytes written through an OutputBuffer
+class OutputSink {
+public:
+  OutputSink();
+  virtual ~OutputSink();
+
+  // Write all of given data, throwing RuntimeError on failure
+  virtual void write(const char *data, size_t len) = 0;
+};
+
+// Sink writing to a stdio stream (which is not closed by the sink)
+class FileSink : public OutputSink {
+private:
+  FILE *m_out;
+
+public:
+  FileSink(FILE *out);
+  virtual ~FileSink();
+
+  virtual void write(const char *data, size_t len);
+};
+
+// Sink writing to a file descriptor (which is not closed by the sink)
+class FdSink : public OutputSink {
+private:
+  int m_fd;
+
+public:
+  FdSink(int fd);
+  virtual ~FdSink();
+
+  virtual void write(const char *data, size_t len);
+};
+
+// Sink appending to a string
+class StringSink : public OutputSink {
+private:
+  std::string &m_str;
+
+public:
+  StringSink(std::string &str);
+  virtual ~StringSink();
+
+  virtual void write(const char *data, size_t len);
+};
+
+// Large output buffer in front of an OutputSink, so that output
+// produced in small pieces reaches the sink in large writes.
+// Call flush() when done: the destructor also flushes, but
+// ignores errors.
+class OutputBuffer {
+private:
+  OutputSink &m_sink;
+  std::vector<char> m_buf;
+  size_t m_len;
+
+  // no value semantics
+  OutputBuffer(const OutputBuffer &);
+  OutputBuffer &operator=(const OutputBuffer &);
+
+public:
+  OutputBuffer(OutputSink &sink, size_t capacity = 65536);
+  ~OutputBuffer();
+
+  void put(char c) {
+    if (m_len == m_buf.size()) {
+      flush();
+    }
+    m_buf[m_len++] = c;
+  }
+
+  void write(const char *data, size_t len) {
+    if (len <= m_buf.size() - m_len) {
+      std::copy(data, data + len, m_buf.data() + m_len);
+      m_len += len;
+    } else {
+      write_large(data, len);
+    }
+  }
+
+  void write(const std::string &s) { write(s.data(), s.size()); }
+
+  // Write a decimal integer
+  void write_int(int64_t val);
+  void write_uint(uint64_t val);
+
+  void flush();
+
+  // Drop the buffered output instead of writing it
+  void discard() { m_len = 0; }
+
+private:
+  void write_large(const char *data, size_t len);
+};
+
+#endif // OUTBUF_H
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "token.h"
+#include "exceptions.h"
+#include "trace.h"
+#include "parlex.h"
+
+namespace {
+
+const size_t NONE = SIZE_MAX;
+
+struct LexChunk {
+  size_t begin, end;
+  std::vector<LexToken> toks;  // positions not yet filled in
+  size_t error;                // offset of an invalid character, or NONE
+  uint64_t newlines;
+  size_t last_newline;         // offset of the chunk's last newline, or NONE
+
+  // set from the counts of the preceding chunks
+  uint64_t start_line;
+  size_t prev_newline;         // offset of the last newline before the chunk, or NONE
+  size_t first_tok;            // index of the chunk's first token in the output
+};
+
+// Count the newlines in n bytes at p, setting last to the index
+// of the last one (leaving it unchanged if there are none)
+uint64_t count_newlines(const char *p, size_t n, size_t &last) {
+  uint64_t count = 0;
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; i + 16 <= n; i += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    unsigned mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+    if (mask != 0) {
+      count += unsigned(__builtin_popcount(mask));
+      last = i + 31 - unsigned(__builtin_clz(mask));
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    if (p[i] == '\n') {
+      count++;
+      last = i;
+    }
+  }
+  return count;
+}
+
+// Kind of a single-character token, or -1 if c can't start a token
+// (other than identifiers and integer literals)
+int punct_kind(int c) {
+  switch (c) {
+  case '+': return TOK_PLUS;
+  case '-': return TOK_MINUS;
+  case '*': return TOK_TIMES;
+  case '/': return TOK_DIVIDE;
+  case '(': return TOK_LPAREN;
+  case ')': return TOK_RPAREN;
+  case ';': return TOK_SEMICOLON;
+  case '=': return TOK_ASSIGN;
+  default: return -1;
+  }
+}
+
+// Scan a chunk's tokens, recording their kinds, offsets, and lengths
+// (the same tokens Lexer::scan finds), and count its newlines
+void lex_chunk(const char *buf, LexChunk &chunk) {
+  TRACE_SPAN("lex chunk");
+  chunk.error = NONE;
+  size_t i = chunk.begin, end = chunk.end;
+  while (i < end) {
+    int c = static_cast<unsigned char>(buf[i]);
+    if (isspace(c)) {
+      i++;
+      continue;
+    }
+
+    LexToken tok;
+    tok.offset = i;
+    tok.line = tok.col = 0;
+    size_t start = i++;
+    if (isalpha(c)) {
+      tok.kind = TOK_IDENTIFIER;
+      while (i < end && isalnum(static_cast<unsigned char>(buf[i]))) {
+        i++;
+      }
+    } else if (isdigit(c)) {
+      tok.kind = TOK_INTEGER_LITERAL;
+      while (i < end && isdigit(static_cast<unsigned char>(buf[i]))) {
+        i++;
+      }
+    } else {
+      tok.kind = punct_kind(c);
+      if (tok.kind < 0) {
+        chunk.error = start;
+        break;
+      }
+    }
+    tok.length = uint32_t(i - start);
+    chunk.toks.push_back(tok);
+  }
+
+  chunk.last_newline = NONE;
+  size_t last = NONE;
+  chunk.newlines = count_newlines(buf + chunk.begin, chunk.end - chunk.begin, last);
+  if (last != NONE) {
+    chunk.last_newline = chunk.begin + last;
+  }
+}
+
+// Give a chunk's tokens their lines and columns, storing them at
+// their place in the output
+void place_chunk(const char *buf, LexChunk &chunk, LexToken *out) {
+  uint64_t line = chunk.start_line;
+  size_t last_newline = chunk.prev_newline;
+  size_t pos = chunk.begin;
+  for (auto i = chunk.toks.begin(); i != chunk.toks.end(); ++i) {
+    // only the whitespace between tokens can contain newlines
+    size_t last = NONE;
+    line += count_newlines(buf + pos, i->offset - pos, last);
+    if (last != NONE) {
+      last_newline = pos + last;
+    }
+    LexToken &tok = *out++;
+    tok = *i;
+    tok.line = int(line);
+    tok.col = int(last_newline == NONE ? tok.offset + 1 : tok.offset - last_newline);
+    pos = i->offset + i->length;
+  }
+  std::vector<LexToken>().swap(chunk.toks);
+}
+
+}
+
+void lex_parallel(const char *buf, size_t len, const std::string &filename,
+                  WorkStealingPool &pool, std::vector<LexToken> &toks,
+                  size_t min_chunk) {
+  toks.clear();
+  size_t num_chunks = std::min(len / std::max(min_chunk, size_t(1)), size_t(pool.get_num_threads()) * 4);
+  num_chunks = std::max(num_chunks, size_t(1));
+
+  // each chunk after the first starts at the first whitespace
+  // character after its nominal start (chunks without one are
+  // merged into the previous chunk)
+  std::vector<LexChunk> chunks;
+  chunks.push_back(LexChunk());
+  chunks.back().begin = 0;
+  for (size_t i = 1; i < num_chunks; i++) {
+    size_t nominal = len * i / num_chunks, limit = len * (i + 1) / num_chunks;
+    for (size_t p = std::max(nominal, chunks.back().begin + 1); p < limit; p++) {
+      if (isspace(static_cast<unsigned char>(buf[p]))) {
+        chunks.back().end = p;
+        chunks.push_back(LexChunk());
+        chunks.back().begin = p;
+        break;
+      }
+    }
+  }
+  chunks.back().end = len;
+
+  for (auto i = chunks.begin(); i != chunks.end(); ++i) {
+    LexChunk *chunk = &*i;
+    pool.submit([buf, chunk]() { lex_chunk(buf, *chunk); });
+  }
+  pool.wait();
+
+  // prefix sums of newlines and token counts
+  uint64_t line = 1;
+  size_t last_newline = NONE, num_toks = 0;
+  for (auto i = chunks.begin(); i != chunks.end(); ++i) {
+    i->start_line = line;
+    i->prev_newline = last_newline;
+    i->first_tok = num_toks;
+    if (i->error != NONE) {
+      // report the error as Lexer does: at the position
+      // following the invalid character
+      size_t last = NONE;
+      uint64_t err_line = line + count_newlines(buf + i->begin, i->error - i->begin, last);
+      size_t err_newline = last != NONE ? i->begin + last : last_newline;
+      int col = int(err_newline == NONE ? i->error + 2 : i->error - err_newline + 1);
+      SyntaxError::raise(Location(filename, int(err_line), col),
+                         "Unrecognized character '%c'", buf[i->error]);
+    }
+    line += i->newlines;
+    if (i->last_newline != NONE) {
+      last_newline = i->last_newline;
+    }
+    num_toks += i->toks.size();
+  }
+
+  toks.resize(num_toks);
+  LexToken *out = toks.data();
+  for (auto i = chunks.begin(); i != chunks.end(); ++i) {
+    LexChunk *chunk = &*i;
+    pool.submit([buf, chunk, out]() { place_chunk(buf, *chunk, out + chunk->first_tok); });
+  }
+  pool.wait();
+}
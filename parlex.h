@@ -0,0 +1,30 @@
+#ifndef PARLEX_H
+#define PARLEX_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "lexer.h"
+#include "workpool.h"
+
+// Lex an in-memory input in parallel, storing all of its tokens in
+// toks, with the same kinds, offsets, lengths, lines and columns as
+// Lexer::lex_batch would produce.
+//
+// The input is split into chunks of at least min_chunk bytes, each
+// starting at a whitespace character (tokens never contain whitespace,
+// so no token spans two chunks), and the chunks are lexed concurrently.
+// The chunk lexers don't track lines and columns: instead, the newlines
+// in each chunk are counted (with SSE2 where available), the counts are
+// summed to find the line at the start of each chunk, and then each
+// chunk's tokens are given their lines and columns (by counting the
+// newlines in the whitespace between tokens) as they are copied into
+// place in toks.
+//
+// Throws SyntaxError for the first invalid character in the input,
+// with the same location and message as Lexer.
+void lex_parallel(const char *buf, size_t len, const std::string &filename,
+                  WorkStealingPool &pool, std::vector<LexToken> &toks,
+                  size_t min_chunk = 1 << 20);
+
+#endif // PARLEX_H
@@ -37,6 +37,10 @@ std::string ParserTreePrint::node_tag_to_string(int tag) const {
     return "LPAREN";
   case TOK_RPAREN:
     return "RPAREN";
+  case TOK_ASSIGN:
+    return "ASSIGN";
+  case TOK_SEMICOLON:
+    return "SEMICOLON";
 
   // nonterminal symbols:
   case NODE_E:
@@ -80,6 +84,10 @@ Parser::~Parser() {
   delete m_lexer;
 }
 
+void Parser::reset(const char *buf, size_t len, const std::string &filename) {
+  m_lexer->reset(buf, len, filename);
+}
+
 Node *Parser::parse() {
   // E is the start symbol
   return parse_E();
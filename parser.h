@@ -34,6 +34,12 @@ public:
   Parser(Lexer *lexer_to_adopt);
   ~Parser();
 
+  // Reset the lexer to parse a new input from an in-memory buffer
+  // (see Lexer::reset), so that the parser and lexer can be reused
+  void reset(const char *buf, size_t len, const std::string &filename);
+
+  Lexer *get_lexer() const { return m_lexer; }
+
   Node *parse();
 
 private:
@@ -32,23 +32,63 @@ Parser2::~Parser2() {
   delete m_lexer;
 }
 
+void Parser2::reset(const char *buf, size_t len, const std::string &filename) {
+  m_lexer->reset(buf, len, filename);
+}
+
 Node *Parser2::parse() {
   // E is the start symbol
   return parse_E();
 }
 
+Node *Parser2::parse_rest(Node *lhs) {
+  // the rest of E, starting at E'
+  return parse_EPrime(lhs);
+}
+
+bool Parser2::at_end() {
+  return !m_lexer->peek();
+}
+
+Node *Parser2::parse_script() {
+  // Script -> ^ S*
+  std::unique_ptr<Node> script(new Node(AST_STATEMENT_LIST));
+
+  // parse statements until the input is exhausted (iteratively,
+  // since scripts can be long)
+  while (m_lexer->peek()) {
+    script->append_kid(parse_S());
+  }
+
+  return script.release();
+}
+
+Node *Parser2::parse_S() {
+  // S -> ^ i = E ;
+
+  std::unique_ptr<Node> target(expect(TOK_IDENTIFIER));
+  target->set_tag(AST_VARREF);
+  expect_and_discard(TOK_ASSIGN);
+  std::unique_ptr<Node> ast(parse_E());
+  expect_and_discard(TOK_SEMICOLON);
+
+  return new Node(AST_ASSIGN, {target.release(), ast.release()});
+}
+
 Node *Parser2::parse_E() {
   // E -> ^ T E'
 
   // Get the AST corresponding to the term (T)
   Node *ast = parse_T();
 
-  // Recursively continue the additive expression
-  return parse_EPrime(ast);  
+  // Continue the additive expression
+  return parse_EPrime(ast);
 }
 
 // This function is passed the "current" portion of the AST
 // that has been built so far for the additive expression.
+// The E' productions are applied iteratively (each one wrapping the
+// AST built so far), so that long chains can't overflow the stack.
 Node *Parser2::parse_EPrime(Node *ast_) {
   // E' -> ^ + T E'
   // E' -> ^ - T E'
@@ -56,25 +96,27 @@ Node *Parser2::parse_EPrime(Node *ast_) {
 
   std::unique_ptr<Node> ast(ast_);
 
-  // peek at next token
-  Node *next_tok = m_lexer->peek();
-  if (next_tok) {
+  for (;;) {
+    // peek at next token
+    Node *next_tok = m_lexer->peek();
+    if (!next_tok) {
+      break;
+    }
     int next_tok_tag = next_tok->get_tag();
-    if (next_tok_tag == TOK_PLUS || next_tok_tag == TOK_MINUS)  {
-      // E' -> ^ + T E'
-      // E' -> ^ - T E'
-      std::unique_ptr<Node> op(expect(static_cast<enum TokenKind>(next_tok_tag)));
+    if (next_tok_tag != TOK_PLUS && next_tok_tag != TOK_MINUS) {
+      break;
+    }
 
-      // build AST for next term, incorporate into current AST
-      Node *term_ast = parse_T();
-      ast.reset(new Node(next_tok_tag == TOK_PLUS ? AST_ADD : AST_SUB, {ast.release(), term_ast}));
+    // E' -> ^ + T E'
+    // E' -> ^ - T E'
+    std::unique_ptr<Node> op(expect(static_cast<enum TokenKind>(next_tok_tag)));
 
-      // copy source information from operator node
-      ast->set_loc(op->get_loc());
+    // build AST for next term, incorporate into current AST
+    Node *term_ast = parse_T();
+    ast.reset(new Node(next_tok_tag == TOK_PLUS ? AST_ADD : AST_SUB, {ast.release(), term_ast}));
 
-      // continue recursively
-      return parse_EPrime(ast.release());
-    }
+    // copy source information from operator node
+    ast->set_loc(op->get_loc());
   }
 
   // E' -> ^ epsilon
@@ -88,7 +130,7 @@ Node *Parser2::parse_T() {
   // Parse primary expression
   Node *ast = parse_F();
 
-  // Recursively continue the multiplicative expression
+  // Continue the multiplicative expression
   return parse_TPrime(ast);
 }
 
@@ -99,25 +141,28 @@ Node *Parser2::parse_TPrime(Node *ast_) {
 
   std::unique_ptr<Node> ast(ast_);
 
-  // peek at next token
-  Node *next_tok = m_lexer->peek();
-  if (next_tok) {
+  // applied iteratively, like E'
+  for (;;) {
+    // peek at next token
+    Node *next_tok = m_lexer->peek();
+    if (!next_tok) {
+      break;
+    }
     int next_tok_tag = next_tok->get_tag();
-    if (next_tok_tag == TOK_TIMES || next_tok_tag == TOK_DIVIDE)  {
-      // T' -> ^ * F T'
-      // T' -> ^ / F T'
-      std::unique_ptr<Node> op(expect(static_cast<enum TokenKind>(next_tok_tag)));
+    if (next_tok_tag != TOK_TIMES && next_tok_tag != TOK_DIVIDE) {
+      break;
+    }
 
-      // build AST for next primary expression, incorporate into current AST
-      Node *primary_ast = parse_F();
-      ast.reset(new Node(next_tok_tag == TOK_TIMES ? AST_MULTIPLY : AST_DIVIDE, {ast.release(), primary_ast}));
+    // T' -> ^ * F T'
+    // T' -> ^ / F T'
+    std::unique_ptr<Node> op(expect(static_cast<enum TokenKind>(next_tok_tag)));
 
-      // copy source information from operator node
-      ast->set_loc(op->get_loc());
+    // build AST for next primary expression, incorporate into current AST
+    Node *primary_ast = parse_F();
+    ast.reset(new Node(next_tok_tag == TOK_TIMES ? AST_MULTIPLY : AST_DIVIDE, {ast.release(), primary_ast}));
 
-      // continue recursively
-      return parse_TPrime(ast.release());
-    }
+    // copy source information from operator node
+    ast->set_loc(op->get_loc());
   }
 
   // T' -> ^ epsilon
@@ -155,6 +200,9 @@ Node *Parser2::parse_F() {
 
 Node *Parser2::expect(enum TokenKind tok_kind) {
   std::unique_ptr<Node> next_terminal(m_lexer->next());
+  if (!next_terminal) {
+    error_at_current_loc("Unexpected end of input");
+  }
   if (next_terminal->get_tag() != tok_kind) {
     SyntaxError::raise(next_terminal->get_loc(), "Unexpected token '%s'", next_terminal->get_str().c_str());
   }
@@ -13,10 +13,31 @@ public:
   Parser2(Lexer *lexer_to_adopt);
   ~Parser2();
 
+  // Reset the lexer to parse a new input from an in-memory buffer
+  // (see Lexer::reset), so that the parser and lexer can be reused
+  void reset(const char *buf, size_t len, const std::string &filename);
+
+  Lexer *get_lexer() const { return m_lexer; }
+
   Node *parse();
 
+  // Parse the rest of an additive expression whose left operand (lhs,
+  // which the parser takes ownership of) was parsed separately: the
+  // input continues with + or - operators and their right operands.
+  // Used to parse pieces of a large expression in parallel (see
+  // parsplit.h).
+  Node *parse_rest(Node *lhs);
+
+  // Check whether all of the input has been consumed
+  bool at_end();
+
+  // Parse a script of assignment statements, returning an
+  // AST_STATEMENT_LIST node
+  Node *parse_script();
+
 private:
   // Parse functions for nonterminal grammar symbols
+  Node *parse_S();
   Node *parse_E();
   Node *parse_EPrime(Node *ast);
   Node *parse_T();
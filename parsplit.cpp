@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "lexer.h"
+#include "parser2.h"
+#include "ast.h"
+#include "exceptions.h"
+#include "trace.h"
+#include "parsplit.h"
+
+namespace {
+
+const size_t NO_SPLIT = SIZE_MAX;
+
+// A block of the input, as seen by the prefix scan
+struct ScanBlock {
+  size_t begin, end;
+
+  // counted in the first pass
+  long depth_change;     // number of ( minus number of )
+  uint64_t newlines;
+  size_t last_newline;   // offset of the block's last newline, or NO_SPLIT
+
+  // found in the second pass, given the state at the start of the block
+  long start_depth;
+  int start_line, start_col;
+  size_t split;          // offset of first + or - at depth 0, or NO_SPLIT
+  int split_line, split_col;
+};
+
+// A piece of the input parsed by one task
+struct Chunk {
+  size_t begin, end;
+  int line, col;         // position of the chunk's first character
+  Node *root;
+  Node *bottom;          // node whose first kid is the placeholder (if any)
+  Node *placeholder;     // stands for the preceding chunks' tree
+  bool ok;
+};
+
+void count_block(const char *buf, ScanBlock &b) {
+  long depth = 0;
+  uint64_t newlines = 0;
+  size_t last_newline = NO_SPLIT;
+  for (size_t i = b.begin; i < b.end; i++) {
+    char c = buf[i];
+    if (c == '(') {
+      depth++;
+    } else if (c == ')') {
+      depth--;
+    } else if (c == '\n') {
+      newlines++;
+      last_newline = i;
+    }
+  }
+  b.depth_change = depth;
+  b.newlines = newlines;
+  b.last_newline = last_newline;
+}
+
+void find_split(const char *buf, ScanBlock &b) {
+  long depth = b.start_depth;
+  int line = b.start_line, col = b.start_col;
+  b.split = NO_SPLIT;
+  for (size_t i = b.begin; i < b.end; i++) {
+    char c = buf[i];
+    if ((c == '+' || c == '-') && depth == 0) {
+      b.split = i;
+      b.split_line = line;
+      b.split_col = col;
+      return;
+    }
+    if (c == '(') {
+      depth++;
+    } else if (c == ')') {
+      depth--;
+    }
+    if (c == '\n') {
+      line++;
+      col = 1;
+    } else {
+      col++;
+    }
+  }
+}
+
+// Parse one chunk: the first chunk is parsed as an expression, and
+// the others as the continuation of an expression whose left operand
+// is a placeholder
+void parse_chunk(const char *buf, const std::string &filename, bool first, Chunk &chunk) {
+  TRACE_SPAN("parse chunk");
+  chunk.root = chunk.bottom = chunk.placeholder = nullptr;
+  chunk.ok = false;
+  try {
+    Lexer *lexer = new Lexer(buf + chunk.begin, chunk.end - chunk.begin, filename);
+    lexer->set_position(chunk.line, chunk.col);
+    Parser2 parser(lexer);
+    if (first) {
+      chunk.root = parser.parse();
+      chunk.ok = parser.at_end();
+      return;
+    }
+
+    chunk.placeholder = new Node(AST_VARREF);
+    chunk.root = parser.parse_rest(chunk.placeholder);
+    if (chunk.root == chunk.placeholder || !parser.at_end()) {
+      return;
+    }
+    Node *n = chunk.root;
+    while (n->get_kid(0) != chunk.placeholder) {
+      n = n->get_kid(0);
+    }
+    chunk.bottom = n;
+    chunk.ok = true;
+  } catch (BaseException &) {
+    // the sequential parse will report the error
+  }
+}
+
+Node *parse_sequential(const char *buf, size_t len, const std::string &filename) {
+  Parser2 parser(new Lexer(buf, len, filename));
+  return parser.parse();
+}
+
+}
+
+Node *parse2_split(const char *buf, size_t len, const std::string &filename,
+                   WorkStealingPool &pool, size_t min_chunk, SplitParseInfo *info) {
+  SplitParseInfo dummy_info;
+  if (!info) {
+    info = &dummy_info;
+  }
+  info->num_chunks = 1;
+  info->fell_back = false;
+
+  size_t num_blocks = std::min(len / std::max(min_chunk, size_t(1)), size_t(pool.get_num_threads()) * 4);
+  if (num_blocks < 2) {
+    return parse_sequential(buf, len, filename);
+  }
+
+  // prefix scan: count, sum, then find the split points
+  std::vector<ScanBlock> blocks(num_blocks);
+  {
+    TRACE_SPAN("split scan");
+    for (size_t i = 0; i < num_blocks; i++) {
+      ScanBlock &b = blocks[i];
+      b.begin = len * i / num_blocks;
+      b.end = len * (i + 1) / num_blocks;
+      pool.submit([buf, &b]() { count_block(buf, b); });
+    }
+    pool.wait();
+
+    long depth = 0;
+    uint64_t line = 1;
+    size_t last_newline = NO_SPLIT;
+    for (auto i = blocks.begin(); i != blocks.end(); ++i) {
+      i->start_depth = depth;
+      i->start_line = int(line);
+      i->start_col = int(last_newline == NO_SPLIT ? i->begin + 1 : i->begin - last_newline);
+      depth += i->depth_change;
+      line += i->newlines;
+      if (i->last_newline != NO_SPLIT) {
+        last_newline = i->last_newline;
+      }
+    }
+
+    // the first block always starts the first chunk
+    for (size_t i = 1; i < num_blocks; i++) {
+      ScanBlock &b = blocks[i];
+      pool.submit([buf, &b]() { find_split(buf, b); });
+    }
+    pool.wait();
+  }
+
+  std::vector<Chunk> chunks;
+  Chunk first = Chunk();
+  first.begin = 0;
+  first.line = 1;
+  first.col = 1;
+  chunks.push_back(first);
+  for (size_t i = 1; i < num_blocks; i++) {
+    const ScanBlock &b = blocks[i];
+    if (b.split != NO_SPLIT) {
+      chunks.back().end = b.split;
+      Chunk chunk = Chunk();
+      chunk.begin = b.split;
+      chunk.line = b.split_line;
+      chunk.col = b.split_col;
+      chunks.push_back(chunk);
+    }
+  }
+  chunks.back().end = len;
+  info->num_chunks = chunks.size();
+  if (chunks.size() < 2) {
+    return parse_sequential(buf, len, filename);
+  }
+
+  for (size_t i = 0; i < chunks.size(); i++) {
+    Chunk &chunk = chunks[i];
+    bool is_first = i == 0;
+    pool.submit([buf, &filename, is_first, &chunk]() { parse_chunk(buf, filename, is_first, chunk); });
+  }
+  pool.wait();
+
+  bool ok = true;
+  for (auto i = chunks.begin(); i != chunks.end(); ++i) {
+    ok = ok && i->ok;
+  }
+  if (!ok) {
+    for (auto i = chunks.begin(); i != chunks.end(); ++i) {
+      delete i->root;
+    }
+    info->num_chunks = 1;
+    info->fell_back = true;
+    return parse_sequential(buf, len, filename);
+  }
+
+  // stitch: the tree built so far replaces each chunk's placeholder
+  TRACE_SPAN("stitch");
+  Node *ast = chunks[0].root;
+  for (size_t i = 1; i < chunks.size(); i++) {
+    delete chunks[i].bottom->replace_kid(0, ast);
+    ast = chunks[i].root;
+  }
+  return ast;
+}
@@ -0,0 +1,42 @@
+#ifndef PARSPLIT_H
+#define PARSPLIT_H
+
+#include <cstddef>
+#include <string>
+#include "node.h"
+#include "workpool.h"
+
+// What parse2_split did
+struct SplitParseInfo {
+  size_t num_chunks;  // pieces parsed in parallel
+  bool fell_back;     // true if the input was parsed sequentially
+
+  SplitParseInfo() : num_chunks(0), fell_back(false) { }
+};
+
+// Parse a single (very large) expression from an in-memory buffer,
+// producing the same AST as Parser2::parse, in parallel.
+//
+// A parallel prefix scan over the input finds + and - operators
+// outside of parentheses: the input is divided into blocks, the change
+// in parenthesis depth (and the number of newlines) in each block is
+// counted concurrently, the counts are summed to find the depth (and
+// line and column) at the start of each block, and then each block is
+// scanned concurrently for its first operator at depth zero.  The
+// input is split at those operators into chunks of at least min_chunk
+// bytes, which are parsed concurrently, each by a Parser2 whose lexer
+// starts at the chunk's position in the input, so that nodes get the
+// same locations as in a sequential parse.  Finally, each chunk's
+// tree is attached as the leftmost operand of the next chunk's tree,
+// rebuilding the left-associative spine of AST_ADD and AST_SUB nodes.
+//
+// If any chunk can't be parsed completely (because the input has an
+// error, or an operator split off a part of the input that a
+// sequential parse would not reach), the whole input is parsed
+// sequentially instead, so errors are reported exactly as by Parser2.
+// Small inputs are always parsed sequentially.
+Node *parse2_split(const char *buf, size_t len, const std::string &filename,
+                   WorkStealingPool &pool, size_t min_chunk = 1 << 20,
+                   SplitParseInfo *info = nullptr);
+
+#endif // PARSPLIT_H
@@ -0,0 +1,49 @@
+#include <algorithm>
+#include <vector>
+#include "partree.h"
+
+SubtreeSizes::SubtreeSizes(const Node *t) {
+  // a node's index is the number of nodes entered before it, and
+  // its size the number entered from it until it is left
+  struct StackItem {
+    const Node *n;
+    size_t index;
+    unsigned next_kid;
+  };
+
+  std::vector<StackItem> stack;
+  m_sizes.push_back(0);
+  stack.push_back({ t, 0, 0 });
+  while (!stack.empty()) {
+    StackItem &top = stack.back();
+    if (top.next_kid < top.n->get_num_kids()) {
+      const Node *kid = top.n->get_kid(top.next_kid++);
+      stack.push_back({ kid, m_sizes.size(), 0 });
+      m_sizes.push_back(0);
+      continue;
+    }
+    m_sizes[top.index] = m_sizes.size() - top.index;
+    stack.pop_back();
+  }
+}
+
+SubtreeSizes::~SubtreeSizes() {
+}
+
+size_t SubtreeSizes::count_fragments(size_t threshold) const {
+  threshold = std::max(threshold, size_t(1));
+  size_t count = m_sizes.empty() ? 0 : 1;
+
+  // ancestors of the current node, innermost last
+  std::vector<size_t> ancestors;
+  for (size_t i = 0; i < m_sizes.size(); i++) {
+    while (!ancestors.empty() && i >= ancestors.back() + m_sizes[ancestors.back()]) {
+      ancestors.pop_back();
+    }
+    if (!ancestors.empty() && is_fragment_root(i, ancestors.back(), threshold)) {
+      count++;
+    }
+    ancestors.push_back(i);
+  }
+  return count;
+}
@@ -0,0 +1,300 @@
+#ifndef PARTREE_H
+#define PARTREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "node.h"
+#include "workpool.h"
+
+// Task-parallel passes over large trees.
+//
+// A tree is divided into fragments of roughly a given number of nodes
+// (the threshold), each processed by one task on a WorkStealingPool.
+// A fragment is the subtree of its root node, less the subtrees of the
+// fragments below it.  Fragments are found from cached subtree sizes
+// (see SubtreeSizes), so the split is balanced whatever the shape of
+// the tree: a node starts a new fragment if its subtree has at least
+// threshold nodes, and its size divided by threshold differs from its
+// parent's.  A long left-deep spine of AST_ADD and AST_SUB nodes (as
+// Parser2 builds for a long sum) is thus cut every threshold nodes or
+// so, and a balanced tree is cut at its threshold-sized subtrees.
+// (A node with many small kids is not split, however.)
+//
+// Each fragment's task walks its part of the tree, submitting a task
+// for each fragment below it.  In a postorder pass (parallel_reduce
+// and parallel_transform), a fragment can only be finished when the
+// fragments below it are: whichever of their tasks finishes last (or
+// the fragment's own task, if it is last) then finishes it, so tasks
+// never wait for each other.
+//
+// With a null pool, a pass runs sequentially, as a single fragment,
+// so that its parallel results can be checked against its sequential
+// results.  The function a pass calls on each node must be safe to
+// call concurrently on different nodes.  If it throws an exception,
+// the pass ends and the exception is rethrown (the first, if it
+// is thrown several times.)
+
+// Default number of nodes in a fragment
+const size_t DEFAULT_FRAGMENT_SIZE = 16384;
+
+// Sizes of all subtrees of a tree, indexed in preorder: the kids of
+// the node with index i start at index i + 1, each following the
+// previous kid's subtree.  The sizes are computed once (by an
+// iterative walk) and can be used for any number of passes, as long
+// as the tree's shape doesn't change.
+class SubtreeSizes {
+private:
+  std::vector<size_t> m_sizes;
+
+  // no value semantics
+  SubtreeSizes(const SubtreeSizes &);
+  SubtreeSizes &operator=(const SubtreeSizes &);
+
+public:
+  SubtreeSizes(const Node *t);
+  ~SubtreeSizes();
+
+  size_t get_num_nodes() const { return m_sizes.size(); }
+  size_t get_size(size_t index) const { return m_sizes[index]; }
+
+  // Check whether the node at given index (whose parent is at
+  // parent_index) starts a new fragment
+  bool is_fragment_root(size_t index, size_t parent_index, size_t threshold) const {
+    size_t size = m_sizes[index];
+    return size >= threshold && size / threshold != m_sizes[parent_index] / threshold;
+  }
+
+  // Number of fragments the tree is divided into
+  size_t count_fragments(size_t threshold) const;
+};
+
+// Implementation of the passes: N is the node type (Node or const
+// Node), and T the type of the values computed by a postorder pass
+// (which must be default constructible and movable)
+template<typename N, typename T>
+class ParallelTreePass {
+private:
+  struct Fragment {
+    N *root;
+    size_t index;
+    Fragment *parent;
+    std::vector<std::unique_ptr<Fragment>> kids;  // in preorder
+    std::atomic<size_t> pending;  // unfinished kids, plus 1 until walked
+    T value;
+
+    Fragment(N *root_, size_t index_, Fragment *parent_)
+      : root(root_), index(index_), parent(parent_), pending(1), value() { }
+
+    ~Fragment() {
+      // fragments can be nested very deeply (along a long spine),
+      // so the ones below are deleted iteratively
+      std::vector<std::unique_ptr<Fragment>> below;
+      below.swap(kids);
+      while (!below.empty()) {
+        std::unique_ptr<Fragment> f = std::move(below.back());
+        below.pop_back();
+        for (auto i = f->kids.begin(); i != f->kids.end(); ++i) {
+          below.push_back(std::move(*i));
+        }
+        f->kids.clear();
+      }
+    }
+  };
+
+  struct SplitItem {
+    N *n;
+    size_t index, parent_index;
+  };
+
+  struct CombineItem {
+    N *n;
+    size_t index;
+    unsigned next_kid;
+    size_t next_index;  // index of the next kid
+  };
+
+  // stands in for the combine function of a for_each pass
+  struct NoCombine {
+    T operator()(N *, T *) { return T(); }
+  };
+
+  const SubtreeSizes &m_sizes;
+  WorkStealingPool *m_pool;
+  size_t m_threshold;
+
+  // no value semantics
+  ParallelTreePass(const ParallelTreePass &);
+  ParallelTreePass &operator=(const ParallelTreePass &);
+
+public:
+  ParallelTreePass(const SubtreeSizes &sizes, WorkStealingPool *pool, size_t threshold)
+    : m_sizes(sizes), m_pool(pool), m_threshold(std::max(threshold, size_t(1))) { }
+
+  // Call visit on each node, in no particular order
+  // (in preorder when sequential)
+  template<typename Visit>
+  void for_each(N *t, Visit &visit) {
+    Fragment top(t, 0, nullptr);
+    NoCombine *no_combine = nullptr;
+    if (!m_pool) {
+      walk(&top, visit, no_combine);
+      return;
+    }
+    m_pool->submit([this, &top, &visit, no_combine]() { walk(&top, visit, no_combine); });
+    m_pool->wait();
+  }
+
+  // Compute combine(n, kid_values) for each node, after its kids,
+  // returning the value for the root
+  template<typename Combine>
+  T reduce(N *t, Combine &combine) {
+    Fragment top(t, 0, nullptr);
+    if (!m_pool) {
+      return combine_fragment(&top, combine);
+    }
+    auto no_visit = [](N *) { };
+    m_pool->submit([this, &top, &no_visit, &combine]() { walk(&top, no_visit, &combine); });
+    m_pool->wait();
+    return std::move(top.value);
+  }
+
+private:
+  bool starts_fragment(size_t index, size_t parent_index) const {
+    return m_pool && m_sizes.is_fragment_root(index, parent_index, m_threshold);
+  }
+
+  // Walk a fragment in preorder, visiting its nodes and submitting a
+  // task for each fragment below it (in preorder, which is also the
+  // order in which combine_fragment reaches them.)  In a postorder
+  // pass, the fragment is then finished if the fragments below it
+  // already are.
+  template<typename Visit, typename Combine>
+  void walk(Fragment *f, Visit &visit, Combine *combine) {
+    std::vector<SplitItem> stack;
+    stack.push_back({ f->root, f->index, f->index });
+    while (!stack.empty()) {
+      SplitItem item = stack.back();
+      stack.pop_back();
+      if (item.n != f->root && starts_fragment(item.index, item.parent_index)) {
+        Fragment *kid = new Fragment(item.n, item.index, f);
+        f->kids.emplace_back(kid);
+        f->pending.fetch_add(1);
+        m_pool->submit([this, kid, &visit, combine]() { walk(kid, visit, combine); });
+        continue;
+      }
+      visit(item.n);
+
+      // push the kids so that the leftmost is on top.  A postorder
+      // pass only needs this walk to find the fragments below, so it
+      // skips kids too small to contain one.
+      size_t first = stack.size(), kid_index = item.index + 1;
+      for (auto i = item.n->cbegin(); i != item.n->cend(); ++i) {
+        size_t kid_size = m_sizes.get_size(kid_index);
+        if (!combine || kid_size >= m_threshold) {
+          stack.push_back({ *i, kid_index, item.index });
+        }
+        kid_index += kid_size;
+      }
+      std::reverse(stack.begin() + first, stack.end());
+    }
+
+    if (combine && f->pending.fetch_sub(1) == 1) {
+      finish(f, *combine);
+    }
+  }
+
+  // Finish a fragment whose kids are finished, and then its parent,
+  // if this was the parent's last unfinished kid, and so on
+  template<typename Combine>
+  void finish(Fragment *f, Combine &combine) {
+    while (f) {
+      f->value = combine_fragment(f, combine);
+      f->kids.clear();
+      f = f->parent;
+      if (f && f->pending.fetch_sub(1) != 1) {
+        return;
+      }
+    }
+  }
+
+  // Walk a fragment in postorder, combining the values of each node's
+  // kids (for a kid that starts a fragment, the fragment's value)
+  template<typename Combine>
+  T combine_fragment(Fragment *f, Combine &combine) {
+    std::vector<CombineItem> stack;
+    std::vector<T> values;
+    size_t next_fragment = 0;
+    stack.push_back({ f->root, f->index, 0, f->index + 1 });
+    while (!stack.empty()) {
+      CombineItem &top = stack.back();
+      if (top.next_kid < top.n->get_num_kids()) {
+        N *kid = top.n->get_kid(top.next_kid++);
+        size_t kid_index = top.next_index;
+        top.next_index += m_sizes.get_size(kid_index);
+        if (starts_fragment(kid_index, top.index)) {
+          Fragment *kid_fragment = f->kids[next_fragment++].get();
+          assert(kid_fragment->index == kid_index);
+          values.push_back(std::move(kid_fragment->value));
+        } else {
+          stack.push_back({ kid, kid_index, 0, kid_index + 1 });
+        }
+        continue;
+      }
+
+      N *n = top.n;
+      size_t num_kids = n->get_num_kids();
+      stack.pop_back();
+      T value = combine(n, values.data() + (values.size() - num_kids));
+      values.resize(values.size() - num_kids);
+      values.push_back(std::move(value));
+    }
+    return std::move(values.back());
+  }
+};
+
+// Call visit(n) on each node n of a tree.  With a pool, visit is called
+// concurrently in no particular order; without one, in preorder.
+template<typename N, typename Visit>
+void parallel_for_each(N *t, const SubtreeSizes &sizes, WorkStealingPool *pool,
+                       Visit visit, size_t threshold = DEFAULT_FRAGMENT_SIZE) {
+  ParallelTreePass<N, char> pass(sizes, pool, threshold);
+  pass.for_each(t, visit);
+}
+
+// Compute a value of type T for each node, as combine(n, kid_values),
+// where kid_values points to the values for n's kids (which combine
+// may move from), and return the value for the root.
+template<typename T, typename N, typename Combine>
+T parallel_reduce(N *t, const SubtreeSizes &sizes, WorkStealingPool *pool,
+                  Combine combine, size_t threshold = DEFAULT_FRAGMENT_SIZE) {
+  ParallelTreePass<N, T> pass(sizes, pool, threshold);
+  return pass.reduce(t, combine);
+}
+
+// Transform a tree bottom-up: each node n is replaced by fn(n), which
+// is called after n's kids have been replaced by their transformed
+// versions.  fn may return n itself (possibly modified), or a new node,
+// in which case fn takes responsibility for n (for example, deleting
+// it.)  Returns the transformed tree, whose sizes must be computed
+// afresh for later passes if its shape has changed.  If fn throws an
+// exception, the tree may be left partly transformed.
+template<typename Fn>
+Node *parallel_transform(Node *t, const SubtreeSizes &sizes, WorkStealingPool *pool,
+                         Fn fn, size_t threshold = DEFAULT_FRAGMENT_SIZE) {
+  auto combine = [&fn](Node *n, Node **kids) {
+    for (unsigned i = 0; i < n->get_num_kids(); i++) {
+      if (kids[i] != n->get_kid(i)) {
+        n->replace_kid(i, kids[i]);
+      }
+    }
+    return fn(n);
+  };
+  return parallel_reduce<Node *>(t, sizes, pool, combine, threshold);
+}
+
+#endif // PARTREE_H
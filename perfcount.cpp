@@ -0,0 +1,87 @@
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perfcount.h"
+
+namespace {
+
+struct EventConfig {
+  uint32_t type;
+  uint64_t config;
+  const char *name;
+};
+
+const uint64_t L1D_READ_MISS =
+  PERF_COUNT_HW_CACHE_L1D
+  | (uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8)
+  | (uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+
+const EventConfig EVENTS[PerfCounters::NUM_EVENTS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses" },
+  { PERF_TYPE_HW_CACHE, L1D_READ_MISS, "l1d_misses" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "llc_misses" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page_faults" },
+};
+
+int open_event(const EventConfig &ev) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = ev.type;
+  attr.config = ev.config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // this thread, any CPU, no group
+  return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+}
+
+PerfCounters::PerfCounters() {
+  for (unsigned i = 0; i < NUM_EVENTS; i++) {
+    m_fds[i] = open_event(EVENTS[i]);
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (unsigned i = 0; i < NUM_EVENTS; i++) {
+    if (m_fds[i] >= 0) {
+      close(m_fds[i]);
+    }
+  }
+}
+
+bool PerfCounters::any_available() const {
+  for (unsigned i = 0; i < NUM_EVENTS; i++) {
+    if (m_fds[i] >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PerfCounters::read(uint64_t values[NUM_EVENTS]) const {
+  for (unsigned i = 0; i < NUM_EVENTS; i++) {
+    values[i] = 0;
+    if (m_fds[i] < 0) {
+      continue;
+    }
+    uint64_t buf[3]; // value, time enabled, time running
+    if (::read(m_fds[i], buf, sizeof(buf)) != ssize_t(sizeof(buf))) {
+      continue;
+    }
+    if (buf[2] > 0 && buf[2] < buf[1]) {
+      values[i] = uint64_t(double(buf[0]) * double(buf[1]) / double(buf[2]));
+    } else {
+      values[i] = buf[0];
+    }
+  }
+}
+
+const char *PerfCounters::get_event_name(Event event) {
+  return EVENTS[event].name;
+}
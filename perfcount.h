@@ -0,0 +1,47 @@
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <cstdint>
+
+// Hardware and software performance counters for the calling thread,
+// using the Linux perf_event_open system call.  Each event is opened
+// separately, so if some events aren't available (no PMU access in
+// a virtual machine, or a restrictive perf_event_paranoid setting),
+// the others are still counted; unavailable events read as 0.
+// Only user-space activity is counted.
+class PerfCounters {
+public:
+  enum Event {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    LLC_MISSES,
+    PAGE_FAULTS,
+    NUM_EVENTS,
+  };
+
+private:
+  int m_fds[NUM_EVENTS];
+
+  // no value semantics
+  PerfCounters(const PerfCounters &);
+  PerfCounters &operator=(const PerfCounters &);
+
+public:
+  // Open and start the counters (never fails: events that can't
+  // be opened are just unavailable)
+  PerfCounters();
+  ~PerfCounters();
+
+  bool is_available(Event event) const { return m_fds[event] >= 0; }
+  bool any_available() const;
+
+  // Read the current (cumulative) counts.  If the kernel multiplexed
+  // a counter, its count is scaled up to the whole time it was enabled.
+  void read(uint64_t values[NUM_EVENTS]) const;
+
+  static const char *get_event_name(Event event);
+};
+
+#endif // PERFCOUNT_H
@@ -0,0 +1,528 @@
+// Performance regression gate: runs the core stages of the pipeline
+// (lexing, Parser + buildast, Parser2, and AST printing) over fixed
+// generated corpora, and compares their throughput and heap allocation
+// counts with a baseline file.  Exits with status 1 (after printing a
+// table of all stages) if any stage has regressed, or if buildast and
+// Parser2 build different ASTs for any expression.
+//
+// Throughput is based on the fastest repetition, which is the least
+// affected by interference from the rest of the system, in the best of
+// several passes over all the stages (a check stops after the first
+// pass with no regressions.)  A baseline records each stage's median
+// pass instead, so that one lucky pass doesn't make the check too
+// strict.  A stage's throughput has regressed if it is lower than the
+// baseline by more than a threshold: twice the relative noise of the
+// baseline measurement (the distance of the median repetition time
+// from the fastest, as a fraction of the median), but no less than a
+// fixed floor and no more than a fixed cap.  Only the baseline's noise
+// counts, so that a noisy (or slow) run can't widen its own threshold.
+// Allocation counts are deterministic, so any increase is a regression.
+//
+// Throughput depends on the machine, so the baseline must be measured
+// (with -u) on the machine running the checks.  Writing a baseline
+// warns about stages so noisy that their threshold is the cap.
+//
+// Usage: perfgate [options] [BASELINE_FILE]
+//   -u        measure and write the baseline file, rather than checking
+//   -n FRAC   minimum regression threshold (default 0.15)
+//   -c FRAC   maximum regression threshold (default 0.25)
+//   -p N      number of passes (at most, for a check; default 3)
+//   -r N      minimum number of timed repetitions (default 15)
+//   -t SECS   minimum timed seconds per stage and corpus (default 0.3)
+//
+// The baseline file defaults to perf_baseline.txt.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <unistd.h> // for getopt
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "exceptions.h"
+#include "lexer.h"
+#include "ast.h"
+#include "buildast.h"
+#include "outbuf.h"
+#include "treeutil.h"
+#include "workload.h"
+#include "bench.h"
+
+////////////////////////////////////////////////////////////////////////
+// Allocation counting
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+std::atomic<uint64_t> g_num_allocs;
+
+}
+
+void *operator new(size_t size) {
+  g_num_allocs.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size > 0 ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Corpora and stages
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Corpus {
+  std::string name;
+  std::vector<std::string> exprs;
+  size_t bytes;
+};
+
+// Generate a corpus of expressions.  Individual expressions are kept
+// to moderate size, since the parsers recurse once per operator.
+Corpus gen_corpus(const std::string &name, const WorkloadShape &shape,
+                  uint64_t seed, size_t num_exprs) {
+  Corpus corpus;
+  corpus.name = name;
+  corpus.bytes = 0;
+  WorkloadGen gen(shape, seed);
+  for (size_t i = 0; i < num_exprs; i++) {
+    std::string src;
+    StringSink sink(src);
+    OutputBuffer out(sink);
+    gen.generate(out);
+    out.flush();
+    corpus.bytes += src.size();
+    corpus.exprs.push_back(src);
+  }
+  return corpus;
+}
+
+std::vector<Corpus> gen_corpora() {
+  std::vector<Corpus> corpora;
+
+  // ordinary formulas
+  WorkloadShape formulas;
+  corpora.push_back(gen_corpus("formulas", formulas, 1, 4000));
+
+  // deeply parenthesized expressions
+  WorkloadShape nested;
+  nested.chain_min = 2;
+  nested.chain_max = 3;
+  nested.max_depth = 10;
+  nested.paren_prob = 0.5;
+  corpora.push_back(gen_corpus("nested", nested, 2, 400));
+
+  // long flat operator chains
+  WorkloadShape chains;
+  chains.chain_min = 20;
+  chains.chain_max = 80;
+  chains.max_depth = 1;
+  chains.paren_prob = 0.05;
+  corpora.push_back(gen_corpus("chains", chains, 3, 200));
+
+  // mostly long literals, little whitespace
+  WorkloadShape literals;
+  literals.literal_prob = 0.9;
+  literals.literal_min = 6;
+  literals.literal_max = 18;
+  literals.ws_density = 0.2;
+  corpora.push_back(gen_corpus("literals", literals, 4, 2000));
+
+  return corpora;
+}
+
+// Lex an expression the way the parsers consume tokens (with a
+// lexer per thread, as bench_parse and bench_parse2 use)
+void lex_expr(const std::string &src) {
+  thread_local Lexer lexer;
+  lexer.reset(src.data(), src.size(), "<perfgate>");
+  while (lexer.peek(1)) {
+    delete lexer.next();
+  }
+}
+
+// Check that buildast and Parser2 build the same AST for every
+// expression; returns the number of expressions where they differ
+size_t check_asts(const Corpus &corpus) {
+  size_t mismatches = 0;
+  for (auto i = corpus.exprs.begin(); i != corpus.exprs.end(); ++i) {
+    std::unique_ptr<Node> parse_tree(bench_parse(*i));
+    std::unique_ptr<Node> ast_b, ast_2(bench_parse2(*i));
+    try {
+      ast_b.reset(buildast(parse_tree.get()));
+    } catch (RuntimeError &) {
+      // buildast failing counts as a mismatch
+    }
+    if (!ast_b || !trees_equal(ast_b.get(), ast_2.get())) {
+      if (mismatches == 0) {
+        printf("%s: -b and -2 ASTs differ for expression %zu: %.60s%s\n",
+               corpus.name.c_str(), size_t(i - corpus.exprs.begin()), i->c_str(),
+               i->size() > 60 ? "..." : "");
+      }
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+// Measurement of one stage on one corpus
+struct Measurement {
+  std::string unit;
+  double throughput; // units per second
+  double noise;      // relative spread of repetition times
+  uint64_t allocs;   // heap allocations per pass over the corpus
+};
+
+typedef std::pair<std::string, std::string> StageKey; // (stage, corpus)
+
+double noise_of(const BenchResult &r) {
+  return r.median > 0.0 ? (r.median - r.min) / r.median : 0.0;
+}
+
+// Run a stage: measure its throughput with the bench runner, and
+// count the allocations done by one (untimed) pass.  The pass runs on
+// a new thread, so that it starts with new lexers and parsers: how
+// often a lexer's lookahead deque allocates depends on how many
+// tokens it has seen before.
+void measure(BenchRunner &runner, std::map<StageKey, Measurement> &results,
+             const std::string &stage, const Corpus &corpus, double items,
+             const std::string &unit, const std::function<void()> &fn,
+             const std::function<void()> &setup = std::function<void()>()) {
+  const BenchResult *r = runner.run(stage, corpus.name, items, unit, fn, setup);
+  if (!r) {
+    return;
+  }
+
+  if (setup) {
+    setup();
+  }
+  uint64_t allocs = 0;
+  std::thread counter([&]() {
+    uint64_t before = g_num_allocs.load();
+    fn();
+    allocs = g_num_allocs.load() - before;
+  });
+  counter.join();
+  if (setup) {
+    setup();
+  }
+
+  Measurement m;
+  m.unit = unit;
+  m.throughput = r->min > 0.0 ? items / r->min : 0.0;
+  m.noise = noise_of(*r);
+  m.allocs = allocs;
+  results[StageKey(stage, corpus.name)] = m;
+  fprintf(stderr, ".");
+}
+
+void measure_corpus(BenchRunner &runner, std::map<StageKey, Measurement> &results,
+                    const Corpus &corpus) {
+  double bytes = double(corpus.bytes);
+  const std::vector<std::string> &exprs = corpus.exprs;
+
+  // trees built by a repetition are destroyed by the next setup,
+  // so that destruction isn't timed
+  std::vector<std::unique_ptr<Node>> trees;
+  auto discard_trees = [&]() { trees.clear(); };
+
+  measure(runner, results, "lex", corpus, bytes, "B", [&]() {
+    for (auto i = exprs.begin(); i != exprs.end(); ++i) {
+      lex_expr(*i);
+    }
+  });
+
+  std::vector<std::unique_ptr<Node>> parse_trees;
+  measure(runner, results, "parse+buildast", corpus, bytes, "B", [&]() {
+    for (auto i = exprs.begin(); i != exprs.end(); ++i) {
+      parse_trees.emplace_back(bench_parse(*i));
+      trees.emplace_back(buildast(parse_trees.back().get()));
+    }
+  }, [&]() { parse_trees.clear(); trees.clear(); });
+
+  measure(runner, results, "parse2", corpus, bytes, "B", [&]() {
+    for (auto i = exprs.begin(); i != exprs.end(); ++i) {
+      trees.emplace_back(bench_parse2(*i));
+    }
+  }, discard_trees);
+
+  std::vector<std::unique_ptr<Node>> asts;
+  size_t ast_nodes = 0;
+  for (auto i = exprs.begin(); i != exprs.end(); ++i) {
+    asts.emplace_back(bench_parse2(*i));
+    ast_nodes += count_nodes(asts.back().get());
+  }
+  ASTTreePrint tp;
+  measure(runner, results, "print", corpus, double(ast_nodes), "node", [&]() {
+    NullSink sink;
+    OutputBuffer out(sink);
+    for (auto i = asts.begin(); i != asts.end(); ++i) {
+      tp.print(i->get(), out);
+    }
+    out.flush();
+  });
+}
+
+////////////////////////////////////////////////////////////////////////
+// Baseline files
+////////////////////////////////////////////////////////////////////////
+
+void write_baseline(const char *filename, const std::map<StageKey, Measurement> &results) {
+  FILE *out = fopen(filename, "w");
+  if (!out) {
+    RuntimeError::raise("Could not open baseline file '%s'", filename);
+  }
+  fprintf(out, "# perfgate baseline: stage corpus unit throughput(units/s) noise allocs\n");
+  for (auto i = results.begin(); i != results.end(); ++i) {
+    const Measurement &m = i->second;
+    fprintf(out, "%s %s %s %.6g %.4f %lu\n", i->first.first.c_str(), i->first.second.c_str(),
+            m.unit.c_str(), m.throughput, m.noise, (unsigned long) m.allocs);
+  }
+  if (fclose(out) != 0) {
+    RuntimeError::raise("Error writing baseline file '%s'", filename);
+  }
+}
+
+std::map<StageKey, Measurement> read_baseline(const char *filename) {
+  FILE *in = fopen(filename, "r");
+  if (!in) {
+    RuntimeError::raise("Could not open baseline file '%s' (create it with -u, or make perfbaseline)", filename);
+  }
+  std::map<StageKey, Measurement> baseline;
+  char line[512], stage[128], corpus[128], unit[32];
+  unsigned lineno = 0;
+  while (fgets(line, sizeof(line), in)) {
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    Measurement m;
+    unsigned long allocs;
+    if (sscanf(line, "%127s %127s %31s %lf %lf %lu", stage, corpus, unit,
+               &m.throughput, &m.noise, &allocs) != 6) {
+      fclose(in);
+      RuntimeError::raise("%s:%u: invalid baseline entry", filename, lineno);
+    }
+    m.unit = unit;
+    m.allocs = allocs;
+    baseline[StageKey(stage, corpus)] = m;
+  }
+  fclose(in);
+  return baseline;
+}
+
+// Combine the measurements of several passes, taking for each stage
+// the pass with the highest throughput, or the median one
+std::map<StageKey, Measurement>
+combine_passes(const std::vector<std::map<StageKey, Measurement>> &passes, bool median) {
+  std::map<StageKey, std::vector<Measurement>> by_stage;
+  for (auto i = passes.begin(); i != passes.end(); ++i) {
+    for (auto j = i->begin(); j != i->end(); ++j) {
+      by_stage[j->first].push_back(j->second);
+    }
+  }
+  std::map<StageKey, Measurement> results;
+  for (auto i = by_stage.begin(); i != by_stage.end(); ++i) {
+    std::vector<Measurement> &m = i->second;
+    std::sort(m.begin(), m.end(), [](const Measurement &a, const Measurement &b) {
+      return a.throughput > b.throughput;
+    });
+    results[i->first] = median ? m[m.size() / 2] : m[0];
+  }
+  return results;
+}
+
+// Regression threshold for a stage, as a fraction of its baseline
+double threshold(const Measurement &base, double floor, double cap) {
+  return std::min(cap, std::max(floor, 2.0 * base.noise));
+}
+
+bool throughput_regressed(const Measurement &base, const Measurement &cur,
+                          double floor, double cap) {
+  double change = base.throughput > 0.0 ? cur.throughput / base.throughput - 1.0 : 0.0;
+  return change < -threshold(base, floor, cap);
+}
+
+// Number of stages whose throughput has regressed
+unsigned count_slower(const std::map<StageKey, Measurement> &baseline,
+                      const std::map<StageKey, Measurement> &results, double floor, double cap) {
+  unsigned slower = 0;
+  for (auto i = results.begin(); i != results.end(); ++i) {
+    auto b = baseline.find(i->first);
+    if (b != baseline.end() && throughput_regressed(b->second, i->second, floor, cap)) {
+      slower++;
+    }
+  }
+  return slower;
+}
+
+// Compare results with the baseline, printing a table; returns
+// the number of regressions
+unsigned compare(const std::map<StageKey, Measurement> &baseline,
+                 const std::map<StageKey, Measurement> &results, double floor, double cap) {
+  unsigned regressions = 0;
+  printf("%-15s %-10s %14s %14s %8s %6s %10s %10s  %s\n", "stage", "corpus",
+         "baseline/s", "current/s", "change", "limit", "allocs", "(baseline)", "status");
+  for (auto i = results.begin(); i != results.end(); ++i) {
+    const Measurement &cur = i->second;
+    auto b = baseline.find(i->first);
+    if (b == baseline.end()) {
+      printf("%-15s %-10s %14s %14.4g %8s %6s %10lu %10s  new (not in baseline)\n",
+             i->first.first.c_str(), i->first.second.c_str(), "-", cur.throughput,
+             "-", "-", (unsigned long) cur.allocs, "-");
+      continue;
+    }
+    const Measurement &base = b->second;
+    double change = base.throughput > 0.0 ? cur.throughput / base.throughput - 1.0 : 0.0;
+    double limit = threshold(base, floor, cap);
+
+    std::string status = "ok";
+    if (throughput_regressed(base, cur, floor, cap)) {
+      status = "REGRESSED (throughput)";
+    }
+    if (cur.allocs > base.allocs) {
+      status = status == "ok" ? "REGRESSED (allocs)" : "REGRESSED (throughput, allocs)";
+    }
+    if (status != "ok") {
+      regressions++;
+    } else if (change > limit || cur.allocs < base.allocs) {
+      status = "improved";
+    }
+
+    printf("%-15s %-10s %14.4g %14.4g %+7.1f%% %5.0f%% %10lu %10lu  %s\n",
+           i->first.first.c_str(), i->first.second.c_str(), base.throughput,
+           cur.throughput, 100.0 * change, 100.0 * limit,
+           (unsigned long) cur.allocs, (unsigned long) base.allocs, status.c_str());
+  }
+  return regressions;
+}
+
+}
+
+int execute(int argc, char **argv) {
+  BenchRunner::Options options;
+  options.min_reps = 15;
+  options.min_secs = 0.3;
+  double floor = 0.15, cap = 0.25;
+  unsigned max_passes = 3;
+  bool update = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "un:c:p:r:t:")) != -1) {
+    switch (opt) {
+    case 'u':
+      update = true;
+      break;
+    case 'n':
+      floor = atof(optarg);
+      break;
+    case 'c':
+      cap = atof(optarg);
+      break;
+    case 'p':
+      max_passes = unsigned(atol(optarg));
+      break;
+    case 'r':
+      options.min_reps = unsigned(atol(optarg));
+      break;
+    case 't':
+      options.min_secs = atof(optarg);
+      break;
+    default:
+      RuntimeError::raise("Unknown option: %c", opt);
+    }
+  }
+  if (options.min_reps < 1) {
+    options.min_reps = 1;
+  }
+  if (max_passes < 1) {
+    max_passes = 1;
+  }
+  cap = std::max(floor, cap);
+  const char *baseline_file = optind < argc ? argv[optind] : "perf_baseline.txt";
+
+  // read the baseline first, so that a missing file is reported
+  // before spending time on measurements
+  std::map<StageKey, Measurement> baseline;
+  if (!update) {
+    baseline = read_baseline(baseline_file);
+  }
+
+  std::vector<Corpus> corpora = gen_corpora();
+  for (auto i = corpora.begin(); i != corpora.end(); ++i) {
+    fprintf(stderr, "%s: %zu bytes\n", i->name.c_str(), i->bytes);
+  }
+
+  // correctness: both ways of building ASTs must agree
+  size_t mismatches = 0;
+  for (auto i = corpora.begin(); i != corpora.end(); ++i) {
+    mismatches += check_asts(*i);
+  }
+
+  BenchRunner runner(options);
+  std::vector<std::map<StageKey, Measurement>> passes;
+  std::map<StageKey, Measurement> results;
+  while (passes.size() < max_passes) {
+    passes.emplace_back();
+    for (auto i = corpora.begin(); i != corpora.end(); ++i) {
+      measure_corpus(runner, passes.back(), *i);
+    }
+    results = combine_passes(passes, update);
+    if (!update && count_slower(baseline, results, floor, cap) == 0) {
+      break;
+    }
+  }
+  fprintf(stderr, "\n");
+
+  if (update) {
+    if (mismatches > 0) {
+      RuntimeError::raise("Not writing a baseline: -b and -2 ASTs differ");
+    }
+    write_baseline(baseline_file, results);
+    printf("Wrote baseline for %zu stage measurements to %s\n", results.size(), baseline_file);
+    for (auto i = results.begin(); i != results.end(); ++i) {
+      if (2.0 * i->second.noise > cap) {
+        fprintf(stderr, "Warning: %s %s is noisy (%.0f%%), so its threshold is the %.0f%% cap\n",
+                i->first.first.c_str(), i->first.second.c_str(),
+                100.0 * i->second.noise, 100.0 * cap);
+      }
+    }
+    return 0;
+  }
+
+  unsigned regressions = compare(baseline, results, floor, cap);
+  if (mismatches > 0) {
+    printf("FAILED: -b and -2 ASTs differ for %zu expressions\n", mismatches);
+  }
+  if (regressions > 0) {
+    printf("FAILED: %u stage measurements regressed\n", regressions);
+  }
+  if (mismatches > 0 || regressions > 0) {
+    return 1;
+  }
+  printf("passed\n");
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  try {
+    return execute(argc, argv);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
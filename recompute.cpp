@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <queue>
+#include "ast.h"
+#include "exceptions.h"
+#include "recompute.h"
+
+namespace {
+
+// Get the distinct slots of the variables referenced in an expression
+std::vector<int> find_deps(const Node *expr) {
+  std::vector<int> deps;
+  std::vector<const Node *> work;
+  work.push_back(expr);
+  while (!work.empty()) {
+    const Node *n = work.back();
+    work.pop_back();
+    if (n->get_tag() == AST_VARREF) {
+      deps.push_back(n->get_slot());
+    }
+    for (auto i = n->cbegin(); i != n->cend(); ++i) {
+      work.push_back(*i);
+    }
+  }
+  std::sort(deps.begin(), deps.end());
+  deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+  return deps;
+}
+
+}
+
+RecomputeEngine::RecomputeEngine(Node *script_to_adopt)
+  : m_script(script_to_adopt)
+  , m_initialized(false)
+  , m_total_recomputed(0) {
+  bind_varrefs(m_script.get(), m_symtab);
+
+  std::vector<const Node *> assigns;
+  for (auto i = m_script->cbegin(); i != m_script->cend(); ++i) {
+    assigns.push_back(*i);
+  }
+  build(assigns);
+}
+
+RecomputeEngine::~RecomputeEngine() {
+}
+
+bool RecomputeEngine::is_input(const std::string &name) const {
+  int slot = m_symtab.lookup(name);
+  return slot >= 0 && m_defined_by[slot] < 0;
+}
+
+void RecomputeEngine::set_input(const std::string &name, int64_t value) {
+  if (!is_input(name)) {
+    RuntimeError::raise("'%s' is not an input variable", name.c_str());
+  }
+  int slot = m_symtab.lookup(name);
+  if (m_values[slot] != value) {
+    m_values[slot] = value;
+    m_changed_inputs.push_back(slot);
+  }
+}
+
+unsigned RecomputeEngine::update() {
+  // min-heap of topological positions of statements to evaluate:
+  // a statement's readers always come later in topological order,
+  // so each statement is evaluated at most once per update
+  std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>> work;
+
+  auto mark = [&](unsigned pos) {
+    if (!m_dirty[pos]) {
+      m_dirty[pos] = true;
+      work.push(pos);
+    }
+  };
+
+  if (!m_initialized) {
+    for (unsigned pos = 0; pos < m_stmts.size(); pos++) {
+      mark(pos);
+    }
+    m_initialized = true;
+  }
+  for (auto i = m_changed_inputs.begin(); i != m_changed_inputs.end(); ++i) {
+    const std::vector<unsigned> &readers = m_input_readers[*i];
+    for (auto j = readers.begin(); j != readers.end(); ++j) {
+      mark(*j);
+    }
+  }
+  m_changed_inputs.clear();
+
+  unsigned count = 0;
+  std::exception_ptr error;
+  while (!work.empty()) {
+    unsigned pos = work.top();
+    work.pop();
+    m_dirty[pos] = false;
+
+    const Statement &stmt = m_stmts[pos];
+    int64_t value;
+    count++;
+    try {
+      value = m_eval.eval(stmt.assign->get_kid(1), m_values.data());
+    } catch (BaseException &) {
+      // the statement keeps its old value; the rest of the work is
+      // still done, so that no statement is left dirty (and never
+      // queued again), and the first error is reported afterwards
+      if (!error) {
+        error = std::current_exception();
+      }
+      continue;
+    }
+
+    if (value != m_values[stmt.target]) {
+      m_values[stmt.target] = value;
+      for (auto i = stmt.readers.begin(); i != stmt.readers.end(); ++i) {
+        mark(*i);
+      }
+    }
+  }
+
+  m_total_recomputed += count;
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return count;
+}
+
+int64_t RecomputeEngine::get_value(const std::string &name) const {
+  int slot = m_symtab.lookup(name);
+  if (slot < 0) {
+    RuntimeError::raise("Unknown variable '%s'", name.c_str());
+  }
+  return m_values[slot];
+}
+
+void RecomputeEngine::build(const std::vector<const Node *> &assigns) {
+  unsigned nslots = m_symtab.get_num_slots();
+  unsigned nstmts = unsigned(assigns.size());
+
+  // find the statement (by source index) defining each variable
+  m_defined_by.assign(nslots, -1);
+  for (unsigned s = 0; s < nstmts; s++) {
+    int target = assigns[s]->get_kid(0)->get_slot();
+    if (m_defined_by[target] >= 0) {
+      SemanticError::raise(assigns[s]->get_loc(), "Variable '%s' is assigned more than once",
+                           m_symtab.get_name(target).c_str());
+    }
+    m_defined_by[target] = int(s);
+  }
+
+  // build dependency graph: users[s] are the statements using
+  // the variable defined by statement s
+  std::vector<std::vector<int>> deps(nstmts);
+  std::vector<std::vector<unsigned>> users(nstmts);
+  std::vector<unsigned> num_pending(nstmts, 0);
+  for (unsigned s = 0; s < nstmts; s++) {
+    deps[s] = find_deps(assigns[s]->get_kid(1));
+    for (auto i = deps[s].begin(); i != deps[s].end(); ++i) {
+      int def = m_defined_by[*i];
+      if (def >= 0) {
+        users[def].push_back(s);
+        num_pending[s]++;
+      }
+    }
+  }
+
+  // topologically sort the statements (Kahn's algorithm), keeping
+  // independent statements in source order
+  std::vector<unsigned> order, pos(nstmts);
+  std::deque<unsigned> ready;
+  for (unsigned s = 0; s < nstmts; s++) {
+    if (num_pending[s] == 0) {
+      ready.push_back(s);
+    }
+  }
+  while (!ready.empty()) {
+    unsigned s = ready.front();
+    ready.pop_front();
+    pos[s] = unsigned(order.size());
+    order.push_back(s);
+    for (auto i = users[s].begin(); i != users[s].end(); ++i) {
+      if (--num_pending[*i] == 0) {
+        ready.push_back(*i);
+      }
+    }
+  }
+  if (order.size() < nstmts) {
+    for (unsigned s = 0; s < nstmts; s++) {
+      if (num_pending[s] > 0) {
+        SemanticError::raise(assigns[s]->get_loc(), "Circular dependency involving variable '%s'",
+                             m_symtab.get_name(assigns[s]->get_kid(0)->get_slot()).c_str());
+      }
+    }
+  }
+
+  // statements and their readers, indexed by topological position
+  m_input_readers.assign(nslots, std::vector<unsigned>());
+  m_stmts.resize(nstmts);
+  for (unsigned s = 0; s < nstmts; s++) {
+    Statement &stmt = m_stmts[pos[s]];
+    stmt.assign = assigns[s];
+    stmt.target = assigns[s]->get_kid(0)->get_slot();
+    for (auto i = users[s].begin(); i != users[s].end(); ++i) {
+      stmt.readers.push_back(pos[*i]);
+    }
+    for (auto i = deps[s].begin(); i != deps[s].end(); ++i) {
+      if (m_defined_by[*i] < 0) {
+        m_input_readers[*i].push_back(pos[s]);
+      }
+    }
+  }
+
+  m_values.assign(nslots, 0);
+  m_dirty.assign(nstmts, false);
+}
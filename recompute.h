@@ -0,0 +1,79 @@
+#ifndef RECOMPUTE_H
+#define RECOMPUTE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "node.h"
+#include "symtab.h"
+#include "eval.h"
+
+// Spreadsheet-style incremental evaluation of a script of assignment
+// statements (as parsed by Parser2::parse_script.)  Variables that
+// are referenced but never assigned are inputs, and default to 0.
+//
+// Statements are evaluated in dependency (topological) order, not in
+// source order.  After the values of some inputs change, update()
+// re-evaluates only the statements that transitively depend on them;
+// propagation also stops at statements whose value didn't change.
+class RecomputeEngine {
+private:
+  struct Statement {
+    const Node *assign;            // the AST_ASSIGN node
+    int target;                    // slot of assigned variable
+    std::vector<unsigned> readers; // statements (topological positions)
+                                   // that use the target variable
+  };
+
+  std::unique_ptr<Node> m_script;
+  SymbolTable m_symtab;
+  std::vector<Statement> m_stmts;          // in topological order
+  std::vector<int> m_defined_by;           // slot -> statement, -1 for inputs
+  std::vector<std::vector<unsigned>> m_input_readers; // slot -> statements
+  std::vector<int64_t> m_values;           // slot -> current value
+  std::vector<int> m_changed_inputs;
+  std::vector<bool> m_dirty;
+  bool m_initialized;
+  Evaluator m_eval;
+  unsigned long m_total_recomputed;
+
+  // no value semantics
+  RecomputeEngine(const RecomputeEngine &);
+  RecomputeEngine &operator=(const RecomputeEngine &);
+
+public:
+  // Takes ownership of the AST_STATEMENT_LIST node.
+  // Throws SemanticError if a variable is assigned more than once,
+  // or if statements depend on each other circularly.
+  RecomputeEngine(Node *script_to_adopt);
+  ~RecomputeEngine();
+
+  unsigned get_num_statements() const { return unsigned(m_stmts.size()); }
+  const SymbolTable &get_symtab() const { return m_symtab; }
+
+  bool is_input(const std::string &name) const;
+
+  // Set the value of an input variable.
+  // Throws RuntimeError if the variable isn't an input.
+  void set_input(const std::string &name, int64_t value);
+
+  // Re-evaluate the statements affected by input changes since the
+  // previous update (the first update evaluates every statement).
+  // Returns the number of statements that were evaluated.  If a
+  // statement can't be evaluated (e.g., it divides by zero), its
+  // variable keeps its previous value, the other statements are
+  // still updated, and then the first such error is rethrown.
+  unsigned update();
+
+  // Total number of statement evaluations over all updates
+  unsigned long get_total_recomputed() const { return m_total_recomputed; }
+
+  // Get the current value of a variable
+  int64_t get_value(const std::string &name) const;
+
+private:
+  void build(const std::vector<const Node *> &assigns);
+};
+
+#endif // RECOMPUTE_H
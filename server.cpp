@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "exceptions.h"
+#include "lexer.h"
+#include "parser.h"
+#include "parser2.h"
+#include "ast.h"
+#include "buildast.h"
+#include "outbuf.h"
+#include "astwire.h"
+#include "treeemit.h"
+#include "unparse.h"
+#include "server.h"
+
+namespace {
+
+// A connection stops reading requests while it has this many
+// response bytes waiting to be sent, so that a client that sends
+// requests without reading responses can't make the server's
+// memory use grow without bound
+const size_t MAX_PENDING_OUTPUT = 4 << 20;
+
+const size_t READ_CHUNK = 65536;
+
+volatile sig_atomic_t g_stop;
+
+void handle_stop_signal(int) {
+  g_stop = 1;
+}
+
+void put_u32(std::string &s, uint32_t val) {
+  for (unsigned i = 0; i < 4; i++) {
+    s.push_back(char(val >> (8*i)));
+  }
+}
+
+uint32_t get_u32(const char *p) {
+  uint32_t val = 0;
+  for (unsigned i = 0; i < 4; i++) {
+    val |= uint32_t(static_cast<unsigned char>(p[i])) << (8*i);
+  }
+  return val;
+}
+
+// Nesting depth of an expression, as far as the parsers' recursion
+// is concerned: the depth of parentheses, plus (if count_operators)
+// the number of operators so far in each enclosing operator chain
+unsigned nesting_depth(const char *src, size_t len, bool count_operators) {
+  std::vector<unsigned> chain_ops(1, 0);  // for each open chain, innermost last
+  unsigned depth = 0, max_depth = 0;
+  for (size_t i = 0; i < len; i++) {
+    switch (src[i]) {
+    case '(':
+      depth++;
+      chain_ops.push_back(0);
+      break;
+    case ')':
+      if (chain_ops.size() > 1) {
+        depth -= chain_ops.back() + 1;
+        chain_ops.pop_back();
+      }
+      break;
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+      if (count_operators) {
+        depth++;
+        chain_ops.back()++;
+      }
+      break;
+    default:
+      continue;
+    }
+    max_depth = std::max(max_depth, depth);
+  }
+  return max_depth;
+}
+
+// Sink appending to a string, which refuses to grow the string
+// beyond a maximum size
+class LimitedStringSink : public OutputSink {
+private:
+  std::string &m_str;
+  size_t m_max_size;
+
+public:
+  LimitedStringSink(std::string &str, size_t max_size)
+    : m_str(str)
+    , m_max_size(max_size) {
+  }
+
+  virtual void write(const char *data, size_t len) {
+    if (len > m_max_size - m_str.size()) {
+      RuntimeError::raise("Response is too large (more than %zu bytes)", m_max_size);
+    }
+    m_str.append(data, len);
+  }
+};
+
+void fill_address(struct sockaddr_un &addr, const std::string &path) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    RuntimeError::raise("Socket path '%s' is too long", path.c_str());
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+}
+
+}
+
+void check_server_request(char mode, char format) {
+  if (mode != 'p' && mode != 'b' && mode != '2') {
+    RuntimeError::raise("Unknown mode '%c'", mode);
+  }
+  switch (format) {
+  case SERVER_FORMAT_TEXT:
+  case SERVER_FORMAT_JSON:
+  case SERVER_FORMAT_SEXP:
+  case SERVER_FORMAT_WIRE:
+    break;
+  case SERVER_FORMAT_SOURCE:
+    if (mode == 'p') {
+      RuntimeError::raise("Format '%c' (source) needs an AST, so it can't be used with mode 'p'", format);
+    }
+    break;
+  default:
+    RuntimeError::raise("Unknown format '%c'", format);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// ServerConnection implementation
+////////////////////////////////////////////////////////////////////////
+
+// State of one client connection.  Everything used to handle requests
+// (buffers, tree printers, the wire encoder, and the parsers and
+// their lexers) is kept for the lifetime of the connection, and
+// reused by each request.
+class ServerConnection {
+public:
+  int fd;
+  std::string in;      // bytes received
+  size_t in_pos;       // start of unprocessed bytes in in
+  std::string out;     // response bytes
+  size_t out_pos;      // start of unsent bytes in out
+  bool eof;            // client has shut down its side
+  uint32_t events;     // events the connection is registered for
+
+private:
+  std::string m_result;
+  LimitedStringSink m_result_sink;
+  OutputBuffer m_result_buf;
+  ASTWireEncoder m_encoder;
+  ParserTreePrint m_parse_tp;
+  ASTTreePrint m_ast_tp;
+  Parser m_parser;
+  Parser2 m_parser2;
+
+  // no value semantics
+  ServerConnection(const ServerConnection &);
+  ServerConnection &operator=(const ServerConnection &);
+
+public:
+  ServerConnection(int fd_)
+    : fd(fd_)
+    , in_pos(0)
+    , out_pos(0)
+    , eof(false)
+    , events(0)
+    , m_result_sink(m_result, SERVER_MAX_FRAME - 1)
+    , m_result_buf(m_result_sink)
+    , m_encoder(m_result_buf)
+    , m_parser(new Lexer())
+    , m_parser2(new Lexer()) {
+  }
+
+  size_t get_pending_output() const { return out.size() - out_pos; }
+
+  // Handle all completely received requests (while there isn't too
+  // much pending output), returning the number handled.  Throws
+  // RuntimeError if the client sent an invalid frame.
+  unsigned process_requests();
+
+private:
+  void handle_request(const char *body, size_t len);
+  Node *parse(char mode, const char *src, size_t len);
+  void render(Node *t, char mode, char format);
+};
+
+unsigned ServerConnection::process_requests() {
+  unsigned count = 0;
+  while (get_pending_output() < MAX_PENDING_OUTPUT
+         && in.size() - in_pos >= SERVER_FRAME_HEADER) {
+    size_t len = get_u32(in.data() + in_pos);
+    if (len > SERVER_MAX_FRAME) {
+      RuntimeError::raise("Request of %zu bytes is too large", len);
+    }
+    if (in.size() - in_pos - SERVER_FRAME_HEADER < len) {
+      break;
+    }
+    handle_request(in.data() + in_pos + SERVER_FRAME_HEADER, len);
+    in_pos += SERVER_FRAME_HEADER + len;
+    count++;
+  }
+
+  // discard processed input once it's most of the buffer
+  if (in_pos > 0 && in_pos >= in.size() / 2) {
+    in.erase(0, in_pos);
+    in_pos = 0;
+  }
+  return count;
+}
+
+void ServerConnection::handle_request(const char *body, size_t len) {
+  unsigned char status = SERVER_STATUS_OK;
+  m_result.clear();
+  try {
+    if (len < 2) {
+      RuntimeError::raise("Request is missing its mode and format");
+    }
+    check_server_request(body[0], body[1]);
+    std::unique_ptr<Node> t(parse(body[0], body + 2, len - 2));
+    render(t.get(), body[0], body[1]);
+    m_result_buf.flush();
+  } catch (BaseException &ex) {
+    // discard any partial output
+    m_result_buf.discard();
+    m_result.clear();
+    status = SERVER_STATUS_ERROR;
+    if (ex.has_location()) {
+      m_result = std::to_string(ex.get_loc().get_line()) + ":"
+        + std::to_string(ex.get_loc().get_col()) + ": ";
+    }
+    m_result += ex.what();
+  }
+
+  put_u32(out, uint32_t(1 + m_result.size()));
+  out.push_back(char(status));
+  out.append(m_result);
+}
+
+Node *ServerConnection::parse(char mode, const char *src, size_t len) {
+  if (nesting_depth(src, len, mode != '2') > SERVER_MAX_NESTING) {
+    RuntimeError::raise("Expression is nested too deeply (more than %u levels)", SERVER_MAX_NESTING);
+  }
+
+  if (mode == '2') {
+    m_parser2.reset(src, len, "<request>");
+    return m_parser2.parse();
+  }
+
+  m_parser.reset(src, len, "<request>");
+  std::unique_ptr<Node> parse_tree(m_parser.parse());
+  return mode == 'b' ? buildast(parse_tree.get()) : parse_tree.release();
+}
+
+void ServerConnection::render(Node *t, char mode, char format) {
+  const TreePrint &tp = mode == 'p'
+    ? static_cast<const TreePrint &>(m_parse_tp)
+    : static_cast<const TreePrint &>(m_ast_tp);
+
+  switch (format) {
+  case SERVER_FORMAT_TEXT:
+    tp.print(t, m_result_buf);
+    break;
+  case SERVER_FORMAT_JSON:
+    emit_json(t, tp, m_result_buf);
+    break;
+  case SERVER_FORMAT_SEXP:
+    emit_sexp(t, tp, m_result_buf);
+    break;
+  case SERVER_FORMAT_SOURCE:
+    unparse(t, m_result_buf);
+    break;
+  case SERVER_FORMAT_WIRE:
+    m_encoder.encode(t);
+    break;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// ASTServer implementation
+////////////////////////////////////////////////////////////////////////
+
+ASTServer::ASTServer(const std::string &path)
+  : m_path(path)
+  , m_listen_fd(-1)
+  , m_epoll_fd(-1)
+  , m_num_requests(0) {
+  struct sockaddr_un addr;
+  fill_address(addr, path);
+
+  m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (m_listen_fd < 0) {
+    RuntimeError::raise("Could not create socket: %s", strerror(errno));
+  }
+
+  // remove a socket file left by a previous server (but not
+  // any other kind of file)
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  if (bind(m_listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0
+      || listen(m_listen_fd, SOMAXCONN) != 0) {
+    int err = errno;
+    close(m_listen_fd);
+    RuntimeError::raise("Could not listen on '%s': %s", path.c_str(), strerror(err));
+  }
+
+  m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = m_listen_fd;
+  if (m_epoll_fd < 0 || epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &ev) != 0) {
+    int err = errno;
+    if (m_epoll_fd >= 0) {
+      close(m_epoll_fd);
+    }
+    close(m_listen_fd);
+    unlink(path.c_str());
+    RuntimeError::raise("Could not set up epoll: %s", strerror(err));
+  }
+}
+
+ASTServer::~ASTServer() {
+  for (int fd = 0; fd < int(m_conns.size()); fd++) {
+    if (m_conns[fd]) {
+      close(fd);
+    }
+  }
+  close(m_epoll_fd);
+  close(m_listen_fd);
+  unlink(m_path.c_str());
+}
+
+void ASTServer::run() {
+  // SIGINT and SIGTERM are blocked except while waiting for events,
+  // so a signal can't arrive between checking g_stop and waiting
+  struct sigaction sa, old_int, old_term;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_stop_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, &old_int);
+  sigaction(SIGTERM, &sa, &old_term);
+
+  sigset_t stop_signals, wait_mask;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, &wait_mask);
+  sigdelset(&wait_mask, SIGINT);
+  sigdelset(&wait_mask, SIGTERM);
+
+  g_stop = 0;
+  const int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+  while (!g_stop) {
+    int n = epoll_pwait(m_epoll_fd, events, MAX_EVENTS, -1, &wait_mask);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      RuntimeError::raise("epoll_wait failed: %s", strerror(errno));
+    }
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.fd == m_listen_fd) {
+        accept_connections();
+      } else {
+        handle_event(events[i].data.fd, events[i].events);
+      }
+    }
+  }
+
+  pthread_sigmask(SIG_UNBLOCK, &stop_signals, nullptr);
+  sigaction(SIGINT, &old_int, nullptr);
+  sigaction(SIGTERM, &old_term, nullptr);
+}
+
+void ASTServer::accept_connections() {
+  for (;;) {
+    int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      // EAGAIN when there are no more connections; other errors
+      // (such as running out of file descriptors) are not fatal
+      return;
+    }
+
+    if (size_t(fd) >= m_conns.size()) {
+      m_conns.resize(size_t(fd) + 1);
+    }
+    m_conns[fd].reset(new ServerConnection(fd));
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close_connection(fd);
+      continue;
+    }
+    m_conns[fd]->events = EPOLLIN;
+  }
+}
+
+void ASTServer::handle_event(int fd, uint32_t events) {
+  ServerConnection *conn = m_conns[fd].get();
+  if (!conn) {
+    return;
+  }
+
+  try {
+    // read as much as is available, unless too much output is
+    // waiting to be sent
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->eof) {
+      char buf[READ_CHUNK];
+      while (conn->get_pending_output() < MAX_PENDING_OUTPUT) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+          conn->in.append(buf, size_t(n));
+          m_num_requests += conn->process_requests();
+          continue;
+        }
+        if (n == 0) {
+          conn->eof = true;
+        } else if (errno == EINTR) {
+          continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          close_connection(fd);
+          return;
+        }
+        break;
+      }
+    }
+
+    // send responses; once output has drained, resume processing
+    // requests that were held back
+    for (;;) {
+      while (conn->get_pending_output() > 0) {
+        ssize_t n = send(fd, conn->out.data() + conn->out_pos, conn->get_pending_output(),
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            close_connection(fd);
+            return;
+          }
+          break;
+        }
+        conn->out_pos += size_t(n);
+      }
+      if (conn->get_pending_output() > 0) {
+        break;
+      }
+      conn->out.clear();
+      conn->out_pos = 0;
+      unsigned count = conn->process_requests();
+      if (count == 0) {
+        break;
+      }
+      m_num_requests += count;
+    }
+  } catch (RuntimeError &) {
+    // invalid frame from the client
+    close_connection(fd);
+    return;
+  }
+
+  if (conn->eof && conn->get_pending_output() == 0) {
+    close_connection(fd);
+    return;
+  }
+  update_events(conn);
+}
+
+void ASTServer::update_events(ServerConnection *conn) {
+  uint32_t events = 0;
+  size_t pending = conn->get_pending_output();
+  if (!conn->eof && pending < MAX_PENDING_OUTPUT) {
+    events |= EPOLLIN;
+  }
+  if (pending > 0) {
+    events |= EPOLLOUT;
+  }
+  if (events != conn->events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = conn->fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) != 0) {
+      close_connection(conn->fd);
+      return;
+    }
+    conn->events = events;
+  }
+}
+
+void ASTServer::close_connection(int fd) {
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  m_conns[fd].reset();
+}
+
+////////////////////////////////////////////////////////////////////////
+// ASTClient implementation
+////////////////////////////////////////////////////////////////////////
+
+ASTClient::ASTClient(const std::string &path)
+  : m_fd(-1) {
+  struct sockaddr_un addr;
+  fill_address(addr, path);
+
+  m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (m_fd < 0) {
+    RuntimeError::raise("Could not create socket: %s", strerror(errno));
+  }
+  if (connect(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+    int err = errno;
+    close(m_fd);
+    RuntimeError::raise("Could not connect to '%s': %s", path.c_str(), strerror(err));
+  }
+}
+
+ASTClient::~ASTClient() {
+  close(m_fd);
+}
+
+void ASTClient::send_request(char mode, char format, const std::string &src) {
+  std::string frame;
+  frame.reserve(SERVER_FRAME_HEADER + 2 + src.size());
+  put_u32(frame, uint32_t(2 + src.size()));
+  frame.push_back(mode);
+  frame.push_back(format);
+  frame.append(src);
+
+  size_t pos = 0;
+  while (pos < frame.size()) {
+    ssize_t n = send(m_fd, frame.data() + pos, frame.size() - pos, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      RuntimeError::raise("Could not send request: %s", strerror(errno));
+    }
+    pos += size_t(n);
+  }
+}
+
+unsigned char ASTClient::receive_response(std::string &payload) {
+  size_t len = 0;
+  for (;;) {
+    if (m_in.size() >= SERVER_FRAME_HEADER) {
+      len = get_u32(m_in.data());
+      if (len < 1 || len > SERVER_MAX_FRAME) {
+        RuntimeError::raise("Invalid response frame from server");
+      }
+      if (m_in.size() - SERVER_FRAME_HEADER >= len) {
+        break;
+      }
+    }
+
+    char buf[READ_CHUNK];
+    ssize_t n = read(m_fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      RuntimeError::raise("Could not receive response: %s", strerror(errno));
+    }
+    if (n == 0) {
+      RuntimeError::raise("Server closed the connection");
+    }
+    m_in.append(buf, size_t(n));
+  }
+
+  unsigned char status = static_cast<unsigned char>(m_in[SERVER_FRAME_HEADER]);
+  payload.assign(m_in, SERVER_FRAME_HEADER + 1, len - 1);
+  m_in.erase(0, SERVER_FRAME_HEADER + len);
+  return status;
+}
@@ -0,0 +1,128 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Long-running server that parses expressions on request, so that
+// clients avoid the cost of starting a process for each (typically
+// small) input.  The server listens on a Unix domain socket and
+// handles all connections in one thread with epoll.
+//
+// Requests and responses are frames:
+//
+//   frame    := length body        (length: 4 bytes, little-endian)
+//   request  := mode format source
+//   response := status payload
+//
+// where mode is 'p' (parse tree), 'b' (AST built from the parse tree)
+// or '2' (AST built by Parser2), and format is one of the SERVER_FORMAT
+// characters below.  The response status is 0 on success, in which case
+// the payload is the rendered tree, or 1 if the request failed, in
+// which case the payload is the error message.  A client may send
+// several requests without waiting for responses; responses are sent
+// in the order of the requests.
+//
+// Trees in the wire format ('w') are encoded with an ASTWireEncoder
+// kept for the connection (see astwire.h), so a client must decode
+// them with a single ASTWireDecoder per connection, in order.
+
+const char SERVER_FORMAT_TEXT = 't';  // as printed by TreePrint
+const char SERVER_FORMAT_JSON = 'j';
+const char SERVER_FORMAT_SEXP = 's';
+const char SERVER_FORMAT_SOURCE = 'u'; // unparsed (ASTs only)
+const char SERVER_FORMAT_WIRE = 'w';
+
+const unsigned char SERVER_STATUS_OK = 0;
+const unsigned char SERVER_STATUS_ERROR = 1;
+
+// Largest frame body accepted (a connection sending a larger
+// frame is closed).  A request whose response would be larger
+// fails instead.
+const size_t SERVER_MAX_FRAME = 64 << 20;
+
+// Size of a frame's length field
+const size_t SERVER_FRAME_HEADER = 4;
+
+// Deepest nesting accepted in a request's source.  The parsers
+// recurse once per level of parentheses, and Parser (modes 'p' and
+// 'b') also once per operator of the enclosing operator chains, so
+// those count as levels too.  A deeper request fails without being
+// parsed, rather than overflowing the server's stack.
+const unsigned SERVER_MAX_NESTING = 10000;
+
+// Check that a request's mode and format are known and can be used
+// together (the source format needs an AST, so it can't be used with
+// mode 'p'), throwing RuntimeError if not
+void check_server_request(char mode, char format);
+
+class ServerConnection;
+
+class ASTServer {
+private:
+  std::string m_path;
+  int m_listen_fd;
+  int m_epoll_fd;
+  std::vector<std::unique_ptr<ServerConnection>> m_conns; // indexed by fd
+  uint64_t m_num_requests;
+
+  // no value semantics
+  ASTServer(const ASTServer &);
+  ASTServer &operator=(const ASTServer &);
+
+public:
+  // Create the socket (replacing a socket file left at path by a
+  // previous server), throwing RuntimeError on failure
+  ASTServer(const std::string &path);
+
+  // Closes all connections and removes the socket file
+  ~ASTServer();
+
+  // Serve requests until SIGINT or SIGTERM is received
+  void run();
+
+  uint64_t get_num_requests() const { return m_num_requests; }
+
+private:
+  void accept_connections();
+  void handle_event(int fd, uint32_t events);
+  void update_events(ServerConnection *conn);
+  void close_connection(int fd);
+};
+
+// Client side of the protocol, using a blocking socket
+class ASTClient {
+private:
+  int m_fd;
+  std::string m_in;
+
+  // no value semantics
+  ASTClient(const ASTClient &);
+  ASTClient &operator=(const ASTClient &);
+
+public:
+  // Connect to a server, throwing RuntimeError on failure
+  ASTClient(const std::string &path);
+  ~ASTClient();
+
+  // Send a request (without waiting for the response).  This blocks
+  // while the server isn't reading, which it stops doing while it has
+  // a lot of unsent output, so a client sending many requests ahead
+  // must not let unreceived responses pile up without bound.
+  void send_request(char mode, char format, const std::string &src);
+
+  // Receive the next response, returning its status, and storing
+  // its payload in given string
+  unsigned char receive_response(std::string &payload);
+
+  // Send a request and receive its response
+  unsigned char request(char mode, char format, const std::string &src, std::string &payload) {
+    send_request(mode, format, src);
+    return receive_response(payload);
+  }
+};
+
+#endif // SERVER_H
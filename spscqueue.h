@@ -0,0 +1,115 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one
+// consumer thread.  The capacity is rounded up to a power of two.
+//
+// The producer owns m_tail and the consumer owns m_head: each only
+// reads the other's index, so no read-modify-write operations are
+// needed.  An element is published by the release store of m_tail
+// that follows writing it, and its slot is handed back by the release
+// store of m_head that follows reading it.  Each side also caches the
+// last value it saw of the other side's index, so it only touches the
+// other side's cache line when the queue looks full (or empty).
+template<typename T>
+class SPSCQueue {
+private:
+  static const size_t CACHE_LINE = 64;
+
+  std::vector<T> m_slots;
+  size_t m_mask;
+
+  alignas(CACHE_LINE) std::atomic<size_t> m_head; // next slot to pop
+  size_t m_cached_tail;                           // consumer's view of m_tail
+
+  alignas(CACHE_LINE) std::atomic<size_t> m_tail; // next slot to push
+  size_t m_cached_head;                           // producer's view of m_head
+
+  // no value semantics
+  SPSCQueue(const SPSCQueue &);
+  SPSCQueue &operator=(const SPSCQueue &);
+
+public:
+  SPSCQueue(size_t capacity)
+    : m_head(0)
+    , m_cached_tail(0)
+    , m_tail(0)
+    , m_cached_head(0) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    m_slots.resize(size);
+    m_mask = size - 1;
+  }
+
+  size_t get_capacity() const { return m_slots.size(); }
+
+  // Producer: add an element, returning false if the queue is full
+  // (in which case val is left unchanged)
+  bool try_push(T &val) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_cached_head == m_slots.size()) {
+      m_cached_head = m_head.load(std::memory_order_acquire);
+      if (tail - m_cached_head == m_slots.size()) {
+        return false;
+      }
+    }
+    m_slots[tail & m_mask] = std::move(val);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer: remove the oldest element, returning false if the
+  // queue is empty
+  bool try_pop(T &val) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_cached_tail) {
+      m_cached_tail = m_tail.load(std::memory_order_acquire);
+      if (head == m_cached_tail) {
+        return false;
+      }
+    }
+    val = std::move(m_slots[head & m_mask]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Blocking versions: wait (spinning briefly, then yielding the
+  // processor) until the operation succeeds or stop becomes true.
+  // Return false if stopped.
+  bool push(T &val, const std::atomic<bool> &stop) {
+    for (unsigned spins = 0; !try_push(val); spins++) {
+      if (stop.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      backoff(spins);
+    }
+    return true;
+  }
+
+  bool pop(T &val, const std::atomic<bool> &stop) {
+    for (unsigned spins = 0; !try_pop(val); spins++) {
+      if (stop.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      backoff(spins);
+    }
+    return true;
+  }
+
+private:
+  static void backoff(unsigned spins) {
+    if (spins >= 64) {
+      std::this_thread::yield();
+    }
+  }
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,204 @@
+#include <ctime>
+#include <sys/resource.h>
+#include "stats.h"
+
+namespace {
+
+double clock_secs(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return double(ts.tv_sec) + double(ts.tv_nsec)/1e9;
+}
+
+const char *PHASE_NAMES[] = { "lex", "parse", "buildast", "output", "destroy" };
+
+}
+
+RunStats::RunStats()
+  : bytes_read(0)
+  , tokens(0)
+  , parse_nodes(0)
+  , ast_nodes(0)
+  , max_depth(0) {
+  for (unsigned i = 0; i < NUM_PHASES; i++) {
+    m_phases[i] = PhaseTimes();
+  }
+}
+
+RunStats::~RunStats() {
+}
+
+void RunStats::enable_perf_counters() {
+  m_perf.reset(new PerfCounters());
+}
+
+void RunStats::begin_phase(Phase phase) {
+  PhaseTimes &p = m_phases[phase];
+  p.used = true;
+  if (m_perf) {
+    m_perf->read(p.counts_start);
+  }
+  p.wall_start = clock_secs(CLOCK_MONOTONIC);
+  p.cpu_start = clock_secs(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void RunStats::end_phase(Phase phase) {
+  PhaseTimes &p = m_phases[phase];
+  p.wall += clock_secs(CLOCK_MONOTONIC) - p.wall_start;
+  p.cpu += clock_secs(CLOCK_PROCESS_CPUTIME_ID) - p.cpu_start;
+  if (m_perf) {
+    uint64_t counts[PerfCounters::NUM_EVENTS];
+    m_perf->read(counts);
+    for (unsigned i = 0; i < PerfCounters::NUM_EVENTS; i++) {
+      p.counts[i] += counts[i] - p.counts_start[i];
+    }
+  }
+}
+
+const char *RunStats::get_phase_name(Phase phase) {
+  return PHASE_NAMES[phase];
+}
+
+uint64_t RunStats::get_peak_rss_kb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // ru_maxrss is in KiB on Linux
+  return uint64_t(usage.ru_maxrss);
+}
+
+void RunStats::print(FILE *out) const {
+  double total_wall = 0.0, total_cpu = 0.0;
+  fprintf(out, "%-10s %12s %12s\n", "phase", "wall ms", "cpu ms");
+  for (unsigned i = 0; i < NUM_PHASES; i++) {
+    const PhaseTimes &p = m_phases[i];
+    if (p.used) {
+      fprintf(out, "%-10s %12.3f %12.3f\n", PHASE_NAMES[i], p.wall*1e3, p.cpu*1e3);
+      total_wall += p.wall;
+      total_cpu += p.cpu;
+    }
+  }
+  fprintf(out, "%-10s %12.3f %12.3f\n", "total", total_wall*1e3, total_cpu*1e3);
+  fprintf(out, "bytes read:     %llu\n", (unsigned long long) bytes_read);
+  fprintf(out, "tokens:         %llu\n", (unsigned long long) tokens);
+  fprintf(out, "parse nodes:    %llu\n", (unsigned long long) parse_nodes);
+  fprintf(out, "AST nodes:      %llu\n", (unsigned long long) ast_nodes);
+  fprintf(out, "max depth:      %llu\n", (unsigned long long) max_depth);
+  fprintf(out, "peak RSS (KiB): %llu\n", (unsigned long long) get_peak_rss_kb());
+
+  if (!m_perf) {
+    return;
+  }
+  if (!m_perf->any_available()) {
+    fprintf(out, "performance counters: not available\n");
+    return;
+  }
+
+  // counts per phase, then per item: events that couldn't
+  // be counted are shown as "-"
+  auto print_value = [&](PerfCounters::Event e, double val, const char *format) {
+    if (m_perf->is_available(e)) {
+      fprintf(out, format, val);
+    } else {
+      fprintf(out, " %14s", "-");
+    }
+  };
+
+  fprintf(out, "\n%-10s", "phase");
+  for (unsigned e = 0; e < PerfCounters::NUM_EVENTS; e++) {
+    fprintf(out, " %14s", PerfCounters::get_event_name(PerfCounters::Event(e)));
+  }
+  fprintf(out, " %6s\n", "IPC");
+  for (unsigned i = 0; i < NUM_PHASES; i++) {
+    const PhaseTimes &p = m_phases[i];
+    if (!p.used) {
+      continue;
+    }
+    fprintf(out, "%-10s", PHASE_NAMES[i]);
+    for (unsigned e = 0; e < PerfCounters::NUM_EVENTS; e++) {
+      print_value(PerfCounters::Event(e), double(p.counts[e]), " %14.0f");
+    }
+    if (m_perf->is_available(PerfCounters::CYCLES) && m_perf->is_available(PerfCounters::INSTRUCTIONS)
+        && p.counts[PerfCounters::CYCLES] > 0) {
+      fprintf(out, " %6.2f", double(p.counts[PerfCounters::INSTRUCTIONS]) / double(p.counts[PerfCounters::CYCLES]));
+    } else {
+      fprintf(out, " %6s", "-");
+    }
+    fputc('\n', out);
+  }
+
+  fprintf(out, "\n%-10s %-6s", "per item", "unit");
+  for (unsigned e = 0; e < PerfCounters::NUM_EVENTS; e++) {
+    fprintf(out, " %14s", PerfCounters::get_event_name(PerfCounters::Event(e)));
+  }
+  fputc('\n', out);
+  for (unsigned i = 0; i < NUM_PHASES; i++) {
+    const PhaseTimes &p = m_phases[i];
+    const char *unit;
+    uint64_t items = get_phase_items(Phase(i), unit);
+    if (!p.used || items == 0) {
+      continue;
+    }
+    fprintf(out, "%-10s %-6s", PHASE_NAMES[i], unit);
+    for (unsigned e = 0; e < PerfCounters::NUM_EVENTS; e++) {
+      print_value(PerfCounters::Event(e), double(p.counts[e]) / double(items), " %14.3f");
+    }
+    fputc('\n', out);
+  }
+}
+
+void RunStats::write_json(FILE *out) const {
+  fputs("{\"phases\":{", out);
+  bool first = true;
+  for (unsigned i = 0; i < NUM_PHASES; i++) {
+    const PhaseTimes &p = m_phases[i];
+    if (!p.used) {
+      continue;
+    }
+    fprintf(out, "%s\"%s\":{\"wall_s\":%.9g,\"cpu_s\":%.9g", first ? "" : ",", PHASE_NAMES[i], p.wall, p.cpu);
+    first = false;
+    const char *unit;
+    uint64_t items = get_phase_items(Phase(i), unit);
+    fprintf(out, ",\"items\":%llu,\"unit\":\"%s\"", (unsigned long long) items, unit);
+    if (m_perf) {
+      // unavailable counters are null
+      fputs(",\"counters\":{", out);
+      for (unsigned e = 0; e < PerfCounters::NUM_EVENTS; e++) {
+        fprintf(out, "%s\"%s\":", e > 0 ? "," : "", PerfCounters::get_event_name(PerfCounters::Event(e)));
+        if (m_perf->is_available(PerfCounters::Event(e))) {
+          fprintf(out, "%llu", (unsigned long long) p.counts[e]);
+        } else {
+          fputs("null", out);
+        }
+      }
+      fputc('}', out);
+    }
+    fputc('}', out);
+  }
+  fprintf(out, "},\"bytes_read\":%llu,\"tokens\":%llu,\"parse_nodes\":%llu,\"ast_nodes\":%llu"
+          ",\"max_depth\":%llu,\"peak_rss_kb\":%llu}\n",
+          (unsigned long long) bytes_read, (unsigned long long) tokens,
+          (unsigned long long) parse_nodes, (unsigned long long) ast_nodes,
+          (unsigned long long) max_depth, (unsigned long long) get_peak_rss_kb());
+}
+
+uint64_t RunStats::get_phase_items(Phase phase, const char *&unit) const {
+  unit = "node";
+  switch (phase) {
+  case PHASE_LEX:
+    unit = "token";
+    return tokens;
+  case PHASE_PARSE:
+    // Parser2 builds the AST directly
+    return parse_nodes > 0 ? parse_nodes : ast_nodes;
+  case PHASE_BUILDAST:
+    return ast_nodes;
+  case PHASE_OUTPUT:
+    return ast_nodes > 0 ? ast_nodes : parse_nodes;
+  case PHASE_DESTROY:
+    return parse_nodes + ast_nodes;
+  default:
+    return 0;
+  }
+}
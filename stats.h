@@ -0,0 +1,106 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include "perfcount.h"
+
+// Statistics for a run of the program: wall clock and CPU time
+// for each phase, and counts of what was processed.  Collecting
+// statistics is optional: code that does so takes a RunStats
+// pointer, which is null when statistics are disabled, so the cost
+// is one test per phase (not per token or per node.)
+//
+// Optionally, hardware performance counters (see perfcount.h) are
+// also read at the start and end of each phase, and reported per
+// phase and per item processed (token or node).
+class RunStats {
+public:
+  enum Phase {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_BUILDAST,
+    PHASE_OUTPUT,
+    PHASE_DESTROY,
+    NUM_PHASES,
+  };
+
+  // counters (left at 0 if they don't apply to the run)
+  uint64_t bytes_read;
+  uint64_t tokens;
+  uint64_t parse_nodes;
+  uint64_t ast_nodes;
+  uint64_t max_depth;
+
+private:
+  struct PhaseTimes {
+    double wall, cpu;
+    double wall_start, cpu_start;
+    uint64_t counts[PerfCounters::NUM_EVENTS];
+    uint64_t counts_start[PerfCounters::NUM_EVENTS];
+    bool used;
+  };
+  PhaseTimes m_phases[NUM_PHASES];
+  std::unique_ptr<PerfCounters> m_perf;
+
+  // no value semantics
+  RunStats(const RunStats &);
+  RunStats &operator=(const RunStats &);
+
+public:
+  RunStats();
+  ~RunStats();
+
+  // Start reading performance counters in each phase.  Phases must
+  // be run by the thread that called this.
+  void enable_perf_counters();
+
+  // Time spent between begin_phase and end_phase is added
+  // to the phase's total
+  void begin_phase(Phase phase);
+  void end_phase(Phase phase);
+
+  static const char *get_phase_name(Phase phase);
+
+  // Peak resident set size of the process so far, in KiB
+  static uint64_t get_peak_rss_kb();
+
+  // Print the statistics as a human-readable table (times in ms), or
+  // as a JSON object (times in seconds, in fields named wall_s and cpu_s)
+  void print(FILE *out) const;
+  void write_json(FILE *out) const;
+
+private:
+  // Number of items (tokens or nodes) processed in a phase
+  uint64_t get_phase_items(Phase phase, const char *&unit) const;
+};
+
+// Times a phase for the lifetime of the object,
+// if stats is not null
+class PhaseTimer {
+private:
+  RunStats *m_stats;
+  RunStats::Phase m_phase;
+
+  // no value semantics
+  PhaseTimer(const PhaseTimer &);
+  PhaseTimer &operator=(const PhaseTimer &);
+
+public:
+  PhaseTimer(RunStats *stats, RunStats::Phase phase)
+    : m_stats(stats), m_phase(phase) {
+    if (m_stats) {
+      m_stats->begin_phase(m_phase);
+    }
+  }
+
+  ~PhaseTimer() {
+    if (m_stats) {
+      m_stats->end_phase(m_phase);
+    }
+  }
+};
+
+#endif // STATS_H
@@ -0,0 +1,43 @@
+#include "ast.h"
+#include "symtab.h"
+
+SymbolTable::SymbolTable() {
+}
+
+SymbolTable::~SymbolTable() {
+}
+
+int SymbolTable::intern(const std::string &name) {
+  auto i = m_slots.find(name);
+  if (i != m_slots.end()) {
+    return i->second;
+  }
+  int slot = int(m_names.size());
+  m_names.push_back(name);
+  m_slots[name] = slot;
+  return slot;
+}
+
+int SymbolTable::lookup(const std::string &name) const {
+  auto i = m_slots.find(name);
+  return i != m_slots.end() ? i->second : -1;
+}
+
+void bind_varrefs(Node *ast, SymbolTable &symtab) {
+  // use an explicit stack rather than Node::preorder, since
+  // ASTs for long operator chains can be very deep
+  std::vector<Node *> work;
+  work.push_back(ast);
+  while (!work.empty()) {
+    Node *n = work.back();
+    work.pop_back();
+    if (n->get_tag() == AST_VARREF) {
+      n->set_slot(symtab.intern(n->get_str()));
+    }
+    // push kids in reverse order, so that slots are assigned in
+    // order of first appearance in the source
+    for (unsigned i = n->get_num_kids(); i > 0; i--) {
+      work.push_back(n->get_kid(i - 1));
+    }
+  }
+}
@@ -0,0 +1,41 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "node.h"
+
+// Symbol table mapping variable names to dense slot indices
+// (0, 1, 2, ...), so that variable values can be stored in an array
+// and looked up during evaluation without any string operations.
+class SymbolTable {
+private:
+  std::unordered_map<std::string, int> m_slots;
+  std::vector<std::string> m_names;
+
+  // no value semantics
+  SymbolTable(const SymbolTable &);
+  SymbolTable &operator=(const SymbolTable &);
+
+public:
+  SymbolTable();
+  ~SymbolTable();
+
+  // Get the slot index of given variable name, assigning a new
+  // slot if the name hasn't been seen before
+  int intern(const std::string &name);
+
+  // Get the slot index of given variable name, or -1 if
+  // the name has not been interned
+  int lookup(const std::string &name) const;
+
+  unsigned get_num_slots() const { return unsigned(m_names.size()); }
+  const std::string &get_name(int slot) const { return m_names.at(slot); }
+};
+
+// Bind every AST_VARREF node in given AST to a slot index
+// in the symbol table (interning names as necessary.)
+void bind_varrefs(Node *ast, SymbolTable &symtab);
+
+#endif // SYMTAB_H
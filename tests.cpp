@@ -0,0 +1,482 @@
+// Regression tests for the library.  Each test is a function that
+// uses CHECK to verify its expectations; a failed check reports its
+// location and condition and ends the test.  Exits with status 1 if
+// any test failed.
+//
+// Usage: runtests [name...]   (run only tests whose name contains
+//                              one of the given strings)
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <pthread.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "exceptions.h"
+#include "lexer.h"
+#include "parser.h"
+#include "parser2.h"
+#include "recompute.h"
+#include "exprcache.h"
+#include "symtab.h"
+#include "batcheval.h"
+#include "batchplan.h"
+#include "treeutil.h"
+#include "outbuf.h"
+#include "astwire.h"
+#include "server.h"
+
+namespace {
+
+class CheckFailure {
+public:
+  std::string msg;
+  CheckFailure(const std::string &msg_) : msg(msg_) { }
+};
+
+void check_failed(const char *file, int line, const char *cond) {
+  throw CheckFailure(std::string(file) + ":" + std::to_string(line) + ": CHECK(" + cond + ") failed");
+}
+
+#define CHECK(cond) do { if (!(cond)) check_failed(__FILE__, __LINE__, #cond); } while (0)
+
+Node *parse_expr(const std::string &src) {
+  Parser2 parser(new Lexer(src.data(), src.size(), "<test>"));
+  return parser.parse();
+}
+
+Node *parse_script(const std::string &src) {
+  Parser2 parser(new Lexer(src.data(), src.size(), "<test>"));
+  return parser.parse_script();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Lexer
+////////////////////////////////////////////////////////////////////////
+
+// Integer literals are decoded by the lexer, which must reject those
+// larger than INT64_MAX (reporting the literal's location) with
+// either parser
+void test_lexer_int_range() {
+  std::string max = "9223372036854775807";
+  std::unique_ptr<Node> t(parse_expr(max));
+  CHECK(t->has_ival() && t->get_ival() == INT64_MAX);
+
+  const char *sources[] = {
+    "1 +\n  9223372036854775808",
+    "1 +\n  99999999999999999999",
+  };
+  for (const char *src : sources) {
+    for (int which = 0; which < 2; which++) {
+      Lexer *lexer = new Lexer(src, strlen(src), "<test>");
+      bool failed = false;
+      try {
+        std::unique_ptr<Node> result(which == 0 ? Parser(lexer).parse() : Parser2(lexer).parse());
+      } catch (SyntaxError &ex) {
+        failed = true;
+        CHECK(strstr(ex.what(), "out of range") != nullptr);
+        CHECK(ex.has_location());
+        CHECK(ex.get_loc().get_line() == 2 && ex.get_loc().get_col() == 3);
+      }
+      CHECK(failed);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// RecomputeEngine
+////////////////////////////////////////////////////////////////////////
+
+void test_recompute_basic() {
+  RecomputeEngine engine(parse_script("c = a + b; d = c * 2; e = b - 1;"));
+  CHECK(engine.update() == 3);
+  engine.set_input("a", 3);
+  CHECK(engine.update() == 2);
+  CHECK(engine.get_value("d") == 6);
+  CHECK(engine.get_value("e") == -1);
+
+  // an unchanged value stops propagation
+  engine.set_input("a", 3);
+  CHECK(engine.update() == 0);
+}
+
+// An evaluation error must not leave the statements still queued
+// for the update dirty (which would keep them from ever being
+// recomputed again)
+void test_recompute_error() {
+  RecomputeEngine engine(parse_script("c = a + b; d = c * 2; e = 10 / a; f = b; g = 7;"));
+  bool raised = false;
+  try {
+    engine.update();
+  } catch (EvaluationError &) {
+    raised = true;
+  }
+  CHECK(raised);
+  CHECK(engine.get_value("g") == 7);
+
+  engine.set_input("a", 2);
+  CHECK(engine.update() == 3);
+  CHECK(engine.get_value("d") == 4);
+  CHECK(engine.get_value("e") == 5);
+
+  engine.set_input("b", 5);
+  engine.update();
+  CHECK(engine.get_value("d") == 14);
+  CHECK(engine.get_value("f") == 5);
+
+  // the failing statement keeps its previous value
+  engine.set_input("a", 0);
+  raised = false;
+  try {
+    engine.update();
+  } catch (EvaluationError &) {
+    raised = true;
+  }
+  CHECK(raised);
+  CHECK(engine.get_value("e") == 5);
+  CHECK(engine.get_value("d") == 10);
+}
+
+////////////////////////////////////////////////////////////////////////
+// ExprCache
+////////////////////////////////////////////////////////////////////////
+
+void test_exprcache_counts() {
+  ExprCache cache(2);
+  std::shared_ptr<const Node> ab = cache.get("a+b");
+  CHECK(cache.get("a + b") == ab);  // same normalized text
+  cache.get("c * d");
+  ExprCache::Stats stats = cache.get_stats();
+  CHECK(stats.hits == 1 && stats.misses == 2 && stats.evictions == 0 && stats.entries == 2);
+
+  // a+b was used more recently than c*d, so c*d is evicted
+  cache.get("a+b");
+  cache.get("e");
+  stats = cache.get_stats();
+  CHECK(stats.hits == 2 && stats.misses == 3 && stats.evictions == 1 && stats.entries == 2);
+  CHECK(cache.get("a+b") == ab);
+  cache.get("c*d");
+  stats = cache.get_stats();
+  CHECK(stats.hits == 3 && stats.misses == 4 && stats.evictions == 2 && stats.entries == 2);
+
+  // an evicted tree stays valid while it is referenced
+  std::unique_ptr<Node> expected(parse_expr("a+b"));
+  cache.get("x");
+  cache.get("y");
+  CHECK(trees_equal(ab.get(), expected.get()));
+
+  // parse errors are not cached
+  bool raised = false;
+  try {
+    cache.get("a +");
+  } catch (SyntaxError &) {
+    raised = true;
+  }
+  CHECK(raised);
+  stats = cache.get_stats();
+  CHECK(stats.misses == 7 && stats.entries == 2);
+  CHECK(stats.bytes > 0);
+
+  cache.clear();
+  CHECK(cache.get_stats().entries == 0 && cache.get_stats().bytes == 0);
+}
+
+void test_exprcache_bytes() {
+  // with a byte limit, the most recent entry is always kept
+  ExprCache cache(100, 1);
+  cache.get("a+b");
+  cache.get("c");
+  ExprCache::Stats stats = cache.get_stats();
+  CHECK(stats.entries == 1 && stats.evictions == 1);
+}
+
+////////////////////////////////////////////////////////////////////////
+// BatchPlan
+////////////////////////////////////////////////////////////////////////
+
+// Plan results must be the same as eval_batch's, and shared
+// subexpressions (including reordered operands of * and +) must
+// become one step
+void test_batchplan() {
+  const char *srcs[] = { "(a*b) + c", "c + (b*a)", "a*b", "a*b - c/2", "7", "(a - b) * (a - b)" };
+  SymbolTable symtab;
+  std::vector<std::unique_ptr<Node>> asts;
+  std::vector<const Node *> exprs;
+  size_t tree_nodes = 0;
+  for (const char *src : srcs) {
+    Node *ast = parse_expr(src);
+    bind_varrefs(ast, symtab);
+    asts.push_back(std::unique_ptr<Node>(ast));
+    exprs.push_back(ast);
+    tree_nodes += count_nodes(ast);
+  }
+
+  const size_t NUM_ROWS = 1000;
+  std::vector<int64_t> values(NUM_ROWS * symtab.get_num_slots());
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = int64_t(i * 7919 % 2001) - 1000;
+  }
+  Dataset data = { values.data(), NUM_ROWS, symtab.get_num_slots() };
+
+  std::vector<int64_t> expected(exprs.size() * NUM_ROWS), results(expected.size());
+  WorkStealingPool pool(2);
+  eval_batch(exprs, data, expected.data(), pool);
+
+  BatchPlan plan(exprs);
+  plan.eval(data, results.data());
+  CHECK(results == expected);
+  std::fill(results.begin(), results.end(), 0);
+  plan.eval(data, results.data(), &pool);
+  CHECK(results == expected);
+
+  // steps: a, b, c, 2, 7, a*b, (a*b)+c, c/2, a*b - c/2, a-b, (a-b)*(a-b)
+  const BatchPlan::Report &report = plan.get_report();
+  CHECK(report.num_exprs == exprs.size());
+  CHECK(report.tree_nodes == tree_nodes);
+  CHECK(report.plan_steps == 11);
+  CHECK(report.work_eliminated() > 0.0);
+}
+
+////////////////////////////////////////////////////////////////////////
+// ASTWireEncoder/ASTWireDecoder
+////////////////////////////////////////////////////////////////////////
+
+// Sink that can be made to fail
+class FailingSink : public OutputSink {
+public:
+  std::string out;
+  bool fail;
+
+  FailingSink() : fail(false) { }
+
+  virtual void write(const char *data, size_t len) {
+    if (fail) {
+      RuntimeError::raise("Sink failed");
+    }
+    out.append(data, len);
+  }
+};
+
+// Strings sent in a frame that could not be written must not be
+// referred to by later frames
+void test_astwire_failed_write() {
+  FailingSink sink;
+  OutputBuffer buf(sink, 1);
+  ASTWireEncoder encoder(buf);
+  std::unique_ptr<Node> first(parse_expr("a + b")), second(parse_expr("b + c"));
+
+  encoder.encode(first.get());
+  buf.flush();
+  sink.fail = true;
+  bool failed = false;
+  try {
+    encoder.encode(second.get());
+  } catch (RuntimeError &) {
+    failed = true;
+  }
+  CHECK(failed);
+  buf.discard();
+  sink.fail = false;
+  encoder.encode(second.get());
+  buf.flush();
+
+  ASTWireDecoder decoder;
+  decoder.feed(sink.out.data(), sink.out.size());
+  std::unique_ptr<Node> first_out(decoder.next()), second_out(decoder.next());
+  CHECK(first_out && second_out);
+  CHECK(second_out->get_kid(0)->get_str() == "b");
+  CHECK(second_out->get_kid(1)->get_str() == "c");
+}
+
+// Decoded nodes must have the same locations as the encoded ones,
+// including whether they were set explicitly
+void test_astwire_locations() {
+  std::unique_ptr<Node> t(parse_expr("a + (b\n * c)"));
+  Node *implicit = new Node(2000, std::vector<Node *>{ parse_expr("d"), parse_expr("e") });
+  t->append_kid(implicit);
+
+  std::string out;
+  StringSink sink(out);
+  OutputBuffer buf(sink);
+  ASTWireEncoder encoder(buf);
+  encoder.encode(t.get());
+  buf.flush();
+  ASTWireDecoder decoder;
+  decoder.feed(out.data(), out.size());
+  std::unique_ptr<Node> decoded(decoder.next());
+  CHECK(decoded);
+
+  std::vector<const Node *> before, after;
+  t->preorder([&](Node *n) { before.push_back(n); });
+  decoded->preorder([&](Node *n) { after.push_back(n); });
+  CHECK(before.size() == after.size());
+  for (size_t i = 0; i < before.size(); i++) {
+    const Location &b = before[i]->get_loc(), &a = after[i]->get_loc();
+    CHECK(b.get_srcfile() == a.get_srcfile() && b.get_line() == a.get_line() && b.get_col() == a.get_col());
+    CHECK(before[i]->is_loc_explicit() == after[i]->is_loc_explicit());
+  }
+  CHECK(!implicit->is_loc_explicit() && t->get_kid(0)->is_loc_explicit());
+}
+
+// Tag bytes that no tag is encoded as must be rejected, rather than
+// decoded to invalid tags
+void test_astwire_invalid_tag() {
+  // a one-node tree: tag byte, info (no kids or flags), empty
+  // string, and line and column deltas
+  for (int tag_byte : { 0x40, 0xC0, 0xFE }) {
+    const char frame[] = { 5, char(tag_byte), 0, 0, 0, 0 };
+    ASTWireDecoder decoder;
+    decoder.feed(frame, sizeof(frame));
+    bool failed = false;
+    try {
+      std::unique_ptr<Node> t(decoder.next());
+      CHECK(t && t->get_tag() == 1000);
+    } catch (RuntimeError &ex) {
+      failed = true;
+      CHECK(strstr(ex.what(), "invalid tag byte") != nullptr);
+    }
+    CHECK(failed == (tag_byte != 0x40));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// ASTServer
+////////////////////////////////////////////////////////////////////////
+
+// Run a server in a thread, and call fn with a client connected to
+// it.  The server is stopped before any exception thrown by fn
+// (such as a failed check) is passed on.
+template<typename Fn>
+void with_server(Fn fn) {
+  std::string path = "/tmp/runtests-" + std::to_string(getpid()) + ".sock";
+  ASTServer server(path);
+  std::thread thread([&server]() { server.run(); });
+
+  std::exception_ptr error;
+  try {
+    ASTClient client(path);
+    fn(client);
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  // the server has installed its signal handler by the time it
+  // accepts the connection
+  pthread_kill(thread.native_handle(), SIGTERM);
+  thread.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+// Requests with an unknown mode or format, or with a format that
+// can't be used with their mode, must fail before being parsed
+void test_server_bad_request() {
+  with_server([&](ASTClient &client) {
+    std::string payload;
+    CHECK(client.request('x', SERVER_FORMAT_TEXT, "a", payload) == SERVER_STATUS_ERROR);
+    CHECK(client.request('2', 'x', "a", payload) == SERVER_STATUS_ERROR);
+    CHECK(client.request('p', SERVER_FORMAT_SOURCE, "(a", payload) == SERVER_STATUS_ERROR);
+    CHECK(payload.find("mode 'p'") != std::string::npos);
+    CHECK(client.request('b', SERVER_FORMAT_SOURCE, "a", payload) == SERVER_STATUS_OK);
+  });
+}
+
+// A request nested too deeply for the parsers' recursion must fail,
+// leaving the server running
+void test_server_nesting() {
+  std::string deep = std::string(200000, '(') + "a" + std::string(200000, ')');
+  std::string chain = "a";
+  for (unsigned i = 0; i <= SERVER_MAX_NESTING; i++) {
+    chain += "+a";
+  }
+
+  with_server([&](ASTClient &client) {
+    std::string payload;
+    CHECK(client.request('2', SERVER_FORMAT_SOURCE, deep, payload) == SERVER_STATUS_ERROR);
+    CHECK(client.request('p', SERVER_FORMAT_TEXT, chain, payload) == SERVER_STATUS_ERROR);
+    CHECK(client.request('2', SERVER_FORMAT_SOURCE, chain, payload) == SERVER_STATUS_OK);
+    CHECK(client.request('b', SERVER_FORMAT_SOURCE, "((a + b)) * c", payload) == SERVER_STATUS_OK);
+    CHECK(payload == "(a + b) * c");
+  });
+}
+
+// A response too large for a frame must fail, rather than being
+// rendered without bound
+void test_server_response_limit() {
+  // the text form of a long chain is indented once per operator,
+  // so it is far larger than SERVER_MAX_FRAME
+  std::string chain = "a";
+  for (unsigned i = 1; i < 10000; i++) {
+    chain += "+a";
+  }
+
+  with_server([&](ASTClient &client) {
+    std::string payload;
+    CHECK(client.request('2', SERVER_FORMAT_TEXT, chain, payload) == SERVER_STATUS_ERROR);
+    CHECK(payload.find("too large") != std::string::npos);
+    CHECK(client.request('2', SERVER_FORMAT_SOURCE, chain, payload) == SERVER_STATUS_OK);
+    CHECK(payload.size() == 4*9999 + 1);
+  });
+}
+
+struct Test {
+  const char *name;
+  void (*fn)();
+};
+
+const Test TESTS[] = {
+  { "lexer_int_range", test_lexer_int_range },
+  { "recompute_basic", test_recompute_basic },
+  { "recompute_error", test_recompute_error },
+  { "exprcache_counts", test_exprcache_counts },
+  { "exprcache_bytes", test_exprcache_bytes },
+  { "batchplan", test_batchplan },
+  { "astwire_failed_write", test_astwire_failed_write },
+  { "astwire_locations", test_astwire_locations },
+  { "astwire_invalid_tag", test_astwire_invalid_tag },
+  { "server_bad_request", test_server_bad_request },
+  { "server_nesting", test_server_nesting },
+  { "server_response_limit", test_server_response_limit },
+};
+
+bool selected(const char *name, int argc, char **argv) {
+  if (argc < 2) {
+    return true;
+  }
+  for (int i = 1; i < argc; i++) {
+    if (strstr(name, argv[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}
+
+int main(int argc, char **argv) {
+  unsigned num_run = 0, num_failed = 0;
+  for (const Test &test : TESTS) {
+    if (!selected(test.name, argc, argv)) {
+      continue;
+    }
+    num_run++;
+    try {
+      test.fn();
+      printf("ok      %s\n", test.name);
+    } catch (CheckFailure &ex) {
+      printf("FAILED  %s: %s\n", test.name, ex.msg.c_str());
+      num_failed++;
+    } catch (BaseException &ex) {
+      printf("FAILED  %s: unexpected exception: %s\n", test.name, ex.what());
+      num_failed++;
+    }
+  }
+  printf("%u tests, %u failed\n", num_run, num_failed);
+  return num_failed > 0 ? 1 : 0;
+}
@@ -13,6 +13,8 @@ enum TokenKind {
   TOK_DIVIDE,
   TOK_LPAREN,
   TOK_RPAREN,
+  TOK_ASSIGN,
+  TOK_SEMICOLON,
 };
 
 #endif // TOKEN_H
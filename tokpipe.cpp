@@ -0,0 +1,114 @@
+#include <cassert>
+#include "trace.h"
+#include "tokpipe.h"
+
+////////////////////////////////////////////////////////////////////////
+// TokenPipeline implementation
+////////////////////////////////////////////////////////////////////////
+
+TokenPipeline::TokenPipeline(Lexer *lexer_to_adopt, size_t batch_size, size_t num_batches)
+  : m_lexer(lexer_to_adopt)
+  , m_batch_size(batch_size > 0 ? batch_size : 1)
+  , m_full(num_batches)
+  , m_free(num_batches)
+  , m_stop(false)
+  , m_done(false) {
+  if (num_batches < 1) {
+    num_batches = 1;
+  }
+  for (size_t i = 0; i < num_batches; i++) {
+    Batch *batch = new Batch();
+    batch->tokens.reserve(m_batch_size);
+    m_batches.push_back(std::unique_ptr<Batch>(batch));
+    bool pushed = m_free.try_push(batch);
+    assert(pushed);
+    (void) pushed;
+  }
+  m_thread = std::thread(&TokenPipeline::produce, this);
+}
+
+TokenPipeline::~TokenPipeline() {
+  m_stop.store(true);
+  m_thread.join();
+
+  // tokens the consumer hasn't taken are still in their batches
+  for (auto i = m_batches.begin(); i != m_batches.end(); ++i) {
+    for (auto j = (*i)->tokens.begin(); j != (*i)->tokens.end(); ++j) {
+      delete *j;
+    }
+  }
+}
+
+bool TokenPipeline::next_tokens(std::deque<Node *> &tokens, int &line, int &col, uint64_t &offset) {
+  if (m_done) {
+    if (m_error) {
+      std::rethrow_exception(m_error);
+    }
+    return false;
+  }
+
+  // m_stop is only set by the destructor, so this waits until
+  // the producer sends a batch
+  Batch *batch = nullptr;
+  if (!m_full.pop(batch, m_stop)) {
+    m_done = true;
+    return false;
+  }
+
+  bool got_tokens = !batch->tokens.empty();
+  tokens.insert(tokens.end(), batch->tokens.begin(), batch->tokens.end());
+  batch->tokens.clear();
+  line = batch->line;
+  col = batch->col;
+  offset = batch->offset;
+  m_done = batch->last;
+
+  // the free queue has room for every batch, so this never waits
+  bool pushed = m_free.push(batch, m_stop);
+  assert(pushed);
+  (void) pushed;
+
+  // a lexing error is thrown after the tokens preceding it are consumed
+  if (m_done && !got_tokens) {
+    return next_tokens(tokens, line, col, offset);
+  }
+  return got_tokens;
+}
+
+// Producer thread: lex the input into batches until the end of
+// input, an error, or the pipeline being destroyed
+void TokenPipeline::produce() {
+  trace_set_thread_name("lexer");
+  TRACE_SPAN("lex");
+
+  bool last = false;
+  while (!last) {
+    Batch *batch;
+    if (!m_free.pop(batch, m_stop)) {
+      return;
+    }
+
+    try {
+      while (batch->tokens.size() < m_batch_size) {
+        if (!m_lexer->peek(1)) {
+          last = true;
+          break;
+        }
+        batch->tokens.push_back(m_lexer->next());
+      }
+    } catch (...) {
+      // the consumer rethrows the error when it reaches it
+      m_error = std::current_exception();
+      last = true;
+    }
+
+    Location loc = m_lexer->get_current_loc();
+    batch->line = loc.get_line();
+    batch->col = loc.get_col();
+    batch->offset = m_lexer->get_offset();
+    batch->last = last;
+    if (!m_full.push(batch, m_stop)) {
+      return;
+    }
+  }
+}
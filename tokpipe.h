@@ -0,0 +1,66 @@
+#ifndef TOKPIPE_H
+#define TOKPIPE_H
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "lexer.h"
+#include "spscqueue.h"
+
+// Token source that lexes its input on a separate (producer) thread,
+// so that a large input can be lexed and parsed at the same time.
+// To parse with a pipeline, create a Lexer that passes on its tokens:
+//
+//   Parser2 parser(new Lexer(new TokenPipeline(new Lexer(in, filename)), filename));
+//
+// The producer thread lexes tokens in batches, which it passes to the
+// consumer (the thread calling next_tokens) through a lock-free SPSC
+// queue.  Batches are recycled through a second queue going the other
+// way, so there is a fixed number of them: once they are all full,
+// the producer waits for the consumer to catch up.
+class TokenPipeline : public TokenSource {
+public:
+  static const size_t DEFAULT_BATCH_SIZE = 512;   // tokens per batch
+  static const size_t DEFAULT_NUM_BATCHES = 64;
+
+private:
+  struct Batch {
+    std::vector<Node *> tokens;
+    int line, col;   // source position following the batch's tokens
+    uint64_t offset;
+    bool last;       // true if the batch ends the input
+  };
+
+  std::unique_ptr<Lexer> m_lexer;   // used only by the producer thread
+  size_t m_batch_size;
+  std::vector<std::unique_ptr<Batch>> m_batches;
+  SPSCQueue<Batch *> m_full;        // producer to consumer
+  SPSCQueue<Batch *> m_free;        // consumer to producer
+  std::atomic<bool> m_stop;
+  std::exception_ptr m_error;       // set before the last batch is sent
+  std::thread m_thread;
+  bool m_done;
+
+  // no value semantics
+  TokenPipeline(const TokenPipeline &);
+  TokenPipeline &operator=(const TokenPipeline &);
+
+public:
+  // Start lexing on the producer thread, taking ownership of the lexer
+  TokenPipeline(Lexer *lexer_to_adopt, size_t batch_size = DEFAULT_BATCH_SIZE,
+                size_t num_batches = DEFAULT_NUM_BATCHES);
+
+  // Stops the producer thread (if it hasn't finished), and deletes
+  // any tokens that weren't consumed
+  virtual ~TokenPipeline();
+
+  virtual bool next_tokens(std::deque<Node *> &tokens, int &line, int &col, uint64_t &offset);
+
+private:
+  void produce();
+};
+
+#endif // TOKPIPE_H
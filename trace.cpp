@@ -0,0 +1,250 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include "exceptions.h"
+#include "outbuf.h"
+#include "trace.h"
+
+#ifdef ASTDEMO_TRACE
+
+namespace {
+
+const unsigned EVENTS_PER_CHUNK = 4096;
+
+struct TraceEvent {
+  const char *name;
+  const char *detail;
+  uint64_t start, end; // ns since trace_start
+};
+
+// A thread's events are stored in a list of chunks.  Only the owning
+// thread appends events; it publishes each one by storing the chunk's
+// new count with release ordering, so the thread writing the trace
+// sees complete events without any locking.
+struct TraceChunk {
+  TraceEvent events[EVENTS_PER_CHUNK];
+  std::atomic<unsigned> count;
+  std::atomic<TraceChunk *> next;
+
+  TraceChunk() : count(0), next(nullptr) { }
+};
+
+struct TraceBuffer {
+  unsigned tid;
+  std::string thread_name;
+  TraceChunk *head, *tail;
+  TraceBuffer *next;
+};
+
+std::atomic<bool> g_enabled;
+std::atomic<TraceBuffer *> g_buffers; // list of all threads' buffers
+std::atomic<unsigned> g_num_buffers;
+uint64_t g_start_ns;
+std::string g_filename;
+
+// Buffers are never freed, since their threads may still be running
+// when the trace is written
+thread_local TraceBuffer *tl_buffer;
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000UL + uint64_t(ts.tv_nsec);
+}
+
+TraceBuffer *get_buffer() {
+  if (!tl_buffer) {
+    TraceBuffer *buf = new TraceBuffer;
+    buf->tid = g_num_buffers.fetch_add(1) + 1;
+    buf->head = buf->tail = new TraceChunk;
+    buf->next = g_buffers.load();
+    while (!g_buffers.compare_exchange_weak(buf->next, buf)) {
+    }
+    tl_buffer = buf;
+  }
+  return tl_buffer;
+}
+
+void record(const char *name, const char *detail, uint64_t start, uint64_t end) {
+  TraceBuffer *buf = get_buffer();
+  TraceChunk *chunk = buf->tail;
+  unsigned n = chunk->count.load(std::memory_order_relaxed);
+  if (n == EVENTS_PER_CHUNK) {
+    TraceChunk *fresh = new TraceChunk;
+    chunk->next.store(fresh, std::memory_order_release);
+    buf->tail = chunk = fresh;
+    n = 0;
+  }
+  TraceEvent &ev = chunk->events[n];
+  ev.name = name;
+  ev.detail = detail;
+  ev.start = start - g_start_ns;
+  ev.end = end - g_start_ns;
+  chunk->count.store(n + 1, std::memory_order_release);
+}
+
+void write_quoted(const char *s, OutputBuffer &out) {
+  static const char hex[] = "0123456789abcdef";
+
+  out.put('"');
+  for (; *s; s++) {
+    unsigned char c = static_cast<unsigned char>(*s);
+    if (c == '"' || c == '\\') {
+      out.put('\\');
+      out.put(char(c));
+    } else if (c < 0x20) {
+      out.write("\\u00", 4);
+      out.put(hex[c >> 4]);
+      out.put(hex[c & 0xF]);
+    } else {
+      out.put(char(c));
+    }
+  }
+  out.put('"');
+}
+
+// Write a time in ns as microseconds (the unit of trace event times)
+void write_usecs(uint64_t ns, OutputBuffer &out) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%lu.%03u", (unsigned long) (ns / 1000), unsigned(ns % 1000));
+  out.write(buf, size_t(len));
+}
+
+void write_event(const TraceEvent &ev, unsigned tid, OutputBuffer &out) {
+  out.write("{\"name\":", 8);
+  write_quoted(ev.name, out);
+  out.write(",\"cat\":\"astdemo\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+  out.write_uint(tid);
+  out.write(",\"ts\":", 6);
+  write_usecs(ev.start, out);
+  out.write(",\"dur\":", 7);
+  write_usecs(ev.end - ev.start, out);
+  if (ev.detail) {
+    out.write(",\"args\":{\"detail\":", 18);
+    write_quoted(ev.detail, out);
+    out.put('}');
+  }
+  out.put('}');
+}
+
+void write_trace(FILE *f) {
+  FileSink sink(f);
+  OutputBuffer out(sink);
+
+  out.write("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  out.write("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"astdemo\"}}");
+
+  for (TraceBuffer *buf = g_buffers.load(); buf; buf = buf->next) {
+    out.write(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+    out.write_uint(buf->tid);
+    out.write(",\"args\":{\"name\":");
+    if (buf->thread_name.empty()) {
+      std::string name = "thread " + std::to_string(buf->tid);
+      write_quoted(name.c_str(), out);
+    } else {
+      write_quoted(buf->thread_name.c_str(), out);
+    }
+    out.write("}}");
+
+    TraceChunk *chunk = buf->head;
+    while (chunk) {
+      unsigned n = chunk->count.load(std::memory_order_acquire);
+      for (unsigned i = 0; i < n; i++) {
+        out.write(",\n", 2);
+        write_event(chunk->events[i], buf->tid, out);
+      }
+      chunk = chunk->next.load(std::memory_order_acquire);
+    }
+  }
+
+  out.write("\n]}\n");
+  out.flush();
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// TraceSpan implementation
+////////////////////////////////////////////////////////////////////////
+
+TraceSpan::TraceSpan(const char *name, const char *detail)
+  : m_name(nullptr)
+  , m_detail(detail)
+  , m_start(0) {
+  if (g_enabled.load(std::memory_order_relaxed)) {
+    m_name = name;
+    m_start = now_ns();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (m_name) {
+    record(m_name, m_detail, m_start, now_ns());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Trace control functions
+////////////////////////////////////////////////////////////////////////
+
+bool trace_enabled() {
+  return g_enabled.load(std::memory_order_relaxed);
+}
+
+bool trace_compiled_in() {
+  return true;
+}
+
+void trace_start(const char *filename) {
+  g_filename = filename;
+  g_start_ns = now_ns();
+  g_enabled.store(true);
+}
+
+void trace_set_thread_name(const char *name) {
+  // threads that never record spans don't get a buffer
+  if (!trace_enabled()) {
+    return;
+  }
+  get_buffer()->thread_name = name;
+}
+
+void trace_finish() {
+  if (!g_enabled.exchange(false)) {
+    return;
+  }
+
+  FILE *f = fopen(g_filename.c_str(), "w");
+  if (!f) {
+    RuntimeError::raise("Could not open trace file '%s'", g_filename.c_str());
+  }
+  try {
+    write_trace(f);
+  } catch (...) {
+    fclose(f);
+    throw;
+  }
+  if (fclose(f) != 0) {
+    RuntimeError::raise("Error writing trace file '%s'", g_filename.c_str());
+  }
+}
+
+#else
+
+bool trace_compiled_in() {
+  return false;
+}
+
+void trace_start(const char *) {
+  RuntimeError::raise("Tracing is not compiled in (build with \"make TRACE=1\")");
+}
+
+void trace_set_thread_name(const char *) {
+}
+
+void trace_finish() {
+}
+
+#endif
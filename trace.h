@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Span tracing, for seeing how the work of a run is distributed over
+// threads and time.  A span records the start time and duration of a
+// scope, e.g.
+//
+//   {
+//     TRACE_SPAN_DETAIL("parse", filename);
+//     root = parser->parse();
+//   }
+//
+// Spans are recorded only after trace_start has been called, and the
+// trace is written by trace_finish as Chrome trace event JSON (which
+// can be loaded in Perfetto or chrome://tracing.)
+//
+// Tracing is compiled in only if ASTDEMO_TRACE is defined (build with
+// "make TRACE=1", after a "make clean"); otherwise the TRACE_SPAN
+// macros expand to nothing, and trace_start raises a RuntimeError.
+//
+// Each thread records its spans in its own buffer, which only that
+// thread writes, so recording a span takes no locks.  Span names and
+// details are not copied: they must remain valid until the trace is
+// written (string literals and argv strings are fine.)
+
+#ifdef ASTDEMO_TRACE
+
+#include <cstdint>
+
+class TraceSpan {
+private:
+  const char *m_name;
+  const char *m_detail;
+  uint64_t m_start;
+
+  // no value semantics
+  TraceSpan(const TraceSpan &);
+  TraceSpan &operator=(const TraceSpan &);
+
+public:
+  TraceSpan(const char *name, const char *detail = nullptr);
+  ~TraceSpan();
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SPAN(name) \
+  TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define TRACE_SPAN_DETAIL(name, detail) \
+  TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name, detail)
+
+// True if spans are being recorded
+bool trace_enabled();
+
+#else
+
+#define TRACE_SPAN(name)
+#define TRACE_SPAN_DETAIL(name, detail)
+
+inline bool trace_enabled() { return false; }
+
+#endif
+
+// True if tracing was compiled in
+bool trace_compiled_in();
+
+// Start recording spans, to be written to given file
+void trace_start(const char *filename);
+
+// Name the calling thread in the trace (the name is copied).  This
+// has no effect if tracing hasn't been started.
+void trace_set_thread_name(const char *name);
+
+// Stop recording, and write the trace file.  Spans still open in other
+// threads are not included.  Does nothing if tracing wasn't started.
+void trace_finish();
+
+#endif // TRACE_H
@@ -0,0 +1,140 @@
+#include <cctype>
+#include <vector>
+#include "treeemit.h"
+
+namespace {
+
+struct StackItem {
+  Node *n;
+  unsigned next_kid;
+};
+
+// Write a string as a JSON or S-expression string literal
+// (the escapes needed for S-expressions are a subset of JSON's)
+void write_quoted(const std::string &s, OutputBuffer &out) {
+  static const char hex[] = "0123456789abcdef";
+
+  out.put('"');
+  for (auto i = s.begin(); i != s.end(); ++i) {
+    unsigned char c = static_cast<unsigned char>(*i);
+    if (c == '"' || c == '\\') {
+      out.put('\\');
+      out.put(char(c));
+    } else if (c < 0x20) {
+      out.write("\\u00", 4);
+      out.put(hex[c >> 4]);
+      out.put(hex[c & 0xF]);
+    } else {
+      out.put(char(c));
+    }
+  }
+  out.put('"');
+}
+
+// Tag names (and their S-expression form) for a tree
+class SexpTagNames {
+private:
+  TagNameCache m_names;
+  std::vector<std::pair<int, std::string>> m_symbols;
+
+public:
+  SexpTagNames(const TreePrint &tags) : m_names(tags) { }
+
+  const std::string &lookup(int tag);
+};
+
+const std::string &SexpTagNames::lookup(int tag) {
+  for (auto i = m_symbols.begin(); i != m_symbols.end(); ++i) {
+    if (i->first == tag) {
+      return i->second;
+    }
+  }
+
+  const std::string &name = m_names.lookup(tag);
+  bool plain = !name.empty();
+  for (auto i = name.begin(); i != name.end(); ++i) {
+    unsigned char c = static_cast<unsigned char>(*i);
+    if (!isalnum(c) && c != '_' && c != '-') {
+      plain = false;
+    }
+  }
+  m_symbols.push_back({ tag, plain ? name : "|" + name + "|" });
+  return m_symbols.back().second;
+}
+
+}
+
+void emit_json(Node *t, const TreePrint &tags, OutputBuffer &out) {
+  TagNameCache names(tags);
+  std::vector<StackItem> stack;
+
+  auto open_node = [&](Node *n) {
+    out.write("{\"tag\":", 7);
+    write_quoted(names.lookup(n->get_tag()), out);
+    out.write(",\"line\":", 8);
+    out.write_int(n->get_loc().get_line());
+    out.write(",\"col\":", 7);
+    out.write_int(n->get_loc().get_col());
+    if (!n->get_str().empty()) {
+      out.write(",\"str\":", 7);
+      write_quoted(n->get_str(), out);
+    }
+    if (n->has_ival()) {
+      out.write(",\"value\":", 9);
+      out.write_int(n->get_ival());
+    }
+    if (n->get_num_kids() > 0) {
+      out.write(",\"kids\":[", 9);
+      stack.push_back({ n, 0 });
+    } else {
+      out.put('}');
+    }
+  };
+
+  open_node(t);
+  while (!stack.empty()) {
+    StackItem &top = stack.back();
+    if (top.next_kid == top.n->get_num_kids()) {
+      out.write("]}", 2);
+      stack.pop_back();
+      continue;
+    }
+    if (top.next_kid > 0) {
+      out.put(',');
+    }
+    open_node(top.n->get_kid(top.next_kid++));
+  }
+  out.put('\n');
+}
+
+void emit_sexp(Node *t, const TreePrint &tags, OutputBuffer &out) {
+  SexpTagNames names(tags);
+  std::vector<StackItem> stack;
+
+  auto open_node = [&](Node *n) {
+    out.put('(');
+    out.write(names.lookup(n->get_tag()));
+    if (!n->get_str().empty()) {
+      out.put(' ');
+      write_quoted(n->get_str(), out);
+    }
+    if (n->get_num_kids() > 0) {
+      stack.push_back({ n, 0 });
+    } else {
+      out.put(')');
+    }
+  };
+
+  open_node(t);
+  while (!stack.empty()) {
+    StackItem &top = stack.back();
+    if (top.next_kid == top.n->get_num_kids()) {
+      out.put(')');
+      stack.pop_back();
+      continue;
+    }
+    out.put(' ');
+    open_node(top.n->get_kid(top.next_kid++));
+  }
+  out.put('\n');
+}
@@ -0,0 +1,35 @@
+#ifndef TREEEMIT_H
+#define TREEEMIT_H
+
+#include "node.h"
+#include "outbuf.h"
+#include "treeprint.h"
+
+// Emitters for machine-readable forms of parse trees and ASTs.
+// The tag set is given by a TreePrint object (ParserTreePrint or
+// ASTTreePrint), which supplies the node tag names.
+//
+// Output is streamed to the output buffer as the tree is traversed,
+// without building any intermediate representation.  The traversal
+// is iterative, so very deep trees can be emitted; the only memory
+// used is a stack with one entry per level of the tree.
+//
+// Each tree is followed by a newline.
+
+// Emit a tree as JSON: each node is an object with "tag", "line" and
+// "col" members, a "str" member if the node has a string, a "value"
+// member if it is a decoded integer literal, and a "kids" array if it
+// has children.  For example:
+//
+//   {"tag":"ADD","line":1,"col":3,"kids":[{"tag":"VARREF","line":1,...
+void emit_json(Node *t, const TreePrint &tags, OutputBuffer &out);
+
+// Emit a tree as an S-expression: each node is a list whose first
+// element is the tag name, followed by the node's string (if any)
+// and its children.  Tag names that aren't plain symbols are written
+// between vertical bars.  For example:
+//
+//   (ADD (VARREF "a") (MULTIPLY (VARREF "b") (INT_LITERAL "3")))
+void emit_sexp(Node *t, const TreePrint &tags, OutputBuffer &out);
+
+#endif // TREEEMIT_H
@@ -23,67 +23,78 @@
 #include <cstdio>
 #include <cassert>
 #include "node.h"
+#include "outbuf.h"
 #include "treeprint.h"
 
 namespace {
 
-// pair of (index, num siblings):
-// index is which sibling we're currently printing
-typedef std::pair<int, int> StackItem;
+struct StackItem {
+  Node *n;
+  unsigned next_kid;
+};
 
 struct TreePrintContext {
-  std::vector<StackItem> stack;
-  const TreePrint *tp_obj;
+  OutputBuffer &out;
+  TagNameCache names;
 
-  TreePrintContext(const TreePrint *tp_obj_)
-    : tp_obj(tp_obj_) { }
+  // Indentation for children of the node on top of the stack:
+  // one "|  " or "   " segment for each ancestor below the root,
+  // depending on whether that ancestor has siblings left to print.
+  // It is extended and truncated as the traversal moves down
+  // and up the tree, rather than being rebuilt for every line.
+  std::string prefix;
 
-  void pushctx(int nsibs);
-  void popctx();
-  void print_node(Node *n);
-};
+  std::vector<StackItem> stack;
 
-void TreePrintContext::pushctx(int nsibs_) {
-  stack.push_back({ 0, nsibs_ });
-}
+  TreePrintContext(const TreePrint *tp_obj_, OutputBuffer &out_)
+    : out(out_), names(*tp_obj_) { }
 
-void TreePrintContext::popctx() {
-  stack.pop_back();
-}
+  void print_tree(Node *t);
+  void print_label(Node *n);
+};
 
-void TreePrintContext::print_node(Node *n) {
-  int depth = int(stack.size());
-  assert(depth > 0);
-  for (int i = 1; i < depth; i++) {
-    if (i == depth-1) {
-      printf("+--");
-    } else {
-      int level_index = stack[i].first;
-      int level_nsibs = stack[i].second;
-      if (level_index < level_nsibs) {
-        printf("|  ");
-      } else {
-        printf("   ");
+void TreePrintContext::print_tree(Node *t) {
+  print_label(t);
+  stack.push_back({ t, 0 });
+
+  // the traversal is iterative, so that very deep trees
+  // (long operator chains) can be printed
+  while (!stack.empty()) {
+    StackItem &top = stack.back();
+    Node *n = top.n;
+    unsigned nkids = n->get_num_kids();
+
+    if (top.next_kid == nkids) {
+      stack.pop_back();
+      if (!stack.empty()) {
+        prefix.resize(prefix.size() - 3);
       }
+      continue;
     }
-  }
 
-  int tag = n->get_tag();
-  std::string str = n->get_str();
+    Node *kid = n->get_kid(top.next_kid++);
+    bool more_sibs = top.next_kid < nkids;
 
-  printf("%s", tp_obj->node_tag_to_string(tag).c_str());
-  if (!str.empty()) {
-    printf("[%s]", str.c_str());
+    out.write(prefix);
+    out.write("+--", 3);
+    print_label(kid);
+
+    if (kid->get_num_kids() > 0) {
+      prefix.append(more_sibs ? "|  " : "   ", 3);
+      stack.push_back({ kid, 0 });
+    }
   }
-  printf("\n");
-  stack[depth-1].first++;
+}
 
-  int nkids = n->get_num_kids();
-  pushctx(nkids);
-  for (int i = 0; i < nkids; i++) {
-    print_node(n->get_kid(i));
+void TreePrintContext::print_label(Node *n) {
+  out.write(names.lookup(n->get_tag()));
+  const std::string &str = n->get_str();
+  if (!str.empty()) {
+    out.put('[');
+    out.write(str);
+    out.put(']');
   }
-  popctx();
+  out.put('\n');
 }
 
 } // end anonymous namespace
@@ -95,7 +106,17 @@ TreePrint::~TreePrint() {
 }
 
 void TreePrint::print(Node *t) const {
-  TreePrintContext ctx(this);
-  ctx.pushctx(1);
-  ctx.print_node(t);
+  FileSink sink(stdout);
+  print(t, sink);
+}
+
+void TreePrint::print(Node *t, OutputSink &sink) const {
+  OutputBuffer out(sink);
+  print(t, out);
+  out.flush();
+}
+
+void TreePrint::print(Node *t, OutputBuffer &out) const {
+  TreePrintContext ctx(this, out);
+  ctx.print_tree(t);
 }
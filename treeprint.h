@@ -22,16 +22,50 @@
 #define TREEPRINT_H
 
 #include <string>
+#include <utility>
+#include <vector>
 struct Node;
+class OutputSink;
+class OutputBuffer;
 
 class TreePrint {
 public:
   TreePrint();
   virtual ~TreePrint();
 
+  // Print tree to standard output
   void print(Node *t) const;
 
+  // Print tree to given sink (output is buffered, and flushed
+  // to the sink when the tree has been printed)
+  void print(Node *t, OutputSink &sink) const;
+
+  // Print tree to given output buffer (which is not flushed)
+  void print(Node *t, OutputBuffer &out) const;
+
   virtual std::string node_tag_to_string(int tag) const = 0;
 };
 
+// Cache of the names of node tags, so that code emitting many nodes
+// calls TreePrint::node_tag_to_string only once per distinct tag.
+// Trees use only a few distinct tags, so a linear search is fastest.
+class TagNameCache {
+private:
+  const TreePrint &m_tp;
+  std::vector<std::pair<int, std::string>> m_names;
+
+public:
+  TagNameCache(const TreePrint &tp) : m_tp(tp) { }
+
+  const std::string &lookup(int tag) {
+    for (auto i = m_names.begin(); i != m_names.end(); ++i) {
+      if (i->first == tag) {
+        return i->second;
+      }
+    }
+    m_names.push_back({ tag, m_tp.node_tag_to_string(tag) });
+    return m_names.back().second;
+  }
+};
+
 #endif // TREEPRINT_H
@@ -0,0 +1,64 @@
+#include <utility>
+#include <vector>
+#include "treeutil.h"
+
+size_t count_nodes(const Node *t) {
+  size_t count = 0;
+  std::vector<const Node *> work;
+  work.push_back(t);
+  while (!work.empty()) {
+    const Node *n = work.back();
+    work.pop_back();
+    count++;
+    for (auto i = n->cbegin(); i != n->cend(); ++i) {
+      work.push_back(*i);
+    }
+  }
+  return count;
+}
+
+size_t tree_depth(const Node *t) {
+  size_t max_depth = 0;
+  std::vector<std::pair<const Node *, size_t>> work;
+  work.push_back({ t, 1 });
+  while (!work.empty()) {
+    const Node *n = work.back().first;
+    size_t depth = work.back().second;
+    work.pop_back();
+    if (depth > max_depth) {
+      max_depth = depth;
+    }
+    for (auto i = n->cbegin(); i != n->cend(); ++i) {
+      work.push_back({ *i, depth + 1 });
+    }
+  }
+  return max_depth;
+}
+
+bool trees_equal(const Node *a, const Node *b, bool compare_locs) {
+  std::vector<std::pair<const Node *, const Node *>> work;
+  work.push_back({ a, b });
+  while (!work.empty()) {
+    const Node *x = work.back().first, *y = work.back().second;
+    work.pop_back();
+
+    if (x->get_tag() != y->get_tag()
+        || x->get_str() != y->get_str()
+        || x->get_num_kids() != y->get_num_kids()) {
+      return false;
+    }
+    if (compare_locs) {
+      const Location &xloc = x->get_loc(), &yloc = y->get_loc();
+      if (xloc.get_line() != yloc.get_line()
+          || xloc.get_col() != yloc.get_col()
+          || xloc.get_srcfile() != yloc.get_srcfile()) {
+        return false;
+      }
+    }
+
+    for (unsigned i = 0; i < x->get_num_kids(); i++) {
+      work.push_back({ x->get_kid(i), y->get_kid(i) });
+    }
+  }
+  return true;
+}
@@ -0,0 +1,22 @@
+#ifndef TREEUTIL_H
+#define TREEUTIL_H
+
+#include <cstddef>
+#include "node.h"
+
+// Utility functions for trees.  These are iterative, so they
+// work on arbitrarily deep trees.
+
+// Count the number of nodes in a tree
+size_t count_nodes(const Node *t);
+
+// Depth of a tree: the number of nodes on its longest path
+// from the root to a leaf
+size_t tree_depth(const Node *t);
+
+// Check whether two trees are identical: same shape, and same tags
+// and strings in corresponding nodes.  If compare_locs is true,
+// source locations must also be the same.
+bool trees_equal(const Node *a, const Node *b, bool compare_locs = false);
+
+#endif // TREEUTIL_H
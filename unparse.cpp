@@ -0,0 +1,151 @@
+#include <charconv>
+#include <vector>
+#include "ast.h"
+#include "exceptions.h"
+#include "unparse.h"
+
+namespace {
+
+// Output adapter for appending to a string, with the
+// same interface as OutputBuffer
+class StringOutput {
+private:
+  std::string &m_str;
+
+public:
+  StringOutput(std::string &str) : m_str(str) { }
+
+  void put(char c) { m_str.push_back(c); }
+  void write(const char *data, size_t len) { m_str.append(data, len); }
+  void write(const std::string &s) { m_str.append(s); }
+
+  void write_int(int64_t val) {
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), val);
+    m_str.append(buf, result.ptr);
+  }
+};
+
+// Binding strength of an AST node: operands bound less
+// tightly than their operator must be parenthesized
+enum {
+  PREC_ADDITIVE = 1,
+  PREC_MULTIPLICATIVE,
+  PREC_PRIMARY,
+};
+
+int precedence(const Node *n) {
+  switch (n->get_tag()) {
+  case AST_ADD: case AST_SUB:
+    return PREC_ADDITIVE;
+  case AST_MULTIPLY: case AST_DIVIDE:
+    return PREC_MULTIPLICATIVE;
+  default:
+    return PREC_PRIMARY;
+  }
+}
+
+const char *operator_text(int tag) {
+  switch (tag) {
+  case AST_ADD:      return " + ";
+  case AST_SUB:      return " - ";
+  case AST_MULTIPLY: return " * ";
+  default:           return " / ";
+  }
+}
+
+struct StackItem {
+  const Node *n;
+  unsigned next_kid;
+  bool parens;
+};
+
+template<typename Out>
+void unparse_tree(const Node *t, Out &out) {
+  std::vector<StackItem> stack;
+  stack.push_back({ t, 0, false });
+
+  while (!stack.empty()) {
+    StackItem &top = stack.back();
+    const Node *n = top.n;
+
+    switch (n->get_tag()) {
+    case AST_VARREF:
+      out.write(n->get_str());
+      stack.pop_back();
+      break;
+
+    case AST_INT_LITERAL:
+      if (n->has_ival()) {
+        out.write_int(n->get_ival());
+      } else {
+        out.write(n->get_str());
+      }
+      stack.pop_back();
+      break;
+
+    case AST_ADD: case AST_SUB: case AST_MULTIPLY: case AST_DIVIDE:
+      {
+        // operators are left associative, so a right operand at the
+        // same precedence level needs parentheses, but a left one doesn't
+        int prec = precedence(n);
+        if (top.next_kid == 0) {
+          if (top.parens) {
+            out.put('(');
+          }
+          top.next_kid = 1;
+          const Node *lhs = n->get_kid(0);
+          stack.push_back({ lhs, 0, precedence(lhs) < prec });
+        } else if (top.next_kid == 1) {
+          out.write(operator_text(n->get_tag()), 3);
+          top.next_kid = 2;
+          const Node *rhs = n->get_kid(1);
+          stack.push_back({ rhs, 0, precedence(rhs) <= prec });
+        } else {
+          if (top.parens) {
+            out.put(')');
+          }
+          stack.pop_back();
+        }
+      }
+      break;
+
+    case AST_ASSIGN:
+      if (top.next_kid == 0) {
+        out.write(n->get_kid(0)->get_str());
+        out.write(" = ", 3);
+        top.next_kid = 1;
+        stack.push_back({ n->get_kid(1), 0, false });
+      } else {
+        out.put(';');
+        stack.pop_back();
+      }
+      break;
+
+    case AST_STATEMENT_LIST:
+      if (top.next_kid < n->get_num_kids()) {
+        if (top.next_kid > 0) {
+          out.put('\n');
+        }
+        stack.push_back({ n->get_kid(top.next_kid++), 0, false });
+      } else {
+        stack.pop_back();
+      }
+      break;
+
+    default:
+      RuntimeError::raise("Cannot unparse node type %d", n->get_tag());
+    }
+  }
+}
+
+}
+
+void unparse(const Node *t, OutputBuffer &out) {
+  unparse_tree(t, out);
+}
+
+void unparse(const Node *t, std::string &out) {
+  StringOutput str_out(out);
+  unparse_tree(t, str_out);
+}
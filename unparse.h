@@ -0,0 +1,31 @@
+#ifndef UNPARSE_H
+#define UNPARSE_H
+
+#include <string>
+#include "node.h"
+#include "outbuf.h"
+
+// Unparser: turns an AST (as built by Parser2 or buildast) back into
+// source text.  Only the parentheses required by operator precedence
+// and left associativity are written, and binary operators are
+// surrounded by single spaces, so unparsing gives a canonical form
+// of an expression:
+//
+//   ((a - (b * 3)) - (4 * c))   unparses as   a - b * 3 - 4 * c
+//   a - (b - c)                 unparses as   a - (b - c)
+//
+// Decoded integer literals are written as their values (so "007"
+// becomes "7".)  A statement list is written one statement per line,
+// with no newline after the last one.
+//
+// The traversal is iterative, so very long operator chains can be
+// unparsed.  Throws RuntimeError if the tree contains a node that
+// isn't part of an AST.
+
+// Write the source text for a tree to an output buffer
+void unparse(const Node *t, OutputBuffer &out);
+
+// Append the source text for a tree to a string
+void unparse(const Node *t, std::string &out);
+
+#endif // UNPARSE_H
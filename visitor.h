@@ -0,0 +1,220 @@
+#ifndef VISITOR_H
+#define VISITOR_H
+
+#include <utility>
+#include <vector>
+#include "node.h"
+#include "token.h"
+#include "parser.h"
+#include "ast.h"
+
+// Tree visitors with static dispatch on node tags.
+//
+// A visitor is a class derived from TreeVisitor<Derived>, which
+// defines visit methods for the tags it is interested in, e.g.
+//
+//   class CountAdds : public TreeVisitor<CountAdds> {
+//   public:
+//     size_t count = 0;
+//     WalkAction visit_add(Node *) { count++; return WALK_CONTINUE; }
+//   };
+//
+//   CountAdds v;
+//   walk_preorder(ast, v);
+//
+// dispatch() switches on the node's tag and calls the Derived class's
+// method for it.  The calls are resolved at compile time (and can be
+// inlined), rather than going through a virtual function.  A tag the
+// Derived class has no method for falls back to the method for its
+// group of tags (visit_binary for the arithmetic operators, visit_ast
+// for all ASTKind tags, visit_nonterminal, visit_token), and finally
+// to visit_node, which by default does nothing.
+//
+// The second template parameter is the node type: use const Node for
+// a visitor that doesn't modify the tree.
+
+// What a walk should do after visiting a node
+enum WalkAction {
+  WALK_CONTINUE,  // keep going
+  WALK_SKIP,      // don't visit the node's kids (preorder walks only)
+  WALK_STOP,      // end the walk
+};
+
+template<typename Derived, typename N = Node>
+class TreeVisitor {
+public:
+  typedef N NodeType;
+
+  WalkAction dispatch(N *n) {
+    Derived &d = static_cast<Derived &>(*this);
+    switch (n->get_tag()) {
+    case AST_ADD:              return d.visit_add(n);
+    case AST_SUB:              return d.visit_sub(n);
+    case AST_MULTIPLY:         return d.visit_multiply(n);
+    case AST_DIVIDE:           return d.visit_divide(n);
+    case AST_VARREF:           return d.visit_varref(n);
+    case AST_INT_LITERAL:      return d.visit_int_literal(n);
+    case AST_ASSIGN:           return d.visit_assign(n);
+    case AST_STATEMENT_LIST:   return d.visit_statement_list(n);
+
+    case NODE_E:               return d.visit_E(n);
+    case NODE_EPrime:          return d.visit_EPrime(n);
+    case NODE_T:               return d.visit_T(n);
+    case NODE_TPrime:          return d.visit_TPrime(n);
+    case NODE_F:               return d.visit_F(n);
+
+    case TOK_IDENTIFIER:       return d.visit_identifier(n);
+    case TOK_INTEGER_LITERAL:  return d.visit_integer_literal(n);
+    case TOK_PLUS:
+    case TOK_MINUS:
+    case TOK_TIMES:
+    case TOK_DIVIDE:
+    case TOK_LPAREN:
+    case TOK_RPAREN:
+    case TOK_ASSIGN:
+    case TOK_SEMICOLON:        return d.visit_punct(n);
+
+    default:                   return d.visit_node(n);
+    }
+  }
+
+  // Default methods: each forwards to the method for its group
+  WalkAction visit_add(N *n)            { return self().visit_binary(n); }
+  WalkAction visit_sub(N *n)            { return self().visit_binary(n); }
+  WalkAction visit_multiply(N *n)       { return self().visit_binary(n); }
+  WalkAction visit_divide(N *n)         { return self().visit_binary(n); }
+  WalkAction visit_binary(N *n)         { return self().visit_ast(n); }
+  WalkAction visit_varref(N *n)         { return self().visit_ast(n); }
+  WalkAction visit_int_literal(N *n)    { return self().visit_ast(n); }
+  WalkAction visit_assign(N *n)         { return self().visit_ast(n); }
+  WalkAction visit_statement_list(N *n) { return self().visit_ast(n); }
+  WalkAction visit_ast(N *n)            { return self().visit_node(n); }
+
+  WalkAction visit_E(N *n)              { return self().visit_nonterminal(n); }
+  WalkAction visit_EPrime(N *n)         { return self().visit_nonterminal(n); }
+  WalkAction visit_T(N *n)              { return self().visit_nonterminal(n); }
+  WalkAction visit_TPrime(N *n)         { return self().visit_nonterminal(n); }
+  WalkAction visit_F(N *n)              { return self().visit_nonterminal(n); }
+  WalkAction visit_nonterminal(N *n)    { return self().visit_node(n); }
+
+  WalkAction visit_identifier(N *n)     { return self().visit_token(n); }
+  WalkAction visit_integer_literal(N *n) { return self().visit_token(n); }
+  WalkAction visit_punct(N *n)          { return self().visit_token(n); }
+  WalkAction visit_token(N *n)          { return self().visit_node(n); }
+
+  WalkAction visit_node(N *)            { return WALK_CONTINUE; }
+
+private:
+  Derived &self() { return static_cast<Derived &>(*this); }
+};
+
+// The walks are iterative, so they work on arbitrarily deep trees.
+// Each returns false if the visitor stopped the walk (by returning
+// WALK_STOP), and true otherwise.  A walker object keeps its stack
+// between walks, to avoid allocating it each time.
+
+template<typename N = Node>
+class TreeWalker {
+private:
+  std::vector<N *> m_preorder;
+  std::vector<std::pair<N *, unsigned>> m_postorder;
+
+  // no value semantics
+  TreeWalker(const TreeWalker &);
+  TreeWalker &operator=(const TreeWalker &);
+
+public:
+  TreeWalker() { }
+
+  // Visit each node before its kids, left to right (the same order
+  // as Node::preorder).  Returning WALK_SKIP from a visit method
+  // skips the node's kids.
+  template<typename Visitor>
+  bool preorder(N *t, Visitor &v) {
+    m_preorder.clear();
+    m_preorder.push_back(t);
+    while (!m_preorder.empty()) {
+      N *n = m_preorder.back();
+      m_preorder.pop_back();
+      WalkAction action = v.dispatch(n);
+      if (action == WALK_STOP) {
+        return false;
+      }
+      if (action == WALK_CONTINUE) {
+        // push the kids in reverse, so the leftmost is visited first
+        for (unsigned i = n->get_num_kids(); i > 0; i--) {
+          m_preorder.push_back(n->get_kid(i - 1));
+        }
+      }
+    }
+    return true;
+  }
+
+  // Visit each node after its kids, left to right.  WALK_SKIP is
+  // the same as WALK_CONTINUE.
+  template<typename Visitor>
+  bool postorder(N *t, Visitor &v) {
+    m_postorder.clear();
+    m_postorder.push_back({ t, 0 });
+    while (!m_postorder.empty()) {
+      N *n = m_postorder.back().first;
+      unsigned next_kid = m_postorder.back().second;
+      if (next_kid < n->get_num_kids()) {
+        m_postorder.back().second++;
+        N *kid = n->get_kid(next_kid);
+        if (kid->get_num_kids() == 0) {
+          // leaves (half of the nodes) don't need to be pushed
+          if (v.dispatch(kid) == WALK_STOP) {
+            return false;
+          }
+        } else {
+          m_postorder.push_back({ kid, 0 });
+        }
+        continue;
+      }
+      m_postorder.pop_back();
+      if (v.dispatch(n) == WALK_STOP) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+template<typename Visitor>
+bool walk_preorder(typename Visitor::NodeType *t, Visitor &v) {
+  TreeWalker<typename Visitor::NodeType> walker;
+  return walker.preorder(t, v);
+}
+
+template<typename Visitor>
+bool walk_postorder(typename Visitor::NodeType *t, Visitor &v) {
+  TreeWalker<typename Visitor::NodeType> walker;
+  return walker.postorder(t, v);
+}
+
+// Early-exit search: the first node, in preorder, for which pred
+// returns true, or nullptr if there is none
+template<typename N, typename Pred>
+N *find_node(N *t, Pred pred) {
+  struct Finder : public TreeVisitor<Finder, N> {
+    Pred &pred;
+    N *found;
+
+    Finder(Pred &pred_) : pred(pred_), found(nullptr) { }
+
+    WalkAction visit_node(N *n) {
+      if (pred(n)) {
+        found = n;
+        return WALK_STOP;
+      }
+      return WALK_CONTINUE;
+    }
+  };
+
+  Finder finder(pred);
+  walk_preorder(t, finder);
+  return finder.found;
+}
+
+#endif // VISITOR_H
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include "exceptions.h"
+#include "workload.h"
+
+namespace {
+
+const char OPERATORS[] = { '+', '-', '*', '/' };
+
+// maximum number of digits in a literal that is always
+// in the range of int64_t
+const unsigned MAX_LITERAL_DIGITS = 18;
+
+struct ChainFrame {
+  unsigned depth;
+  unsigned remaining;  // operands not generated yet
+  bool first;
+};
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// WorkloadShape implementation
+////////////////////////////////////////////////////////////////////////
+
+WorkloadShape::WorkloadShape()
+  : op_weights{ 3, 2, 3, 1 }
+  , chain_min(2), chain_max(5)
+  , max_depth(4), paren_prob(0.2)
+  , literal_prob(0.3)
+  , ident_min(1), ident_max(6)
+  , ident_alphabet("abcdefghijklmnopqrstuvwxyz0123456789")
+  , vocab_size(0)
+  , literal_min(1), literal_max(3)
+  , ws_density(1.0)
+  , ws_newlines(false)
+  , safe_division(true) {
+}
+
+void WorkloadShape::validate() const {
+  if (op_weights[0] + op_weights[1] + op_weights[2] + op_weights[3] == 0) {
+    RuntimeError::raise("At least one operator must have a nonzero weight");
+  }
+  if (chain_min < 1 || chain_min > chain_max) {
+    RuntimeError::raise("Invalid chain length range %u-%u", chain_min, chain_max);
+  }
+  if (paren_prob < 0.0 || paren_prob > 1.0 || literal_prob < 0.0 || literal_prob > 1.0) {
+    RuntimeError::raise("Probabilities must be between 0 and 1");
+  }
+  if (ident_min < 1 || ident_min > ident_max) {
+    RuntimeError::raise("Invalid identifier length range %u-%u", ident_min, ident_max);
+  }
+  bool has_letter = false;
+  for (auto i = ident_alphabet.begin(); i != ident_alphabet.end(); ++i) {
+    unsigned char c = static_cast<unsigned char>(*i);
+    if (!isalnum(c)) {
+      RuntimeError::raise("Identifier alphabet contains invalid character '%c'", c);
+    }
+    has_letter = has_letter || isalpha(c);
+  }
+  if (!has_letter) {
+    RuntimeError::raise("Identifier alphabet must contain at least one letter");
+  }
+  if (literal_min < 1 || literal_min > literal_max || literal_max > MAX_LITERAL_DIGITS) {
+    RuntimeError::raise("Invalid literal length range %u-%u (at most %u digits)",
+                        literal_min, literal_max, MAX_LITERAL_DIGITS);
+  }
+  if (ws_density < 0.0) {
+    RuntimeError::raise("Whitespace density must not be negative");
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// WorkloadGen implementation
+////////////////////////////////////////////////////////////////////////
+
+WorkloadGen::WorkloadGen(const WorkloadShape &shape, uint64_t seed)
+  : m_shape(shape)
+  , m_state(seed)
+  , m_out(nullptr)
+  , m_bytes(0) {
+  m_shape.validate();
+  for (auto i = m_shape.ident_alphabet.begin(); i != m_shape.ident_alphabet.end(); ++i) {
+    if (isalpha(static_cast<unsigned char>(*i))) {
+      m_letters.push_back(*i);
+    }
+  }
+  for (unsigned i = 0; i < m_shape.vocab_size; i++) {
+    m_vocab.push_back(std::string());
+    make_ident(m_vocab.back());
+  }
+}
+
+WorkloadGen::~WorkloadGen() {
+}
+
+size_t WorkloadGen::generate(OutputBuffer &out) {
+  m_out = &out;
+  m_bytes = 0;
+
+  std::vector<ChainFrame> stack;
+  stack.push_back({ 0, random_in(m_shape.chain_min, m_shape.chain_max), true });
+  while (!stack.empty()) {
+    ChainFrame &f = stack.back();
+    if (f.remaining == 0) {
+      stack.pop_back();
+      if (!stack.empty()) {
+        emit_gap();
+        emit(')');
+      }
+      continue;
+    }
+
+    f.remaining--;
+    if (!f.first) {
+      char op = pick_operator(0, 4);
+      emit_gap();
+      emit(op);
+      emit_gap();
+      if (op == '/' && m_shape.safe_division) {
+        emit_literal(true);
+        continue;
+      }
+    }
+    f.first = false;
+
+    if (f.depth < m_shape.max_depth && chance(m_shape.paren_prob)) {
+      unsigned depth = f.depth + 1;
+      emit('(');
+      emit_gap();
+      stack.push_back({ depth, random_in(m_shape.chain_min, m_shape.chain_max), true });
+    } else {
+      emit_leaf();
+    }
+  }
+
+  m_out = nullptr;
+  return m_bytes;
+}
+
+size_t WorkloadGen::generate_nodes(OutputBuffer &out, size_t target_nodes) {
+  m_out = &out;
+  m_bytes = 0;
+  emit_chain(target_nodes > 0 ? target_nodes : 1, true);
+  m_out = nullptr;
+  return m_bytes;
+}
+
+std::string WorkloadGen::generate_nodes(size_t target_nodes) {
+  std::string src;
+  StringSink sink(src);
+  OutputBuffer out(sink);
+  generate_nodes(out, target_nodes);
+  out.flush();
+  return src;
+}
+
+std::string WorkloadGen::generate_sum(size_t size) {
+  std::string src;
+  StringSink sink(src);
+  OutputBuffer out(sink);
+  size_t bytes = 0;
+  for (unsigned i = 0; bytes < size; i++) {
+    if (i > 0) {
+      out.write(i % 3 == 0 ? " - " : " + ", 3);
+      bytes += 3;
+    }
+    bytes += generate(out);
+    if (i % 8 == 7) {
+      out.put('\n');
+      bytes++;
+    }
+  }
+  out.flush();
+  return src;
+}
+
+uint64_t WorkloadGen::random(uint64_t n) {
+  // multiply and shift rather than divide (Lemire's method,
+  // without the rejection step: the bias is negligible here)
+  return uint64_t((static_cast<unsigned __int128>(next_u64()) * n) >> 64);
+}
+
+unsigned WorkloadGen::random_in(unsigned min, unsigned max) {
+  return min + unsigned(random(uint64_t(max - min) + 1));
+}
+
+bool WorkloadGen::chance(double p) {
+  // 53 random bits give a uniform double in [0, 1)
+  return double(next_u64() >> 11) * 0x1.0p-53 < p;
+}
+
+uint64_t WorkloadGen::next_u64() {
+  // splitmix64
+  uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+void WorkloadGen::make_ident(std::string &s) {
+  const std::string &alphabet = m_shape.ident_alphabet;
+  unsigned len = random_in(m_shape.ident_min, m_shape.ident_max);
+  s.clear();
+  s.push_back(m_letters[random(m_letters.size())]);
+  for (unsigned i = 1; i < len; i++) {
+    s.push_back(alphabet[random(alphabet.size())]);
+  }
+}
+
+// Pick one of count operators, starting with OPERATORS[first],
+// according to their weights (with equal weights if all are zero)
+char WorkloadGen::pick_operator(unsigned first, unsigned count) {
+  unsigned total = 0;
+  for (unsigned i = first; i < first + count; i++) {
+    total += m_shape.op_weights[i];
+  }
+  if (total == 0) {
+    return OPERATORS[first + random(count)];
+  }
+  unsigned r = unsigned(random(total)), op = first;
+  while (r >= m_shape.op_weights[op]) {
+    r -= m_shape.op_weights[op];
+    op++;
+  }
+  return OPERATORS[op];
+}
+
+// Generate an operator chain of approximately n AST nodes (the
+// recursion is only as deep as the number of nested chains, which
+// grows with the logarithm of n)
+void WorkloadGen::emit_chain(size_t n, bool additive) {
+  if (n <= 2) {
+    emit_leaf();
+    return;
+  }
+
+  // a chain of k operands has k-1 operator nodes
+  size_t k = random_in(std::max(m_shape.chain_min, 2u), std::max(m_shape.chain_max, 2u));
+  if (2*k - 1 > n) {
+    k = (n + 1)/2;
+  }
+  size_t operand_nodes = (n - (k - 1))/k;
+
+  for (size_t i = 0; i < k; i++) {
+    if (i > 0) {
+      char op = pick_operator(additive ? 0 : 2, 2);
+      emit_gap();
+      emit(op);
+      emit_gap();
+      if (op == '/' && m_shape.safe_division) {
+        emit_literal(true);
+        continue;
+      }
+    }
+
+    if (additive) {
+      emit_chain(operand_nodes, false);
+    } else if (operand_nodes <= 2) {
+      emit_leaf();
+    } else {
+      emit('(');
+      emit_gap();
+      emit_chain(operand_nodes, true);
+      emit_gap();
+      emit(')');
+    }
+  }
+}
+
+void WorkloadGen::emit_gap() {
+  double whole = std::floor(m_shape.ws_density), frac = m_shape.ws_density - whole;
+  unsigned n = unsigned(whole) + (frac > 0.0 && chance(frac) ? 1 : 0);
+  for (unsigned i = 0; i < n; i++) {
+    unsigned r = unsigned(random(64));
+    emit(r == 0 && m_shape.ws_newlines ? '\n' : r == 1 ? '\t' : ' ');
+  }
+}
+
+void WorkloadGen::emit_leaf() {
+  if (chance(m_shape.literal_prob)) {
+    emit_literal(false);
+  } else if (!m_vocab.empty()) {
+    emit(m_vocab[random(m_vocab.size())]);
+  } else {
+    // generate the identifier directly into the output
+    const std::string &alphabet = m_shape.ident_alphabet;
+    unsigned len = random_in(m_shape.ident_min, m_shape.ident_max);
+    emit(m_letters[random(m_letters.size())]);
+    for (unsigned i = 1; i < len; i++) {
+      emit(alphabet[random(alphabet.size())]);
+    }
+  }
+}
+
+void WorkloadGen::emit_literal(bool nonzero) {
+  unsigned digits = random_in(m_shape.literal_min, m_shape.literal_max);
+  if (digits == 1 && !nonzero) {
+    emit(char('0' + random(10)));
+    return;
+  }
+  // no leading zeros
+  emit(char('1' + random(9)));
+  for (unsigned i = 1; i < digits; i++) {
+    emit(char('0' + random(10)));
+  }
+}
@@ -0,0 +1,122 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "outbuf.h"
+
+// Parameters controlling the shape of generated expressions
+struct WorkloadShape {
+  // relative weights of the +, -, *, and / operators
+  unsigned op_weights[4];
+
+  // number of operands in each operator chain (a chain is a flat
+  // sequence of operands and operators, such as a * b - c / d)
+  unsigned chain_min, chain_max;
+
+  // maximum nesting depth of parentheses, and probability that
+  // an operand is a parenthesized chain (if the depth allows it)
+  unsigned max_depth;
+  double paren_prob;
+
+  // probability that a leaf operand is an integer literal
+  // rather than an identifier
+  double literal_prob;
+
+  // identifiers: length range, and the characters they are made of
+  // (alphanumeric; identifiers start with one of the letters).  If
+  // vocab_size is nonzero, identifiers are drawn from a fixed set of
+  // that many, rather than generated fresh for each use.
+  unsigned ident_min, ident_max;
+  std::string ident_alphabet;
+  unsigned vocab_size;
+
+  // number of digits in integer literals (at most 18, so that
+  // literals are always in range)
+  unsigned literal_min, literal_max;
+
+  // average number of whitespace characters between tokens (mostly
+  // spaces, with occasional tabs, and newlines if ws_newlines is set)
+  double ws_density;
+  bool ws_newlines;
+
+  // if true, the right operand of / is always a nonzero literal,
+  // so that generated expressions can be evaluated
+  bool safe_division;
+
+  // The default shape resembles ordinary formulas
+  WorkloadShape();
+
+  // Check the parameters, throwing RuntimeError if they are invalid
+  void validate() const;
+};
+
+// Fast generator of expressions in the language accepted by Parser
+// and Parser2, with a configurable shape, for benchmarks and stress
+// tests.  Output is deterministic for a given seed and shape.
+class WorkloadGen {
+private:
+  WorkloadShape m_shape;
+  uint64_t m_state;
+  std::string m_letters;
+  std::vector<std::string> m_vocab;
+  OutputBuffer *m_out;
+  size_t m_bytes;
+
+  // no value semantics
+  WorkloadGen(const WorkloadGen &);
+  WorkloadGen &operator=(const WorkloadGen &);
+
+public:
+  // Throws RuntimeError if the shape is invalid
+  WorkloadGen(const WorkloadShape &shape, uint64_t seed);
+  ~WorkloadGen();
+
+  // Write one expression (without a trailing newline),
+  // returning the number of bytes written.  Generation is
+  // iterative, so deeply nested expressions can be generated.
+  size_t generate(OutputBuffer &out);
+
+  // Write an expression whose AST has approximately target_nodes
+  // nodes, returning the number of bytes written.  Additive chains
+  // (of + and -) alternate with multiplicative chains (of * and /),
+  // whose operands are leaves or parenthesized additive chains, so
+  // that the size of the parse tree can grow without making the
+  // parsers' recursion very deep.  Chain lengths (of at least 2
+  // operands), leaves and whitespace follow the shape, as do the
+  // weights of the operators within each kind of chain; max_depth
+  // and paren_prob are not used.
+  size_t generate_nodes(OutputBuffer &out, size_t target_nodes);
+
+  // The same, returning the expression
+  std::string generate_nodes(size_t target_nodes);
+
+  // Generate a long sum of about size bytes: expressions joined by
+  // + and -, with a newline after every eighth (Parser2 builds an AST
+  // with a left-deep spine as long as the sum for it)
+  std::string generate_sum(size_t size);
+
+  // Random number in the range [0, n)
+  uint64_t random(uint64_t n);
+
+  // Random number in the range [min, max]
+  unsigned random_in(unsigned min, unsigned max);
+
+  // Random event with probability p
+  bool chance(double p);
+
+private:
+  uint64_t next_u64();
+  void make_ident(std::string &s);
+  char pick_operator(unsigned first, unsigned count);
+  void emit_chain(size_t n, bool additive);
+  void emit(char c) { m_out->put(c); m_bytes++; }
+  void emit(const std::string &s) { m_out->write(s); m_bytes += s.size(); }
+  void emit_gap();
+  void emit_leaf();
+  void emit_literal(bool nonzero);
+};
+
+#endif // WORKLOAD_H
@@ -0,0 +1,161 @@
+#include <cassert>
+#include <string>
+#include "trace.h"
+#include "workpool.h"
+
+namespace {
+
+// Pool and deque index of the worker running on the current thread,
+// so that tasks submitted by tasks go to the submitting worker's deque
+thread_local WorkStealingPool *tl_pool = nullptr;
+thread_local int tl_worker_index = -1;
+
+}
+
+WorkStealingPool::WorkStealingPool(unsigned num_threads)
+  : m_next_victim(0)
+  , m_queued(0)
+  , m_unfinished(0)
+  , m_shutdown(false)
+  , m_steals(0) {
+  if (num_threads == 0) {
+    num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0) {
+      num_threads = 1;
+    }
+  }
+
+  for (unsigned i = 0; i < num_threads; i++) {
+    m_workers.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+  for (unsigned i = 0; i < num_threads; i++) {
+    m_threads.push_back(std::thread(&WorkStealingPool::worker_loop, this, i));
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> guard(m_sleep_lock);
+    m_shutdown = true;
+  }
+  m_wake.notify_all();
+  for (auto i = m_threads.begin(); i != m_threads.end(); ++i) {
+    i->join();
+  }
+}
+
+void WorkStealingPool::submit(Task task) {
+  unsigned index;
+  if (tl_pool == this) {
+    index = unsigned(tl_worker_index);
+  } else {
+    index = m_next_victim.fetch_add(1) % get_num_threads();
+  }
+
+  m_unfinished++;
+  {
+    Worker &w = *m_workers[index];
+    std::lock_guard<std::mutex> guard(w.lock);
+    w.tasks.push_back(std::move(task));
+  }
+  m_queued++;
+
+  // acquiring the sleep lock ensures that a worker that just
+  // found no work is either already waiting, or will see the new task
+  { std::lock_guard<std::mutex> guard(m_sleep_lock); }
+  m_wake.notify_one();
+}
+
+void WorkStealingPool::wait() {
+  assert(tl_pool != this);
+
+  // the waiting thread helps out until no queued work remains
+  Task task;
+  while (find_task(-1, task)) {
+    run_task(task);
+  }
+
+  std::unique_lock<std::mutex> guard(m_sleep_lock);
+  m_done.wait(guard, [this]() { return m_unfinished.load() == 0; });
+
+  if (m_error) {
+    std::exception_ptr error = m_error;
+    m_error = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void WorkStealingPool::worker_loop(unsigned index) {
+  tl_pool = this;
+  tl_worker_index = int(index);
+  std::string name = "worker " + std::to_string(index);
+  trace_set_thread_name(name.c_str());
+
+  Task task;
+  for (;;) {
+    if (find_task(int(index), task)) {
+      run_task(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> guard(m_sleep_lock);
+    m_wake.wait(guard, [this]() { return m_shutdown || m_queued.load() > 0; });
+    if (m_shutdown && m_queued.load() == 0) {
+      return;
+    }
+  }
+}
+
+bool WorkStealingPool::find_task(int index, Task &task) {
+  unsigned nworkers = get_num_threads();
+
+  // check own deque first (newest task)
+  if (index >= 0) {
+    Worker &w = *m_workers[index];
+    std::lock_guard<std::mutex> guard(w.lock);
+    if (!w.tasks.empty()) {
+      task = std::move(w.tasks.back());
+      w.tasks.pop_back();
+      m_queued--;
+      return true;
+    }
+  }
+
+  // steal the oldest task from some other worker's deque
+  unsigned start = m_next_victim.fetch_add(1);
+  for (unsigned i = 0; i < nworkers; i++) {
+    int victim = int((start + i) % nworkers);
+    if (victim == index) {
+      continue;
+    }
+    Worker &w = *m_workers[victim];
+    std::lock_guard<std::mutex> guard(w.lock);
+    if (!w.tasks.empty()) {
+      task = std::move(w.tasks.front());
+      w.tasks.pop_front();
+      m_queued--;
+      m_steals++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void WorkStealingPool::run_task(Task &task) {
+  try {
+    TRACE_SPAN("task");
+    task();
+  } catch (...) {
+    std::lock_guard<std::mutex> guard(m_sleep_lock);
+    if (!m_error) {
+      m_error = std::current_exception();
+    }
+  }
+  task = nullptr;
+
+  if (--m_unfinished == 0) {
+    std::lock_guard<std::mutex> guard(m_sleep_lock);
+    m_done.notify_all();
+  }
+}
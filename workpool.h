@@ -0,0 +1,71 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.  Each worker thread has its own deque of
+// tasks: a worker pushes and pops tasks at the back of its own deque
+// (so recently split work stays hot in its cache), and when its deque
+// is empty it steals from the front of another worker's deque (taking
+// the oldest, and typically largest, piece of work.)
+//
+// Tasks submitted from a worker thread go to that worker's deque, so a
+// task can split itself by submitting part of its work.  Tasks
+// submitted from other threads are distributed round robin.
+class WorkStealingPool {
+public:
+  typedef std::function<void()> Task;
+
+private:
+  struct Worker {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::vector<std::thread> m_threads;
+  std::atomic<unsigned> m_next_victim;
+  std::atomic<long> m_queued;      // tasks waiting in deques
+  std::atomic<long> m_unfinished;  // tasks submitted but not completed
+  std::mutex m_sleep_lock;
+  std::condition_variable m_wake, m_done;
+  bool m_shutdown;
+  std::exception_ptr m_error;
+  std::atomic<unsigned long> m_steals;
+
+  // no value semantics
+  WorkStealingPool(const WorkStealingPool &);
+  WorkStealingPool &operator=(const WorkStealingPool &);
+
+public:
+  // num_threads == 0 means use one thread per hardware thread
+  WorkStealingPool(unsigned num_threads = 0);
+  ~WorkStealingPool();
+
+  unsigned get_num_threads() const { return unsigned(m_workers.size()); }
+
+  // Number of tasks that have been stolen from another worker's deque
+  unsigned long get_num_steals() const { return m_steals.load(); }
+
+  void submit(Task task);
+
+  // Wait for all submitted tasks (including tasks they submit) to
+  // complete.  Must not be called from a task.  If any task threw an
+  // exception, the first such exception is rethrown.
+  void wait();
+
+private:
+  void worker_loop(unsigned index);
+  bool find_task(int index, Task &task);
+  void run_task(Task &task);
+};
+
+#endif // WORKPOOL_H